@@ -0,0 +1,430 @@
+//          Copyright Malte Skarupke 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "radix_sort.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// sorts files of fixed width records that don't fit into memory. the records
+// are split into 256 bucket files by the most significant byte of the key,
+// then every bucket is sorted in memory with radix_sort and appended to the
+// output. a bucket that is still too big gets split again by the next byte.
+// the reads and writes of the files run on a second thread, so they overlap
+// with the partitioning and the sorting. the sort is stable
+struct external_radix_sort_options
+{
+    // the sort allocates this many bytes and uses no other big buffers. a
+    // bucket has to fit into a third of it to be sorted in memory, so with
+    // 1 GB a 200 GB input gets split twice
+    std::size_t memory_budget = std::size_t(1) << 30;
+    // the directory for the bucket files. if it's empty, TMPDIR is used, or
+    // /tmp if that isn't set. the bucket files together are as big as the
+    // input at most
+    std::string temp_directory;
+};
+
+namespace detail
+{
+struct FileCloser
+{
+    void operator()(std::FILE * file) const
+    {
+        std::fclose(file);
+    }
+};
+typedef std::unique_ptr<std::FILE, FileCloser> unique_file;
+
+inline std::system_error file_error(const char * what, const std::string & path)
+{
+    return std::system_error(errno, std::generic_category(), std::string(what) + " " + path);
+}
+inline unique_file open_file(const std::string & path, const char * mode)
+{
+    unique_file file(std::fopen(path.c_str(), mode));
+    if (!file)
+        throw file_error("couldn't open", path);
+    return file;
+}
+inline std::uint64_t file_size(std::FILE * file, const std::string & path)
+{
+#ifdef _WIN32
+    bool failed = _fseeki64(file, 0, SEEK_END) != 0;
+    std::int64_t size = _ftelli64(file);
+    failed = failed || size < 0 || _fseeki64(file, 0, SEEK_SET) != 0;
+#else
+    bool failed = fseeko(file, 0, SEEK_END) != 0;
+    off_t size = ftello(file);
+    failed = failed || size < 0 || fseeko(file, 0, SEEK_SET) != 0;
+#endif
+    if (failed)
+        throw file_error("couldn't get the size of", path);
+    return static_cast<std::uint64_t>(size);
+}
+template<typename T>
+std::size_t read_records(std::FILE * file, T * records, std::size_t num_records, const std::string & path)
+{
+    std::size_t num_read = std::fread(records, sizeof(T), num_records, file);
+    if (num_read < num_records && std::ferror(file))
+        throw file_error("couldn't read from", path);
+    return num_read;
+}
+template<typename T>
+void write_records(std::FILE * file, const T * records, std::size_t num_records, const std::string & path)
+{
+    if (std::fwrite(records, sizeof(T), num_records, file) != num_records)
+        throw file_error("couldn't write to", path);
+}
+
+// a bucket file that gets deleted when it's no longer needed. the file is
+// only created when the first records are written to it
+struct TempFile
+{
+    std::string path;
+    unique_file file;
+    std::uint64_t num_records = 0;
+    // the most significant byte of the key that differs between the records
+    // of this file, or the size of the key if all keys are the same
+    size_t next_index = 0;
+
+    TempFile() = default;
+    TempFile(TempFile &&) = default;
+    TempFile & operator=(TempFile &&) = default;
+    ~TempFile()
+    {
+        remove();
+    }
+    void remove()
+    {
+        file.reset();
+        if (!path.empty())
+            std::remove(path.c_str());
+        path.clear();
+        num_records = 0;
+    }
+};
+
+// byte index of the key, counting from the most significant byte. the key
+// can be anything that FlatKey can split into scalars, so it is encoded with
+// to_unsigned the same way as for radix_sort
+template<typename Key>
+std::uint8_t external_key_byte(const Key & key, size_t index)
+{
+    size_t from_bottom = FusedRadixSorter<Key>::num_bytes - 1 - index;
+    std::uint8_t result = 0;
+    for_each_leaf([&](auto leaf)
+    {
+        constexpr size_t L = decltype(leaf)::value;
+        static_assert(FlatKeyLeaf<Key, L>::num_bytes <= sizeof(std::uint64_t), "the leaves are loaded as uint64_t");
+        if (from_bottom >= FlatKeyLeaf<Key, L>::offset && from_bottom < FlatKeyLeaf<Key, L>::offset + FlatKeyLeaf<Key, L>::num_bytes)
+        {
+            std::uint64_t value = FlatKey<Key>::template leaf<L>(key);
+            result = static_cast<std::uint8_t>(value >> ((from_bottom - FlatKeyLeaf<Key, L>::offset) * 8));
+        }
+    }, std::make_index_sequence<FlatKey<Key>::num_leaves>{});
+    return result;
+}
+
+template<typename T, typename ExtractKey>
+class ExternalRadixSort
+{
+public:
+    typedef typename std::decay<typename std::result_of<ExtractKey(const T &)>::type>::type key_type;
+    static_assert(std::is_trivially_copyable<T>::value, "external_radix_sort writes the records to files as bytes");
+    static_assert(FlatKey<key_type>::value, "external_radix_sort needs a key made of scalars, or pairs, tuples and arrays of scalars");
+    static constexpr size_t num_key_bytes = FusedRadixSorter<key_type>::num_bytes;
+    static constexpr size_t num_leaves = FlatKey<key_type>::num_leaves;
+
+    ExternalRadixSort(ExtractKey & extract_key, const external_radix_sort_options & options)
+        : extract_key(extract_key)
+        , temp_directory(options.temp_directory)
+        , memory(std::max(options.memory_budget / sizeof(T), std::size_t(4)))
+    {
+        if (temp_directory.empty())
+        {
+            const char * tmpdir = std::getenv("TMPDIR");
+            temp_directory = tmpdir && *tmpdir ? tmpdir : "/tmp";
+        }
+        std::random_device random;
+        temp_prefix = temp_directory + "/radix_sort_" + std::to_string(random()) + "_";
+    }
+
+    void sort(const std::string & input_path, const std::string & output_path)
+    {
+        unique_file input = open_file(input_path, "rb");
+        std::uint64_t num_bytes = file_size(input.get(), input_path);
+        if (num_bytes % sizeof(T))
+            throw std::system_error(std::make_error_code(std::errc::invalid_argument), input_path + " has " + std::to_string(num_bytes) + " bytes, which isn't a multiple of the record size " + std::to_string(sizeof(T)));
+        std::uint64_t num_records = num_bytes / sizeof(T);
+        // the output can be the input, so it only gets opened once all of
+        // the input has been read
+        if (num_records <= sort_capacity())
+        {
+            T * records = memory.data();
+            read_records(input.get(), records, static_cast<std::size_t>(num_records), input_path);
+            input.reset();
+            open_output(output_path);
+            radix_sort_in_input(records, records + num_records, records + sort_capacity(), extract_key);
+            write_records(output.get(), records, static_cast<std::size_t>(num_records), output_path);
+        }
+        else
+        {
+            std::vector<TempFile> buckets = partition(input.get(), input_path, 0);
+            input.reset();
+            open_output(output_path);
+            for (TempFile & bucket : buckets)
+                sort_bucket(bucket);
+            finish_write();
+        }
+        if (std::fflush(output.get()) != 0)
+            throw file_error("couldn't write to", output_path);
+        output.reset();
+    }
+
+private:
+    ExtractKey & extract_key;
+    std::string temp_directory;
+    std::string temp_prefix;
+    std::size_t num_temp_files = 0;
+    // all the buffers are slices of this
+    std::vector<T> memory;
+    unique_file output;
+    std::string output_path;
+    std::future<void> pending_write;
+    // which of the outer thirds of the memory the next bucket goes into.
+    // the middle third is the buffer for radix_sort
+    bool use_last_third = false;
+
+    // a bucket, its radix_sort buffer and the sorted bucket before it that
+    // is still being written
+    std::size_t sort_capacity() const
+    {
+        return memory.size() / 3;
+    }
+    // two chunks for reading, two for the partitioned chunks being written
+    std::size_t chunk_capacity() const
+    {
+        return std::max(memory.size() / 4, std::size_t(1));
+    }
+
+    void open_output(const std::string & path)
+    {
+        output = open_file(path, "wb");
+        output_path = path;
+    }
+    void finish_write()
+    {
+        if (pending_write.valid())
+            pending_write.get();
+    }
+
+    // for finding the next byte that differs in a bucket, every bucket
+    // remembers the leaves of its first key and the bits that any other key
+    // differs in
+    struct VaryingBits
+    {
+        bool seen = false;
+        std::uint64_t first[num_leaves] = {};
+        std::uint64_t varying[num_leaves] = {};
+    };
+    void add_varying_bits(VaryingBits & bits, const key_type & key)
+    {
+        for_each_leaf([&](auto leaf)
+        {
+            constexpr size_t L = decltype(leaf)::value;
+            std::uint64_t value = FlatKey<key_type>::template leaf<L>(key);
+            if (!bits.seen)
+            {
+                bits.first[L] = value;
+                bits.varying[L] = 0;
+            }
+            bits.varying[L] |= value ^ bits.first[L];
+        }, std::make_index_sequence<num_leaves>{});
+        bits.seen = true;
+    }
+    static size_t first_varying_byte(const VaryingBits & bits, size_t index)
+    {
+        for (; index < num_key_bytes; ++index)
+        {
+            size_t from_bottom = num_key_bytes - 1 - index;
+            bool varies = false;
+            for_each_leaf([&](auto leaf)
+            {
+                constexpr size_t L = decltype(leaf)::value;
+                if (from_bottom >= FlatKeyLeaf<key_type, L>::offset && from_bottom < FlatKeyLeaf<key_type, L>::offset + FlatKeyLeaf<key_type, L>::num_bytes)
+                    varies = ((bits.varying[L] >> ((from_bottom - FlatKeyLeaf<key_type, L>::offset) * 8)) & 0xff) != 0;
+            }, std::make_index_sequence<num_leaves>{});
+            if (varies)
+                break;
+        }
+        return index;
+    }
+
+    // reads the whole file and splits it into bucket files by byte index of
+    // the key. the next chunk gets read and the last chunk gets written while
+    // the current one is partitioned in memory
+    std::vector<TempFile> partition(std::FILE * input, const std::string & input_path, size_t index)
+    {
+        std::size_t capacity = chunk_capacity();
+        T * read_chunks[2] = { memory.data(), memory.data() + capacity };
+        T * partitioned_chunks[2] = { memory.data() + 2 * capacity, memory.data() + 3 * capacity };
+        std::vector<TempFile> buckets(256);
+        std::vector<VaryingBits> varying_bits(256);
+        std::future<std::size_t> pending_read = std::async(std::launch::async, [=]
+        {
+            return read_records(input, read_chunks[0], capacity, input_path);
+        });
+        std::future<void> pending_bucket_write;
+        for (int chunk = 0;; chunk ^= 1)
+        {
+            std::size_t num_read = pending_read.get();
+            if (num_read == 0)
+                break;
+            T * begin = read_chunks[chunk];
+            T * end = begin + num_read;
+            if (num_read == capacity)
+            {
+                pending_read = std::async(std::launch::async, [=]
+                {
+                    return read_records(input, read_chunks[chunk ^ 1], capacity, input_path);
+                });
+            }
+            else
+                pending_read = make_ready_future(std::size_t(0));
+            std::size_t counts[256] = {};
+            for (T * it = begin; it != end; ++it)
+            {
+                auto && key = extract_key(*it);
+                std::uint8_t digit = external_key_byte(key, index);
+                ++counts[digit];
+                add_varying_bits(varying_bits[digit], key);
+            }
+            std::size_t offsets[256];
+            std::copy(std::begin(counts), std::end(counts), offsets);
+            counts_to_offsets(offsets);
+            T * out = partitioned_chunks[chunk];
+            auto extract_digit = [&](const T & record)
+            {
+                return external_key_byte(extract_key(record), index);
+            };
+            radix_scatter(begin, end, out, offsets, extract_digit, choose_scatter_mode<T *, T *>(end - begin));
+            if (pending_bucket_write.valid())
+                pending_bucket_write.get();
+            std::vector<std::size_t> sizes(std::begin(counts), std::end(counts));
+            pending_bucket_write = std::async(std::launch::async, [this, out, sizes, &buckets]
+            {
+                write_buckets(buckets, out, sizes);
+            });
+        }
+        if (pending_bucket_write.valid())
+            pending_bucket_write.get();
+        for (int i = 0; i < 256; ++i)
+        {
+            TempFile & bucket = buckets[i];
+            if (bucket.file && std::fflush(bucket.file.get()) != 0)
+                throw file_error("couldn't write to", bucket.path);
+            bucket.file.reset();
+            bucket.next_index = first_varying_byte(varying_bits[i], index + 1);
+        }
+        return buckets;
+    }
+    void write_buckets(std::vector<TempFile> & buckets, const T * records, const std::vector<std::size_t> & sizes)
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            if (!sizes[i])
+                continue;
+            TempFile & bucket = buckets[i];
+            if (!bucket.file)
+            {
+                bucket.path = temp_prefix + std::to_string(num_temp_files++);
+                // x makes this fail instead of overwriting an existing file
+                bucket.file = open_file(bucket.path, "wbx");
+            }
+            write_records(bucket.file.get(), records, sizes[i], bucket.path);
+            bucket.num_records += sizes[i];
+            records += sizes[i];
+        }
+    }
+
+    // sorts the bucket and appends it to the output
+    void sort_bucket(TempFile & bucket)
+    {
+        if (!bucket.num_records)
+            return;
+        if (bucket.num_records <= sort_capacity() && bucket.next_index < num_key_bytes)
+        {
+            // the bucket before this one may still be written from the other
+            // outer third
+            std::size_t num_records = static_cast<std::size_t>(bucket.num_records);
+            T * begin = memory.data() + (use_last_third ? 2 * sort_capacity() : 0);
+            {
+                unique_file file = open_file(bucket.path, "rb");
+                read_records(file.get(), begin, num_records, bucket.path);
+            }
+            bucket.remove();
+            radix_sort_in_input(begin, begin + num_records, memory.data() + sort_capacity(), extract_key);
+            finish_write();
+            pending_write = std::async(std::launch::async, [this, begin, num_records]
+            {
+                write_records(output.get(), begin, num_records, output_path);
+            });
+            use_last_third = !use_last_third;
+            return;
+        }
+        finish_write();
+        unique_file file = open_file(bucket.path, "rb");
+        if (bucket.next_index == num_key_bytes)
+        {
+            // all the keys are equal, and the partitions are stable, so the
+            // records are already sorted
+            T * chunk = memory.data();
+            while (std::size_t num_read = read_records(file.get(), chunk, memory.size(), bucket.path))
+                write_records(output.get(), chunk, num_read, output_path);
+            file.reset();
+            bucket.remove();
+            return;
+        }
+        std::vector<TempFile> sub_buckets = partition(file.get(), bucket.path, bucket.next_index);
+        file.reset();
+        bucket.remove();
+        for (TempFile & sub_bucket : sub_buckets)
+            sort_bucket(sub_bucket);
+    }
+
+    template<typename U>
+    static std::future<U> make_ready_future(U value)
+    {
+        std::promise<U> promise;
+        promise.set_value(value);
+        return promise.get_future();
+    }
+};
+}
+
+// sorts the records of type T in the file at input_path by the key that
+// extract_key returns and writes them to output_path, which can be the same
+// file. T has to be trivially copyable, and the file is read as an array of
+// T. the key has to be a scalar, or a pair, tuple or std::array of scalars.
+// throws std::system_error if a file can't be read or written, or if the
+// size of the input isn't a multiple of sizeof(T)
+template<typename T, typename ExtractKey, typename = typename std::enable_if<!std::is_same<typename std::decay<ExtractKey>::type, external_radix_sort_options>::value>::type>
+void external_radix_sort(const std::string & input_path, const std::string & output_path, ExtractKey && extract_key, const external_radix_sort_options & options = external_radix_sort_options())
+{
+    detail::ExternalRadixSort<T, typename std::remove_reference<ExtractKey>::type> sort(extract_key, options);
+    sort.sort(input_path, output_path);
+}
+template<typename T>
+void external_radix_sort(const std::string & input_path, const std::string & output_path, const external_radix_sort_options & options = external_radix_sort_options())
+{
+    external_radix_sort<T>(input_path, output_path, [](const T & record) -> const T &{ return record; }, options);
+}
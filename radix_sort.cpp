@@ -3,9 +3,28 @@
 //    (See http://www.boost.org/LICENSE_1_0.txt)
 
 #include "radix_sort.hpp"
+#include "external_radix_sort.hpp"
+#include "radix_sort_file.hpp"
 
 #ifndef DISABLE_GTEST
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <forward_list>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <tuple>
 #include <vector>
 #include <gtest/gtest.h>
 
@@ -27,6 +46,20 @@ TEST(counting_sort, string)
     ASSERT_EQ(to_sort, result);
 }
 
+TEST(counting_sort, sub_histograms)
+{
+    // big enough to count into several histograms, with an odd size and long
+    // runs of the same value
+    std::mt19937_64 randomness(5);
+    std::vector<uint8_t> to_sort(4099);
+    for (size_t i = 0; i < to_sort.size(); ++i)
+        to_sort[i] = i < 2000 ? 17 : static_cast<uint8_t>(randomness() % 5);
+    std::vector<uint8_t> result(to_sort.size());
+    counting_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto i){ return i; });
+    std::sort(to_sort.begin(), to_sort.end());
+    ASSERT_EQ(to_sort, result);
+}
+
 TEST(radix_sort, uint8)
 {
     std::vector<uint8_t> to_sort = { 5, 6, 19, 2, 5, 0, 7, 23, 6, 255, 8, 99 };
@@ -182,6 +215,133 @@ TEST(radix_sort, double)
         std::sort(result.begin(), result.end());
     ASSERT_EQ(result, to_sort);
 }
+#ifdef RADIX_SORT_HAS_INT128
+TEST(radix_sort, int128)
+{
+    __int128 big = static_cast<__int128>(1) << 100;
+    __int128 max = static_cast<__int128>(~static_cast<unsigned __int128>(0) >> 1);
+    std::vector<__int128> to_sort = { 5, 6, 19, -4, 2, 5, 0, -55, big, -big, big + 1, -big - 1, max, -max - 1, max - 1, -max, std::numeric_limits<int64_t>::lowest(), std::numeric_limits<int64_t>::max(), static_cast<__int128>(std::numeric_limits<uint64_t>::max()) + 1, 256, -256, 1000000 };
+    std::vector<__int128> result(to_sort.size());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto i){ return i; });
+    if (which_buffer)
+        std::sort(to_sort.begin(), to_sort.end());
+    else
+        std::sort(result.begin(), result.end());
+    ASSERT_EQ(result, to_sort);
+}
+TEST(radix_sort, uint128_constant_digits)
+{
+    // like UUIDv7: a timestamp at the top, constant version and variant bits
+    // and random bits at the bottom. the constant bytes get skipped
+    std::mt19937_64 randomness(128);
+    std::vector<unsigned __int128> to_sort(100000);
+    for (unsigned __int128 & key : to_sort)
+    {
+        std::uint64_t high = 0x0190000000007000ull | ((randomness() & 0xffffff) << 16) | (randomness() & 0xfff);
+        std::uint64_t low = 0x8000000000000000ull | (randomness() & 0x3fffffffffffffffull);
+        key = (static_cast<unsigned __int128>(high) << 64) | low;
+    }
+    std::vector<unsigned __int128> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<unsigned __int128> buffer(to_sort.size());
+    radix_sort_in_input(to_sort.begin(), to_sort.end(), buffer.begin());
+    ASSERT_EQ(sorted, to_sort);
+
+    std::vector<std::pair<unsigned __int128, int>> pairs(to_sort.size());
+    for (size_t i = 0; i < pairs.size(); ++i)
+        pairs[i] = { to_sort[i] >> 120, static_cast<int>(randomness() % 1000) - 500 };
+    std::vector<std::pair<unsigned __int128, int>> sorted_pairs = pairs;
+    std::stable_sort(sorted_pairs.begin(), sorted_pairs.end());
+    std::vector<std::pair<unsigned __int128, int>> pair_buffer(pairs.size());
+    radix_sort_in_input(pairs.begin(), pairs.end(), pair_buffer.begin());
+    ASSERT_EQ(sorted_pairs, pairs);
+}
+#endif
+enum class radix_sort_test_state : std::uint8_t
+{
+    idle,
+    running,
+    done,
+    failed
+};
+TEST(radix_sort, enum_class)
+{
+    std::vector<radix_sort_test_state> to_sort = { radix_sort_test_state::done, radix_sort_test_state::idle, radix_sort_test_state::failed, radix_sort_test_state::running, radix_sort_test_state::idle, radix_sort_test_state::done };
+    std::vector<radix_sort_test_state> result(to_sort.size());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin());
+    if (which_buffer)
+        std::sort(to_sort.begin(), to_sort.end());
+    else
+        std::sort(result.begin(), result.end());
+    ASSERT_EQ(result, to_sort);
+    static_assert(sizeof(detail::to_unsigned(radix_sort_test_state::idle)) == 1, "enums sort by their underlying type");
+}
+TEST(radix_sort, chrono_and_pointers)
+{
+    typedef std::chrono::steady_clock::time_point time_point;
+    std::mt19937_64 randomness(25);
+    std::vector<int> storage(16);
+    std::vector<std::tuple<radix_sort_test_state, time_point, std::chrono::milliseconds, const int *>> to_sort(100000);
+    for (auto & element : to_sort)
+    {
+        time_point time(std::chrono::steady_clock::duration(static_cast<std::int64_t>(randomness() % 1000) - 500));
+        std::chrono::milliseconds duration(static_cast<std::int64_t>(randomness() % 100) - 50);
+        element = std::make_tuple(static_cast<radix_sort_test_state>(randomness() % 4), time, duration, storage.data() + randomness() % storage.size());
+    }
+    std::vector<std::tuple<radix_sort_test_state, time_point, std::chrono::milliseconds, const int *>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<std::tuple<radix_sort_test_state, time_point, std::chrono::milliseconds, const int *>> buffer(to_sort.size());
+    bool in_buffer = linear_sort(to_sort.begin(), to_sort.end(), buffer.begin());
+    ASSERT_EQ(sorted, in_buffer ? buffer : to_sort);
+}
+#ifdef RADIX_SORT_HAS_CPP17
+TEST(radix_sort, std_byte)
+{
+    std::vector<std::byte> to_sort = { std::byte(5), std::byte(255), std::byte(0), std::byte(128), std::byte(127), std::byte(5) };
+    std::vector<std::byte> result(to_sort.size());
+    radix_sort_in_input(to_sort.begin(), to_sort.end(), result.begin());
+    ASSERT_TRUE(std::is_sorted(to_sort.begin(), to_sort.end()));
+}
+TEST(radix_sort, optional)
+{
+    std::vector<std::optional<std::int64_t>> to_sort = { 5, std::nullopt, -3, std::numeric_limits<std::int64_t>::max(), std::nullopt, std::numeric_limits<std::int64_t>::lowest(), 0 };
+    std::vector<std::optional<std::int64_t>> buffer(to_sort.size());
+    std::vector<std::optional<std::int64_t>> nulls_first = to_sort;
+    radix_sort_in_input(nulls_first.begin(), nulls_first.end(), buffer.begin());
+    std::vector<std::optional<std::int64_t>> expected = { std::nullopt, std::nullopt, std::numeric_limits<std::int64_t>::lowest(), -3, 0, 5, std::numeric_limits<std::int64_t>::max() };
+    ASSERT_EQ(expected, nulls_first);
+    std::vector<std::optional<std::int64_t>> nulls_last = to_sort;
+    radix_sort_in_input(nulls_last.begin(), nulls_last.end(), buffer.begin(), [](const std::optional<std::int64_t> & key)
+    {
+        return radix_sort_nulls_last(key);
+    });
+    std::rotate(expected.begin(), expected.begin() + 2, expected.end());
+    ASSERT_EQ(expected, nulls_last);
+}
+TEST(linear_sort, optional_in_tuple)
+{
+    std::mt19937_64 randomness(25);
+    std::vector<std::pair<std::optional<radix_sort_test_state>, int>> to_sort(100000);
+    for (auto & element : to_sort)
+    {
+        if (randomness() % 3)
+            element.first = static_cast<radix_sort_test_state>(randomness() % 4);
+        element.second = static_cast<int>(randomness() % 1000);
+    }
+    auto extract_key = [](const std::pair<std::optional<radix_sort_test_state>, int> & element)
+    {
+        return std::make_tuple(radix_sort_nulls_last(element.first), radix_sort_descending(element.second));
+    };
+    std::vector<std::pair<std::optional<radix_sort_test_state>, int>> sorted = to_sort;
+    std::stable_sort(sorted.begin(), sorted.end(), [&](const auto & lhs, const auto & rhs)
+    {
+        return extract_key(lhs) < extract_key(rhs);
+    });
+    std::vector<std::pair<std::optional<radix_sort_test_state>, int>> buffer(to_sort.size());
+    bool in_buffer = linear_sort(to_sort.begin(), to_sort.end(), buffer.begin(), extract_key);
+    ASSERT_EQ(sorted, in_buffer ? buffer : to_sort);
+}
+#endif
 TEST(radix_sort, pair)
 {
     std::vector<std::pair<int, bool>> to_sort = { { 5, true }, { 5, false }, { 6, false }, { 7, true }, { 4, false }, { 4, true } };
@@ -215,6 +375,17 @@ TEST(radix_sort, tuple)
         std::sort(result.begin(), result.end());
     ASSERT_EQ(result, to_sort);
 }
+TEST(radix_sort, empty_tuple)
+{
+    // an empty key doesn't change the order, and an empty part of a key
+    // doesn't change what the rest sorts by
+    std::vector<int> to_sort = { 6, 5, 4, 3, 2, 1 };
+    std::vector<int> buffer(to_sort.size());
+    radix_sort_in_input(to_sort.begin(), to_sort.end(), buffer.begin(), [](int){ return std::tuple<>(); });
+    ASSERT_EQ((std::vector<int>{ 6, 5, 4, 3, 2, 1 }), to_sort);
+    radix_sort_in_input(to_sort.begin(), to_sort.end(), buffer.begin(), [](int i){ return std::make_tuple(i, std::tuple<>()); });
+    ASSERT_EQ((std::vector<int>{ 1, 2, 3, 4, 5, 6 }), to_sort);
+}
 TEST(radix_sort, reference)
 {
     std::vector<int> to_sort = { 6, 5, 4, 3, 2, 1 };
@@ -294,284 +465,1563 @@ TEST(radix_sort, vector_bool)
     ASSERT_EQ(result, to_sort);
 }
 
-TEST(linear_sort, tuple)
+TEST(radix_sort, deque_is_stable)
 {
-    std::vector<std::tuple<bool, int, bool>> to_sort = { std::tuple<bool, int, bool>{ true, 5, true }, std::tuple<bool, int, bool>{ true, 5, false }, std::tuple<bool, int, bool>{ false, 6, false }, std::tuple<bool, int, bool>{ true, 7, true }, std::tuple<bool, int, bool>{ true, 4, false }, std::tuple<bool, int, bool>{ false, 4, true }, std::tuple<bool, int, bool>{ false, 5, false } };
-    std::vector<std::tuple<bool, int, bool>> result = to_sort;
-    bool which_buffer = linear_sort(to_sort.begin(), to_sort.end(), result.begin());
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(-1000, 1000);
+    std::deque<std::pair<int, size_t>> to_sort;
+    for (size_t i = 0; i < 10000; ++i)
+        to_sort.emplace_back(distribution(randomness), i);
+    std::vector<std::pair<int, size_t>> sorted(to_sort.begin(), to_sort.end());
+    std::sort(sorted.begin(), sorted.end());
+    std::deque<std::pair<int, size_t>> result(to_sort.size());
+    ASSERT_FALSE(radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i){ return i.first; }));
+    ASSERT_TRUE(std::equal(sorted.begin(), sorted.end(), to_sort.begin(), to_sort.end()));
+}
+
+TEST(radix_sort, deque_bool)
+{
+    std::deque<bool> to_sort = { true, false, true, true, false, true, true, true, false, true, false, false };
+    std::deque<bool> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    ASSERT_FALSE(radix_sort(to_sort.begin(), to_sort.end(), to_sort.begin()));
+    ASSERT_EQ(sorted, to_sort);
+}
+struct NotDefaultConstructible
+{
+    explicit NotDefaultConstructible(int value)
+        : value(std::make_unique<int>(value))
+    {
+    }
+    std::unique_ptr<int> value;
+};
+TEST(radix_sort, deque_not_default_constructible)
+{
+    std::mt19937_64 randomness(14);
+    std::deque<NotDefaultConstructible> to_sort;
+    for (int i = 0; i < 3000; ++i)
+        to_sort.emplace_back(static_cast<int>(randomness() % 2001) - 1000);
+    std::vector<int> sorted;
+    for (const NotDefaultConstructible & i : to_sort)
+        sorted.push_back(*i.value);
+    std::sort(sorted.begin(), sorted.end());
+    radix_sort_in_input(to_sort.begin(), to_sort.end(), to_sort.begin(), [](const NotDefaultConstructible & i){ return *i.value; });
+    std::vector<int> result;
+    for (const NotDefaultConstructible & i : to_sort)
+        result.push_back(*i.value);
+    ASSERT_EQ(sorted, result);
+}
+
+TEST(radix_sort, list_move_only)
+{
+    std::list<std::unique_ptr<int>> to_sort;
+    for (int i : { 5, 0, 1234567, -1000, 5, 17 })
+        to_sort.push_back(std::make_unique<int>(i));
+    std::vector<int> sorted = { -1000, 0, 5, 5, 17, 1234567 };
+    ASSERT_FALSE(radix_sort(to_sort.begin(), to_sort.end(), to_sort.begin(), [](auto & i){ return *i; }));
+    std::vector<int> result;
+    for (const std::unique_ptr<int> & i : to_sort)
+        result.push_back(*i);
+    ASSERT_EQ(sorted, result);
+}
+
+TEST(radix_sort, forward_list)
+{
+    std::forward_list<std::string> to_sort = { "foo", "bar", "", "baz", "foobar", "ba" };
+    std::forward_list<std::string> sorted = to_sort;
+    sorted.sort();
+    ASSERT_FALSE(radix_sort(to_sort.begin(), to_sort.end(), to_sort.begin()));
+    ASSERT_EQ(sorted, to_sort);
+}
+
+TEST(radix_sort, skip_constant_bytes)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<uint64_t> to_sort(1000);
+    for (uint64_t & i : to_sort)
+        i = 0x1234000000000000ull + randomness() % 100000;
+    std::vector<uint64_t> result(to_sort.size());
+    std::vector<uint64_t> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto i){ return i; });
     if (which_buffer)
-        std::sort(to_sort.begin(), to_sort.end());
+        ASSERT_EQ(sorted, result);
     else
-        std::sort(result.begin(), result.end());
-    ASSERT_EQ(result, to_sort);
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, sub_histograms_low_entropy)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<std::pair<uint32_t, size_t>> to_sort;
+    for (size_t i = 0; i < 3001; ++i)
+        to_sort.emplace_back(i % 7 ? 0x01020304u : static_cast<uint32_t>(randomness() % 3) << 16, i);
+    std::vector<std::pair<uint32_t, size_t>> sorted = to_sort;
+    std::stable_sort(sorted.begin(), sorted.end(), [](auto & l, auto & r){ return l.first < r.first; });
+    std::vector<std::pair<uint32_t, size_t>> result(to_sort.size());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i){ return i.first; });
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, replan_unaligned_bits)
+{
+    // only bits 4 to 19 differ, which needs two passes instead of three
+    std::mt19937_64 randomness(5);
+    std::vector<int32_t> to_sort(1000);
+    for (int32_t & i : to_sort)
+        i = -5 - static_cast<int32_t>((randomness() & 0xffff) << 4);
+    std::vector<int32_t> result(to_sort.size());
+    std::vector<int32_t> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto i){ return i; });
+    ASSERT_FALSE(which_buffer);
+    ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, all_keys_equal)
+{
+    std::vector<std::pair<int, size_t>> to_sort;
+    for (size_t i = 0; i < 300; ++i)
+        to_sort.emplace_back(7, i);
+    std::vector<std::pair<int, size_t>> expected = to_sort;
+    std::vector<std::pair<int, size_t>> result(to_sort.size());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i){ return i.first; });
+    ASSERT_FALSE(which_buffer);
+    ASSERT_EQ(expected, to_sort);
+    which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i){ return std::make_pair(i.first == 7, static_cast<uint8_t>(3)); });
+    ASSERT_FALSE(which_buffer);
+    ASSERT_EQ(expected, to_sort);
+}
+static std::vector<std::string> create_strings(size_t count)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> length_distribution(0, 40);
+    std::vector<std::string> result;
+    for (size_t i = 0; i < count; ++i)
+    {
+        // shared prefixes, embedded zeros and non-ascii characters
+        std::string str = i % 3 ? "common/prefix/for/some/of/the/keys/" : "";
+        int length = length_distribution(randomness);
+        for (int j = 0; j < length; ++j)
+            str.push_back(static_cast<char>("ab\0\xff"[randomness() % 4]));
+        result.push_back(std::move(str));
+    }
+    return result;
+}
+TEST(radix_sort, string)
+{
+    std::vector<std::string> to_sort = create_strings(5000);
+    std::vector<std::string> result(to_sort.size());
+    std::vector<std::string> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin());
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+#ifdef RADIX_SORT_HAS_CPP17
+TEST(radix_sort, string_view)
+{
+    std::vector<std::string> strings = create_strings(5000);
+    std::vector<std::string_view> to_sort(strings.begin(), strings.end());
+    std::vector<std::string_view> result(to_sort.size());
+    std::vector<std::string_view> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](std::string_view s){ return s; });
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
 }
-
 #endif
+TEST(radix_sort, c_string)
+{
+    std::vector<std::string> strings = create_strings(5000);
+    std::vector<const char *> to_sort;
+    for (const std::string & str : strings)
+        to_sort.push_back(str.c_str());
+    std::vector<const char *> result(to_sort.size());
+    std::vector<std::string> sorted;
+    for (const char * str : to_sort)
+        sorted.push_back(str);
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin());
+    const std::vector<const char *> & sorted_pointers = which_buffer ? result : to_sort;
+    for (size_t i = 0; i < sorted.size(); ++i)
+        ASSERT_EQ(sorted[i], sorted_pointers[i]);
+}
+TEST(radix_sort, long_shared_prefixes)
+{
+    // every byte splits one key off from the others, so a sort that recursed
+    // once per byte would go 6000 levels deep
+    std::vector<std::string> to_sort;
+    for (size_t i = 0; i < 6000; ++i)
+    {
+        to_sort.emplace_back(6000, 'a');
+        to_sort.back()[i] = 'b';
+    }
+    std::reverse(to_sort.begin(), to_sort.end());
+    std::vector<std::string> result(to_sort.size());
+    std::vector<std::string> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin());
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, vector_key)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<std::vector<int>> to_sort;
+    for (int i = 0; i < 3000; ++i)
+    {
+        std::vector<int> key(randomness() % 5);
+        for (int & element : key)
+            element = static_cast<int>(randomness() % 5) - 2;
+        to_sort.push_back(std::move(key));
+    }
+    std::vector<std::vector<int>> result(to_sort.size());
+    std::vector<std::vector<int>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin());
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, descending_is_stable)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(-1000, 1000);
+    std::vector<std::pair<int, size_t>> to_sort;
+    for (size_t i = 0; i < 10000; ++i)
+        to_sort.emplace_back(distribution(randomness), i);
+    std::vector<std::pair<int, size_t>> result(to_sort.size());
+    std::vector<std::pair<int, size_t>> sorted = to_sort;
+    std::stable_sort(sorted.begin(), sorted.end(), [](auto & l, auto & r){ return l.first > r.first; });
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i){ return i.first; }, radix_sort_order::descending);
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, descending_scalars)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<std::tuple<bool, uint16_t, float, uint64_t>> to_sort;
+    for (size_t i = 0; i < 10000; ++i)
+        to_sort.emplace_back(randomness() % 2, static_cast<uint16_t>(randomness()), static_cast<int>(randomness() % 2001) - 1000.5f, randomness());
+    std::vector<std::tuple<bool, uint16_t, float, uint64_t>> result(to_sort.size());
+    std::vector<std::tuple<bool, uint16_t, float, uint64_t>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end(), std::greater<>());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i){ return i; }, radix_sort_order::descending);
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, descending_string)
+{
+    std::vector<std::string> to_sort = create_strings(5000);
+    std::vector<std::string> result(to_sort.size());
+    std::vector<std::string> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end(), std::greater<>());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](const std::string & s) -> const std::string & { return s; }, radix_sort_order::descending);
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+    std::vector<const char *> c_strings;
+    for (const std::string & s : to_sort)
+        c_strings.push_back(s.c_str());
+    std::vector<const char *> c_result(c_strings.size());
+    which_buffer = radix_sort(c_strings.begin(), c_strings.end(), c_result.begin(), [](const char * s){ return radix_sort_descending(s); });
+    std::vector<const char *> & c_sorted = which_buffer ? c_result : c_strings;
+    for (size_t i = 1; i < c_sorted.size(); ++i)
+        ASSERT_GE(std::strcmp(c_sorted[i - 1], c_sorted[i]), 0);
+}
+TEST(radix_sort, per_component_direction)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<std::string> strings = create_strings(5000);
+    std::vector<std::tuple<int, double, std::string, size_t>> to_sort;
+    for (size_t i = 0; i < strings.size(); ++i)
+        to_sort.emplace_back(static_cast<int>(randomness() % 5), static_cast<double>(randomness() % 3), strings[i], i);
+    // first ascending, second and third descending, stable
+    auto less = [](auto & l, auto & r)
+    {
+        if (std::get<0>(l) != std::get<0>(r))
+            return std::get<0>(l) < std::get<0>(r);
+        else if (std::get<1>(l) != std::get<1>(r))
+            return std::get<1>(l) > std::get<1>(r);
+        else
+            return std::get<2>(l) > std::get<2>(r);
+    };
+    auto extract_key = [](auto & i)
+    {
+        return std::make_tuple(std::get<0>(i), radix_sort_descending(std::pair<double, const std::string &>(std::get<1>(i), std::get<2>(i))));
+    };
+    std::vector<std::tuple<int, double, std::string, size_t>> sorted = to_sort;
+    std::stable_sort(sorted.begin(), sorted.end(), less);
+    std::vector<std::tuple<int, double, std::string, size_t>> result(to_sort.size());
+    std::vector<std::tuple<int, double, std::string, size_t>> cached_to_sort = to_sort;
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), extract_key);
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+    which_buffer = cached_key_radix_sort(cached_to_sort.begin(), cached_to_sort.end(), result.begin(), extract_key);
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, cached_to_sort);
+}
+TEST(radix_sort, tuple_with_string_is_stable)
+{
+    std::vector<std::string> strings = create_strings(5000);
+    std::vector<std::pair<std::tuple<std::string, int>, size_t>> to_sort;
+    for (size_t i = 0; i < strings.size(); ++i)
+        to_sort.emplace_back(std::make_tuple(strings[i].substr(0, 36), static_cast<int>(i % 7) - 3), i);
+    std::vector<std::pair<std::tuple<std::string, int>, size_t>> result(to_sort.size());
+    std::vector<std::pair<std::tuple<std::string, int>, size_t>> sorted = to_sort;
+    std::stable_sort(sorted.begin(), sorted.end(), [](auto & l, auto & r){ return l.first < r.first; });
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i) -> decltype(auto) { return i.first; });
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, tuple_with_constant_parts)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(-1000, 1000);
+    std::vector<std::tuple<int64_t, std::pair<float, int64_t>, std::array<int16_t, 2>>> to_sort;
+    for (size_t i = 0; i < 10000; ++i)
+        to_sort.emplace_back(distribution(randomness), std::make_pair(1.5f, distribution(randomness)), std::array<int16_t, 2>{ { 7, static_cast<int16_t>(distribution(randomness)) } });
+    std::vector<std::tuple<int64_t, std::pair<float, int64_t>, std::array<int16_t, 2>>> result(to_sort.size());
+    std::vector<std::tuple<int64_t, std::pair<float, int64_t>, std::array<int16_t, 2>>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin());
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, composite_pass_count)
+{
+    // one counting pass for all the bytes, then one pass per byte
+    ASSERT_EQ(9u, (detail::radix_sort_pass_count<std::pair<int, int>>));
+    ASSERT_EQ(17u, (detail::radix_sort_pass_count<std::tuple<int64_t, int64_t>>));
+    ASSERT_EQ(17u, (detail::radix_sort_pass_count<std::array<float, 4>>));
+}
+TEST(radix_sort, digit_schedules)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<int64_t> int64s(5000);
+    for (int64_t & i : int64s)
+        i = static_cast<int64_t>(randomness() >> (randomness() % 64));
+    std::vector<float> floats(5000);
+    std::uniform_real_distribution<float> distribution(-100.0f, 100.0f);
+    for (float & f : floats)
+        f = distribution(randomness);
+    for (radix_sort_digits digits : { radix_sort_digits::bits_8, radix_sort_digits::bits_11, radix_sort_digits::bits_16 })
+    {
+        std::vector<int64_t> to_sort = int64s;
+        std::vector<int64_t> result(to_sort.size());
+        std::vector<int64_t> sorted = to_sort;
+        std::sort(sorted.begin(), sorted.end());
+        if (radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](int64_t i){ return i; }, digits))
+            ASSERT_EQ(sorted, result);
+        else
+            ASSERT_EQ(sorted, to_sort);
 
-// benchmarks
-#if 0
+        std::vector<float> floats_to_sort = floats;
+        std::vector<float> floats_result(floats_to_sort.size());
+        std::vector<float> floats_sorted = floats_to_sort;
+        std::sort(floats_sorted.begin(), floats_sorted.end());
+        if (radix_sort(floats_to_sort.begin(), floats_to_sort.end(), floats_result.begin(), [](float f){ return f; }, digits))
+            ASSERT_EQ(floats_sorted, floats_result);
+        else
+            ASSERT_EQ(floats_sorted, floats_to_sort);
+    }
+}
+TEST(radix_sort, wide_digits_skip_constant_digits)
+{
+    // only the lowest 11 bit digit differs, so this needs one pass
+    std::vector<uint32_t> to_sort = { 0x12345003, 0x12345001, 0x12345002, 0x12345000 };
+    std::vector<uint32_t> result(to_sort.size());
+    ASSERT_TRUE(radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](uint32_t i){ return i; }, radix_sort_digits::bits_11));
+    ASSERT_EQ((std::vector<uint32_t>{ 0x12345000, 0x12345001, 0x12345002, 0x12345003 }), result);
+}
+TEST(radix_sort, write_combining_uint64)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<uint64_t> to_sort(1 << 19);
+    for (uint64_t & i : to_sort)
+        i = randomness();
+    std::vector<uint64_t> result(to_sort.size());
+    std::vector<uint64_t> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto i){ return i; });
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, write_combining_pair_is_stable)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<std::pair<uint16_t, uint32_t>> to_sort;
+    for (uint32_t i = 0; i < (1 << 19); ++i)
+        to_sort.emplace_back(static_cast<uint16_t>(randomness()), i);
+    std::vector<std::pair<uint16_t, uint32_t>> result(to_sort.size());
+    std::vector<std::pair<uint16_t, uint32_t>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i){ return i.first; });
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, write_combining_odd_size)
+{
+    // 12 byte elements never line up with the cache lines
+    std::mt19937_64 randomness(5);
+    std::vector<std::array<uint32_t, 3>> to_sort(1 << 18);
+    for (std::array<uint32_t, 3> & i : to_sort)
+        i = { { static_cast<uint32_t>(randomness()), static_cast<uint32_t>(randomness()), static_cast<uint32_t>(randomness()) } };
+    std::vector<std::array<uint32_t, 3>> result(to_sort.size());
+    std::vector<std::array<uint32_t, 3>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin());
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, parallel_uint64)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<uint64_t> to_sort(300000);
+    for (uint64_t & i : to_sort)
+        i = randomness();
+    std::vector<uint64_t> result(to_sort.size());
+    std::vector<uint64_t> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto i){ return i; }, 4);
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, parallel_replan_unaligned_bits)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<uint64_t> to_sort(300000);
+    for (uint64_t & i : to_sort)
+        i = 0xff00000000000000ull | ((randomness() & 0xffffff) << 5);
+    std::vector<uint64_t> result(to_sort.size());
+    std::vector<uint64_t> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto i){ return i; }, 4);
+    ASSERT_TRUE(which_buffer);
+    ASSERT_EQ(sorted, result);
+}
+TEST(radix_sort, parallel_int8)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(-128, 127);
+    std::vector<int8_t> to_sort(300000);
+    for (int8_t & i : to_sort)
+        i = static_cast<int8_t>(distribution(randomness));
+    std::vector<int8_t> result(to_sort.size());
+    std::vector<int8_t> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    radix_sort_thread_pool thread_pool(3);
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto i){ return i; }, thread_pool);
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, parallel_pair_is_stable)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(-1000, 1000);
+    std::vector<std::pair<std::pair<int, bool>, size_t>> to_sort;
+    for (size_t i = 0; i < 300000; ++i)
+        to_sort.emplace_back(std::make_pair(distribution(randomness), distribution(randomness) > 0), i);
+    std::vector<std::pair<std::pair<int, bool>, size_t>> result(to_sort.size());
+    std::vector<std::pair<std::pair<int, bool>, size_t>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    radix_sort_thread_pool thread_pool(4);
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i) -> decltype(auto) { return i.first; }, thread_pool);
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort, parallel_tuple)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(-1000, 1000);
+    std::vector<std::tuple<bool, int, float>> to_sort;
+    for (size_t i = 0; i < 300000; ++i)
+        to_sort.emplace_back(distribution(randomness) > 0, distribution(randomness), distribution(randomness) * 0.25f);
+    std::vector<std::tuple<bool, int, float>> result(to_sort.size());
+    std::vector<std::tuple<bool, int, float>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto i){ return i; }, 4);
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
 
-#include "benchmark/benchmark.h"
+// keys with an odd and an even number of digits, keys where skipped bytes
+// change the number of passes, chained pairs and strings
+template<typename T, typename ExtractKey>
+void check_radix_sort_in_input(std::vector<T> to_sort, ExtractKey && extract_key)
+{
+    std::vector<T> sorted = to_sort;
+    std::stable_sort(sorted.begin(), sorted.end(), [&](const T & l, const T & r){ return extract_key(l) < extract_key(r); });
+    std::vector<T> buffer(to_sort.size());
+    radix_sort_in_input(to_sort.begin(), to_sort.end(), buffer.begin(), extract_key);
+    ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort_in_input, keys)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<std::pair<std::uint8_t, int>> bytes;
+    std::vector<std::pair<std::uint32_t, int>> small_values;
+    std::vector<std::pair<std::uint32_t, std::uint8_t>> fused;
+    std::vector<std::pair<std::string, std::uint16_t>> chained;
+    for (int i = 0; i < 200000; ++i)
+    {
+        bytes.emplace_back(static_cast<std::uint8_t>(randomness()), i);
+        small_values.emplace_back(static_cast<std::uint32_t>(randomness() % 200), i);
+        fused.emplace_back(static_cast<std::uint32_t>(randomness()), static_cast<std::uint8_t>(randomness() % 3));
+        chained.emplace_back(std::to_string(randomness() % 100), static_cast<std::uint16_t>(randomness()));
+    }
+    auto first = [](const auto & p){ return p.first; };
+    auto identity = [](const auto & p){ return p; };
+    // 11 bit digits, so three passes
+    check_radix_sort_in_input(small_values, [](const auto & p){ return static_cast<std::uint32_t>(p.second); });
+    check_radix_sort_in_input(bytes, first);
+    check_radix_sort_in_input(small_values, first);
+    check_radix_sort_in_input(fused, identity);
+    check_radix_sort_in_input(chained, identity);
+    check_radix_sort_in_input(std::vector<std::pair<std::uint8_t, int>>(200000, { 7, 1 }), first);
+    std::deque<std::int16_t> deque = { 5, -3, 0, 5, -300, 2 };
+    radix_sort_in_input(deque.begin(), deque.end(), deque.begin());
+    ASSERT_EQ((std::deque<std::int16_t>{ -300, -3, 0, 2, 5, 5 }), deque);
+}
+TEST(radix_sort_in_input, move_only)
+{
+    // the folded copy moves from the input, so the passes have to start in
+    // the buffer even if the number of passes turns out to be even. with
+    // 200000 elements the keys get three 11 bit digits, and the pointers are
+    // big enough to fold the copy
+    std::mt19937_64 randomness(5);
+    for (std::uint64_t mask : { 0x0u, 0xffu, 0x3fffffu, 0xffffffffu })
+    {
+        std::vector<std::unique_ptr<std::uint32_t>> to_sort;
+        for (int i = 0; i < 200000; ++i)
+            to_sort.emplace_back(new std::uint32_t(static_cast<std::uint32_t>(randomness() & mask)));
+        std::vector<std::unique_ptr<std::uint32_t>> buffer(to_sort.size());
+        radix_sort_in_input(to_sort.begin(), to_sort.end(), buffer.begin(), [](const std::unique_ptr<std::uint32_t> & i){ return *i; });
+        ASSERT_TRUE(std::is_sorted(to_sort.begin(), to_sort.end(), [](const std::unique_ptr<std::uint32_t> & l, const std::unique_ptr<std::uint32_t> & r){ return *l < *r; }));
+    }
+}
 
-#include <random>
-#include <deque>
-#if 0
-static std::vector<int32_t> create_radix_sort_data(std::mt19937_64 & randomness, int size)
+TEST(radix_sort, hybrid_msd_lsd)
 {
-    std::vector<int32_t> result;
-    result.reserve(size);
-    std::uniform_int_distribution<int32_t> distribution;
-    for (int i = 0; i < size; ++i)
+    // the hybrid sort is off unless it's calibrated, so call it directly.
+    // two top bytes get most of the keys, so those buckets need a second MSD
+    // pass. a few keys get buckets of their own
+    std::mt19937_64 randomness(5);
+    typedef std::pair<std::uint64_t, int> element;
+    std::vector<element> original;
+    for (int i = 0; i < 100000; ++i)
     {
-        result.push_back(distribution(randomness));
+        std::uint64_t top = (randomness() % 2 ? 0x10ull : 0x80ull) << 56;
+        original.emplace_back(top | (randomness() % 5000) << 20, i);
+    }
+    original.emplace_back(0xffull << 56, -1);
+    original.emplace_back(0x7full << 56, -2);
+    auto extract_key = [](const element & e){ return e.first; };
+    std::vector<element> sorted = original;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const element & l, const element & r){ return l.first < r.first; });
+    for (detail::ResultPlacement placement : { detail::ResultPlacement::anywhere, detail::ResultPlacement::in_input, detail::ResultPlacement::in_buffer })
+    {
+        std::vector<element> to_sort = original;
+        std::vector<element> buffer(to_sort.size());
+        detail::SerialExecutor executor;
+        bool which_buffer = detail::SizedRadixSorter<8>::sort_hybrid(to_sort.begin(), to_sort.end(), buffer.begin(), extract_key, executor, detail::hybrid_max_msd_passes, placement);
+        if (placement != detail::ResultPlacement::anywhere)
+        {
+            ASSERT_EQ(placement == detail::ResultPlacement::in_buffer, which_buffer);
+        }
+        if (which_buffer)
+            ASSERT_EQ(sorted, buffer);
+        else
+            ASSERT_EQ(sorted, to_sort);
     }
-    return result;
 }
-#elif 1
-static std::vector<std::pair<bool, float>> create_radix_sort_data(std::mt19937_64 & randomness, int size)
+
+struct ExternalRecord
 {
-    std::vector<std::pair<bool, float>> result;
-    result.reserve(size);
-    std::uniform_int_distribution<int> int_distribution(0, 1);
-    std::uniform_real_distribution<float> real_distribution;
-    for (int i = 0; i < size; ++i)
+    std::uint64_t key;
+    std::uint32_t index;
+    std::uint32_t padding;
+
+    bool operator==(const ExternalRecord & other) const
     {
-        result.emplace_back(int_distribution(randomness) != 0, real_distribution(randomness));
+        return key == other.key && index == other.index;
     }
-    return result;
+};
+// the files of the tests go where the bucket files go by default
+static std::string external_test_path(const std::string & name)
+{
+    const char * tmpdir = std::getenv("TMPDIR");
+    return std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/" + name;
+}
+static void write_external_records(const std::string & path, const std::vector<ExternalRecord> & records)
+{
+    std::FILE * file = std::fopen(path.c_str(), "wb");
+    ASSERT_TRUE(file);
+    std::fwrite(records.data(), sizeof(ExternalRecord), records.size(), file);
+    std::fclose(file);
+}
+static std::vector<ExternalRecord> read_external_records(const std::string & path)
+{
+    std::vector<ExternalRecord> records;
+    std::FILE * file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return records;
+    ExternalRecord record;
+    while (std::fread(&record, sizeof(record), 1, file) == 1)
+        records.push_back(record);
+    std::fclose(file);
+    return records;
 }
-#elif 0
-static std::deque<bool> create_radix_sort_data(std::mt19937_64 & randomness, int size)
+TEST(external_radix_sort, small_memory_budget)
 {
-    std::deque<bool> result;
-    std::uniform_int_distribution<int> int_distribution(0, 1);
-    for (int i = 0; i < size; ++i)
+    // with 16 kB of memory a bucket has to have fewer than 342 records to
+    // be sorted in memory. two top bytes get most of the keys, so those get
+    // split more than once, and one key is in 1000 records, which are
+    // copied without being sorted
+    std::mt19937_64 randomness(5);
+    std::vector<ExternalRecord> records;
+    for (std::uint32_t i = 0; i < 20000; ++i)
     {
-        result.emplace_back(int_distribution(randomness) != 0);
+        std::uint64_t top = (randomness() % 2 ? 0x10ull : 0x80ull) << 56;
+        records.push_back({ top | (randomness() % 100000), i, 0 });
     }
-    return result;
+    for (std::uint32_t i = 0; i < 1000; ++i)
+        records.insert(records.begin() + static_cast<std::ptrdiff_t>(randomness() % records.size()), ExternalRecord{ 0x42, 20000 + i, 0 });
+    std::string input = external_test_path("external_radix_sort_input");
+    std::string output = external_test_path("external_radix_sort_output");
+    write_external_records(input, records);
+    external_radix_sort_options options;
+    options.memory_budget = 1 << 14;
+    external_radix_sort<ExternalRecord>(input, output, [](const ExternalRecord & r){ return r.key; }, options);
+    std::vector<ExternalRecord> sorted = records;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const ExternalRecord & l, const ExternalRecord & r){ return l.key < r.key; });
+    ASSERT_EQ(sorted, read_external_records(output));
+
+    // a composite key, sorting the file in place
+    auto composite_key = [](const ExternalRecord & r){ return std::make_pair(radix_sort_descending(static_cast<std::uint8_t>(r.index % 3)), r.key); };
+    external_radix_sort<ExternalRecord>(input, input, composite_key, options);
+    std::stable_sort(records.begin(), records.end(), [&](const ExternalRecord & l, const ExternalRecord & r){ return composite_key(l) < composite_key(r); });
+    ASSERT_EQ(records, read_external_records(input));
+    std::remove(input.c_str());
+    std::remove(output.c_str());
+}
+TEST(external_radix_sort, missing_input)
+{
+    ASSERT_THROW(external_radix_sort<std::uint32_t>(external_test_path("external_radix_sort_missing_input"), external_test_path("external_radix_sort_missing_output")), std::system_error);
+}
+TEST(external_radix_sort, partial_record)
+{
+    // the last record is cut off, so the file can't be sorted without
+    // losing data
+    std::string input = external_test_path("external_radix_sort_partial_input");
+    std::string output = external_test_path("external_radix_sort_partial_output");
+    std::FILE * file = std::fopen(input.c_str(), "wb");
+    ASSERT_TRUE(file);
+    std::uint32_t records[] = { 3, 1, 2 };
+    std::fwrite(records, 1, sizeof(records) - 1, file);
+    std::fclose(file);
+    ASSERT_THROW(external_radix_sort<std::uint32_t>(input, output), std::system_error);
+    std::remove(input.c_str());
+    std::remove(output.c_str());
 }
-#elif 0
-static std::vector<std::int8_t> create_radix_sort_data(std::mt19937_64 & randomness, int size)
+#ifdef RADIX_SORT_HAS_CPP17
+TEST(external_radix_sort, optional_keys)
 {
-    std::vector<std::int8_t> result;
-    result.reserve(size);
-    std::uniform_int_distribution<std::int8_t> int_distribution(-128, 127);
-    for (int i = 0; i < size; ++i)
+    // the optional is 128 bits after to_unsigned, so it's two leaves
+    struct OptionalRecord
     {
-        result.emplace_back(int_distribution(randomness));
+        std::optional<std::uint64_t> key;
+        std::uint32_t index;
+    };
+    std::mt19937_64 randomness(25);
+    std::vector<OptionalRecord> records;
+    for (std::uint32_t i = 0; i < 20000; ++i)
+        records.push_back({ randomness() % 10 ? std::optional<std::uint64_t>(randomness()) : std::nullopt, i });
+    std::string input = external_test_path("external_radix_sort_optional_input");
+    std::string output = external_test_path("external_radix_sort_optional_output");
+    std::FILE * file = std::fopen(input.c_str(), "wb");
+    ASSERT_TRUE(file);
+    std::fwrite(records.data(), sizeof(OptionalRecord), records.size(), file);
+    std::fclose(file);
+    external_radix_sort_options options;
+    options.memory_budget = 1 << 16;
+    external_radix_sort<OptionalRecord>(input, output, [](const OptionalRecord & r){ return r.key; }, options);
+    std::stable_sort(records.begin(), records.end(), [](const OptionalRecord & l, const OptionalRecord & r){ return l.key < r.key; });
+    std::vector<OptionalRecord> sorted(records.size());
+    file = std::fopen(output.c_str(), "rb");
+    ASSERT_TRUE(file);
+    ASSERT_EQ(records.size(), std::fread(sorted.data(), sizeof(OptionalRecord), sorted.size(), file));
+    std::fclose(file);
+    for (size_t i = 0; i < records.size(); ++i)
+        ASSERT_EQ(records[i].index, sorted[i].index);
+    std::remove(input.c_str());
+    std::remove(output.c_str());
+}
+#endif
+
+// writes the lowest width bytes of value into a record in the byte order of
+// the field
+static std::vector<unsigned char> key_field_record(std::uint64_t value, const KeyField & field)
+{
+    std::vector<unsigned char> record(field.offset + field.width);
+    for (std::size_t i = 0; i < field.width; ++i)
+    {
+        unsigned char byte = static_cast<unsigned char>(value >> (i * 8));
+        record[field.offset + (field.big_endian ? field.width - 1 - i : i)] = byte;
     }
+    return record;
+}
+static std::vector<std::uint64_t> read_key_fields(const std::vector<std::uint64_t> & values, const KeyField & field)
+{
+    std::vector<std::uint64_t> result;
+    for (std::uint64_t value : values)
+        result.push_back(read_key_field(key_field_record(value, field).data(), field));
     return result;
 }
-#elif 0
-static std::vector<std::int16_t> create_radix_sort_data(std::mt19937_64 & randomness, int size)
+template<typename Float, typename Bits>
+static std::vector<std::uint64_t> float_bits(std::initializer_list<Float> values)
 {
-    std::vector<std::int16_t> result;
-    result.reserve(size);
-    std::uniform_int_distribution<std::int16_t> int_distribution(-32768, 32767);
-    for (int i = 0; i < size; ++i)
+    std::vector<std::uint64_t> result;
+    for (Float value : values)
     {
-        result.emplace_back(int_distribution(randomness));
+        Bits bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        result.push_back(bits);
     }
     return result;
 }
-#elif 0
-static std::vector<std::int64_t> create_radix_sort_data(std::mt19937_64 & randomness, int size)
+TEST(radix_sort_file, read_key_field)
 {
-    std::vector<std::int64_t> result;
-    result.reserve(size);
-    std::uniform_int_distribution<std::int64_t> int_distribution(std::numeric_limits<int64_t>::lowest(), std::numeric_limits<int64_t>::max());
-    for (int i = 0; i < size; ++i)
+    KeyField field;
+    ASSERT_TRUE(parse_key_field("3:2", field));
+    ASSERT_EQ(0x1234u, read_key_field(key_field_record(0x1234, field).data(), field));
+    ASSERT_TRUE(parse_key_field("3:2:be", field));
+    ASSERT_EQ(0x1234u, read_key_field(key_field_record(0x1234, field).data(), field));
+    unsigned char bytes[] = { 0x12, 0x34, 0x56 };
+    ASSERT_EQ(0x563412u, read_key_field(bytes, KeyField{ 0, 3 }));
+    ASSERT_TRUE(parse_key_field("0:3:be", field));
+    ASSERT_EQ(0x123456u, read_key_field(bytes, field));
+    ASSERT_FALSE(parse_key_field("0:9", field));
+    ASSERT_FALSE(parse_key_field("0:2:f", field));
+    ASSERT_FALSE(parse_key_field("0:4:x", field));
+
+    // every list is in ascending order of the values that the bits stand
+    // for, so the keys have to be increasing, or decreasing for desc
+    std::vector<std::vector<std::uint64_t>> signed_values =
+    {
+        { 0x80, 0xff, 0, 1, 0x7f },
+        { 0x8000, 0xfffe, 0xffff, 0, 0x100, 0x7fff },
+        { 0x8000000000000000ull, 0xffffffffffffffffull, 0, 1, 0x7fffffffffffffffull },
+    };
+    std::vector<std::vector<std::uint64_t>> float_values =
+    {
+        float_bits<float, std::uint32_t>({ -std::numeric_limits<float>::infinity(), -1.5f, -1e-30f, -0.0f, 0.0f, 1e-30f, 2.5f, std::numeric_limits<float>::infinity() }),
+        float_bits<double, std::uint64_t>({ -std::numeric_limits<double>::infinity(), -1.5, -1e-300, -0.0, 0.0, 1e-300, 2.5, std::numeric_limits<double>::infinity() }),
+    };
+    for (const char * endian : { "le", "be" })
     {
-        result.emplace_back(int_distribution(randomness));
+        for (const char * direction : { "asc", "desc" })
+        {
+            auto check = [&](const std::vector<std::uint64_t> & values, std::string type, std::size_t width)
+            {
+                KeyField field;
+                ASSERT_TRUE(parse_key_field("1:" + std::to_string(width) + ":" + type + ":" + endian + ":" + direction, field));
+                std::vector<std::uint64_t> keys = read_key_fields(values, field);
+                if (field.descending)
+                    std::reverse(keys.begin(), keys.end());
+                ASSERT_TRUE(std::adjacent_find(keys.begin(), keys.end(), std::greater_equal<std::uint64_t>()) == keys.end());
+                for (std::uint64_t key : keys)
+                    ASSERT_EQ(0u, width == 8 ? 0 : key >> (width * 8));
+            };
+            check(signed_values[0], "s", 1);
+            check(signed_values[1], "s", 2);
+            check(signed_values[2], "s", 8);
+            check(float_values[0], "f", 4);
+            check(float_values[1], "f", 8);
+            check({ 0, 1, 0x7fffff, 0x800000, 0xffffff }, "u", 3);
+        }
     }
-    return result;
 }
-#elif 0
-static std::vector<std::tuple<std::int64_t, std::int64_t>> create_radix_sort_data(std::mt19937_64 & randomness, int size)
+TEST(radix_sort_file, pack_key)
 {
-    std::vector<std::tuple<std::int64_t, std::int64_t>> result;
-    result.reserve(size);
-    std::uniform_int_distribution<std::int64_t> int_distribution(std::numeric_limits<int64_t>::lowest(), std::numeric_limits<int64_t>::max());
-    for (int i = 0; i < size; ++i)
+    // the second field starts at bit 40 and crosses into the second word
+    std::vector<KeyField> fields(3);
+    ASSERT_TRUE(parse_key_field("0:5:be", fields[0]));
+    ASSERT_TRUE(parse_key_field("5:6:be", fields[1]));
+    ASSERT_TRUE(parse_key_field("11:1", fields[2]));
+    unsigned char record[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0xaa };
+    std::array<std::uint64_t, 2> key;
+    pack_key(record, fields, key);
+    ASSERT_EQ(0x0102030405111213ull, key[0]);
+    ASSERT_EQ(0x141516aa00000000ull, key[1]);
+
+    // a composite key sorts like the tuple of its fields
+    std::mt19937_64 randomness(21);
+    std::vector<KeyField> composite(4);
+    ASSERT_TRUE(parse_key_field("0:3:s:desc", composite[0]));
+    ASSERT_TRUE(parse_key_field("3:7:be", composite[1]));
+    ASSERT_TRUE(parse_key_field("10:8:f", composite[2]));
+    ASSERT_TRUE(parse_key_field("18:2:s:be", composite[3]));
+    std::vector<std::array<unsigned char, 20>> records(2000);
+    for (std::array<unsigned char, 20> & r : records)
     {
-        result.emplace_back(int_distribution(randomness), int_distribution(randomness));
+        for (unsigned char & byte : r)
+            byte = static_cast<unsigned char>(randomness() % 4 ? randomness() % 3 : randomness());
+        double value = static_cast<double>(static_cast<int>(randomness() % 20) - 10);
+        std::memcpy(r.data() + 10, &value, sizeof(value));
     }
-    return result;
+    auto fields_of = [&](const std::array<unsigned char, 20> & r)
+    {
+        std::vector<std::uint64_t> result;
+        for (const KeyField & field : composite)
+            result.push_back(read_key_field(r.data(), field));
+        return result;
+    };
+    auto packed = [&](const std::array<unsigned char, 20> & r)
+    {
+        std::array<std::uint64_t, 3> result;
+        pack_key(r.data(), composite, result);
+        return result;
+    };
+    for (std::size_t i = 1; i < records.size(); ++i)
+    {
+        ASSERT_EQ(fields_of(records[i - 1]) < fields_of(records[i]), packed(records[i - 1]) < packed(records[i]));
+        ASSERT_EQ(fields_of(records[i - 1]) == fields_of(records[i]), packed(records[i - 1]) == packed(records[i]));
+    }
+}
+TEST(radix_sort_file, permute_in_place)
+{
+    std::mt19937_64 randomness(22);
+    const std::size_t record_size = 3;
+    std::vector<unsigned char> records(1000 * record_size);
+    for (unsigned char & byte : records)
+        byte = static_cast<unsigned char>(randomness());
+    std::vector<std::uint32_t> permutation(1000);
+    std::iota(permutation.begin(), permutation.end(), 0);
+    std::shuffle(permutation.begin(), permutation.end(), randomness);
+    // a fixed point and a cycle of two
+    std::swap(permutation[5], *std::find(permutation.begin(), permutation.end(), 5u));
+    std::swap(permutation[6], *std::find(permutation.begin(), permutation.end(), 7u));
+    std::swap(permutation[7], *std::find(permutation.begin(), permutation.end(), 6u));
+    std::vector<unsigned char> expected(records.size());
+    for (std::size_t i = 0; i < permutation.size(); ++i)
+        std::copy_n(records.begin() + static_cast<std::ptrdiff_t>(permutation[i] * record_size), record_size, expected.begin() + static_cast<std::ptrdiff_t>(i * record_size));
+    permute_in_place(records.data(), record_size, permutation);
+    ASSERT_EQ(expected, records);
+    for (std::size_t i = 0; i < permutation.size(); ++i)
+        ASSERT_EQ(i, permutation[i]);
+}
+
+TEST(in_place_radix_sort, int64)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<int64_t> to_sort(10000);
+    for (int64_t & i : to_sort)
+        i = static_cast<int64_t>(randomness());
+    to_sort.push_back(std::numeric_limits<int64_t>::lowest());
+    to_sort.push_back(std::numeric_limits<int64_t>::max());
+    std::vector<int64_t> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    in_place_radix_sort(to_sort.begin(), to_sort.end());
+    ASSERT_EQ(sorted, to_sort);
 }
-#elif 0
-static std::vector<std::tuple<std::int32_t, std::int32_t, std::int64_t>> create_radix_sort_data(std::mt19937_64 & randomness, int size)
+TEST(in_place_radix_sort, float)
 {
-    std::vector<std::tuple<std::int32_t, std::int32_t, std::int64_t>> result;
-    result.reserve(size);
-    std::uniform_int_distribution<std::int32_t> int32_distribution(std::numeric_limits<int32_t>::lowest(), std::numeric_limits<int32_t>::max());
-    std::uniform_int_distribution<std::int64_t> int64_distribution(std::numeric_limits<int64_t>::lowest(), std::numeric_limits<int64_t>::max());
-    for (int i = 0; i < size; ++i)
+    std::mt19937_64 randomness(5);
+    std::uniform_real_distribution<float> distribution(-1000.0f, 1000.0f);
+    std::vector<float> to_sort(10000);
+    for (float & f : to_sort)
+        f = distribution(randomness);
+    to_sort.push_back(std::numeric_limits<float>::infinity());
+    to_sort.push_back(-std::numeric_limits<float>::infinity());
+    std::vector<float> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    in_place_radix_sort(to_sort.begin(), to_sort.end(), [](float f){ return f; });
+    ASSERT_EQ(sorted, to_sort);
+}
+TEST(in_place_radix_sort, tuple)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(-10, 10);
+    std::vector<std::tuple<bool, int, std::pair<int8_t, uint16_t>>> to_sort;
+    for (int i = 0; i < 10000; ++i)
+        to_sort.emplace_back(distribution(randomness) > 0, distribution(randomness), std::make_pair(static_cast<int8_t>(distribution(randomness)), static_cast<uint16_t>(distribution(randomness) + 10)));
+    std::vector<std::tuple<bool, int, std::pair<int8_t, uint16_t>>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    in_place_radix_sort(to_sort.begin(), to_sort.end(), [](auto & i) -> decltype(auto) { return i; });
+    ASSERT_EQ(sorted, to_sort);
+}
+TEST(in_place_radix_sort, std_array)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(0, 3);
+    std::vector<std::array<float, 4>> to_sort(10000);
+    for (std::array<float, 4> & a : to_sort)
     {
-        result.emplace_back(int32_distribution(randomness), int32_distribution(randomness), int64_distribution(randomness));
+        for (float & f : a)
+            f = distribution(randomness) * 0.5f;
     }
-    return result;
+    std::vector<std::array<float, 4>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    in_place_radix_sort(to_sort.begin(), to_sort.end());
+    ASSERT_EQ(sorted, to_sort);
 }
-#else
-template<size_t Size>
-struct SizedStruct
+TEST(in_place_radix_sort, move_only)
 {
-    uint8_t array[Size] = {};
-};
-template<>
-struct SizedStruct<0>
+    std::mt19937_64 randomness(5);
+    std::vector<std::unique_ptr<int>> to_sort;
+    std::vector<int> sorted;
+    for (int i = 0; i < 1000; ++i)
+    {
+        to_sort.push_back(std::make_unique<int>(static_cast<int>(randomness() % 100000)));
+        sorted.push_back(*to_sort.back());
+    }
+    std::sort(sorted.begin(), sorted.end());
+    in_place_radix_sort(to_sort.begin(), to_sort.end(), [](auto & i){ return *i; });
+    for (size_t i = 0; i < sorted.size(); ++i)
+        ASSERT_EQ(sorted[i], *to_sort[i]);
+}
+
+TEST(radix_select, float)
 {
-};
-// 1 1
-// benchmark_radix_sort/2k      15584 ns      15584 ns      45023
-// benchmark_std_sort/2k        81390 ns      81387 ns       8402
-// 1 4
-// benchmark_radix_sort/2k      18295 ns      18294 ns      38503
-// benchmark_std_sort/2k        88495 ns      88490 ns       7884
-// 1 16
-// benchmark_radix_sort/2k      24150 ns      24149 ns      29040
-// benchmark_std_sort/2k        99820 ns      99816 ns       7030
-// 1 64
-// benchmark_radix_sort/2k      57376 ns      57374 ns      11904
-// benchmark_std_sort/2k       140581 ns     140572 ns       4871
-// 1 256
-// benchmark_radix_sort/2k     143925 ns     143918 ns       4872
-// benchmark_std_sort/2k       413432 ns     413412 ns       1697
-// 4 4
-// benchmark_radix_sort/2k      23582 ns      23581 ns      30160
-// benchmark_std_sort/2k        86721 ns      86717 ns       8127
-// 4 16
-// benchmark_radix_sort/2k      39676 ns      39674 ns      17607
-// benchmark_std_sort/2k        97408 ns      97403 ns       7164
-// 4 64
-// benchmark_radix_sort/2k     119144 ns     119138 ns       5932
-// benchmark_std_sort/2k       137889 ns     137882 ns       4997
-// 4 256
-// benchmark_radix_sort/2k     340898 ns     340881 ns       2079
-// benchmark_std_sort/2k       442650 ns     442628 ns       1585
-// 16 16
-// benchmark_radix_sort/2k     123524 ns     123519 ns       5533
-// benchmark_std_sort/2k       111651 ns     111647 ns       6335
-// 16 64
-// benchmark_radix_sort/2k     346659 ns     346640 ns       1991
-// benchmark_std_sort/2k       150146 ns     150128 ns       4537
-// 16 256
-// benchmark_radix_sort/2k    1194784 ns    1194713 ns        589
-// benchmark_std_sort/2k       459288 ns     459260 ns       1545
-// 64 64
-// benchmark_radix_sort/2k    1881615 ns    1880636 ns        379
-// benchmark_std_sort/2k       254113 ns     254002 ns       2770
-// 64 256
-// benchmark_radix_sort/2k    5500901 ns    5500572 ns        113
-// benchmark_std_sort/2k       577450 ns     577417 ns       1203
-// 256 256
-// benchmark_radix_sort/2k   17657334 ns   17656224 ns         40
-// benchmark_std_sort/2k       698080 ns     698040 ns       1008
-
-#define SORT_ON_FIRST_ONLY
-typedef std::int64_t benchmark_sort_key;
-#define NUM_SORT_KEYS 1
-typedef SizedStruct<0> benchmark_sort_value;
-#if NUM_SORT_KEYS == 1
-static std::vector<std::tuple<benchmark_sort_key, benchmark_sort_value>> create_radix_sort_data(std::mt19937_64 & randomness, int size)
-{
-    std::vector<std::tuple<benchmark_sort_key, benchmark_sort_value>> result;
-    result.reserve(size);
-    std::uniform_int_distribution<benchmark_sort_key> distribution(std::numeric_limits<benchmark_sort_key>::lowest(), std::numeric_limits<benchmark_sort_key>::max());
-    for (int i = 0; i < size; ++i)
-    {
-        result.emplace_back(distribution(randomness), benchmark_sort_value());
+    std::mt19937_64 randomness(5);
+    std::uniform_real_distribution<float> distribution(-1000.0f, 1000.0f);
+    std::vector<float> original(100000);
+    for (float & f : original)
+        f = distribution(randomness);
+    std::vector<float> sorted = original;
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t nth : { size_t(0), size_t(1), size_t(300), size_t(5000), original.size() / 2, original.size() - 1 })
+    {
+        std::vector<float> to_select = original;
+        radix_select(to_select.begin(), to_select.begin() + nth, to_select.end());
+        ASSERT_EQ(sorted[nth], to_select[nth]);
+        for (size_t i = 0; i < nth; ++i)
+            ASSERT_LE(to_select[i], to_select[nth]);
+        for (size_t i = nth; i < to_select.size(); ++i)
+            ASSERT_GE(to_select[i], to_select[nth]);
     }
-    return result;
 }
-#elif NUM_SORT_KEYS == 2
-static std::vector<std::tuple<std::pair<benchmark_sort_key, benchmark_sort_key>, benchmark_sort_value>> create_radix_sort_data(std::mt19937_64 & randomness, int size)
+TEST(radix_select, pair_with_duplicates)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<std::pair<std::pair<int8_t, double>, std::string>> to_select;
+    for (size_t i = 0; i < 10000; ++i)
+        to_select.emplace_back(std::make_pair(static_cast<int8_t>(randomness() % 3), static_cast<double>(randomness() % 100)), std::to_string(i));
+    auto extract_key = [](auto & i) -> const std::pair<int8_t, double> & { return i.first; };
+    std::vector<std::pair<int8_t, double>> sorted;
+    for (auto & i : to_select)
+        sorted.push_back(i.first);
+    std::sort(sorted.begin(), sorted.end());
+    size_t nth = 7000;
+    radix_select(to_select.begin(), to_select.begin() + nth, to_select.end(), extract_key);
+    ASSERT_EQ(sorted[nth], to_select[nth].first);
+    for (size_t i = 0; i < nth; ++i)
+        ASSERT_LE(to_select[i].first, to_select[nth].first);
+    for (size_t i = nth; i < to_select.size(); ++i)
+        ASSERT_GE(to_select[i].first, to_select[nth].first);
+}
+TEST(radix_partial_sort, top_k)
 {
-    std::vector<std::tuple<std::pair<benchmark_sort_key, benchmark_sort_key>, benchmark_sort_value>> result;
-    result.reserve(size);
-    std::uniform_int_distribution<benchmark_sort_key> distribution(std::numeric_limits<benchmark_sort_key>::lowest(), std::numeric_limits<benchmark_sort_key>::max());
-    for (int i = 0; i < size; ++i)
+    std::mt19937_64 randomness(5);
+    std::vector<std::tuple<bool, uint64_t>> to_sort(100000);
+    for (auto & i : to_sort)
+        i = std::make_tuple(randomness() % 4 == 0, randomness());
+    std::vector<std::tuple<bool, uint64_t>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end(), std::greater<>());
+    for (size_t k : { size_t(0), size_t(1), size_t(100), size_t(1000), size_t(30000) })
     {
-        result.emplace_back(std::make_pair(distribution(randomness), distribution(randomness)), benchmark_sort_value());
+        std::vector<std::tuple<bool, uint64_t>> result = to_sort;
+        radix_partial_sort(result.begin(), result.begin() + k, result.end(), [](auto & i){ return radix_sort_descending(i); });
+        ASSERT_TRUE(std::equal(sorted.begin(), sorted.begin() + k, result.begin()));
+        std::sort(result.begin(), result.end(), std::greater<>());
+        ASSERT_EQ(sorted, result);
     }
-    return result;
 }
-#else
-static std::vector<std::tuple<std::array<benchmark_sort_key, NUM_SORT_KEYS>, benchmark_sort_value>> create_radix_sort_data(std::mt19937_64 & randomness, int size)
+TEST(radix_partial_sort, few_of_reverse_sorted)
 {
-    std::vector<std::tuple<std::array<benchmark_sort_key, NUM_SORT_KEYS>, benchmark_sort_value>> result;
-    result.reserve(size);
-    std::uniform_int_distribution<benchmark_sort_key> distribution(std::numeric_limits<benchmark_sort_key>::lowest(), std::numeric_limits<benchmark_sort_key>::max());
-    for (int i = 0; i < size; ++i)
+    // every element is smaller than the top of the heap, so every one of
+    // them replaces it
+    std::vector<int> to_sort;
+    for (int i = 10000; i > 0; --i)
+        to_sort.push_back(i);
+    std::vector<int> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t k : { size_t(1), size_t(10) })
     {
-        std::array<benchmark_sort_key, NUM_SORT_KEYS> key;
-        for (int i = 0; i < NUM_SORT_KEYS; ++i)
-            key[i] = distribution(randomness);
-        result.emplace_back(key, benchmark_sort_value());
+        std::vector<int> result = to_sort;
+        radix_partial_sort(result.begin(), result.begin() + k, result.end());
+        ASSERT_TRUE(std::equal(sorted.begin(), sorted.begin() + k, result.begin()));
+        std::sort(result.begin(), result.end());
+        ASSERT_EQ(sorted, result);
     }
-    return result;
 }
-#endif
-#endif
 
+template<typename T>
+struct CountingAllocator
+{
+    typedef T value_type;
 
-static constexpr int profile_multiplier = 4;
-static constexpr int max_profile_range = 2 << 15;
+    explicit CountingAllocator(int * num_allocations)
+        : num_allocations(num_allocations)
+    {
+    }
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U> & other)
+        : num_allocations(other.num_allocations)
+    {
+    }
+    T * allocate(size_t n)
+    {
+        ++*num_allocations;
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T * p, size_t n)
+    {
+        std::allocator<T>().deallocate(p, n);
+    }
+    bool operator==(const CountingAllocator & other) const
+    {
+        return num_allocations == other.num_allocations;
+    }
+    bool operator!=(const CountingAllocator & other) const
+    {
+        return num_allocations != other.num_allocations;
+    }
 
-static void benchmark_radix_sort(benchmark::State & state)
+    int * num_allocations;
+};
+TEST(radix_sort, deque_with_allocator)
+{
+    int num_allocations = 0;
+    std::deque<int, CountingAllocator<int>> to_sort({ 5, -3, 1000000, 0, 7, -3, 2 }, CountingAllocator<int>(&num_allocations));
+    std::vector<int> sorted(to_sort.begin(), to_sort.end());
+    std::sort(sorted.begin(), sorted.end());
+    radix_sort_in_input(to_sort.begin(), to_sort.end(), to_sort.begin());
+    ASSERT_TRUE(std::equal(sorted.begin(), sorted.end(), to_sort.begin(), to_sort.end()));
+}
+TEST(radix_sorter, reuses_buffer)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(-1000, 1000);
+    int num_allocations = 0;
+    typedef std::pair<int, size_t> element;
+    radix_sorter<element, CountingAllocator<element>> sorter{ CountingAllocator<element>(&num_allocations) };
+    for (size_t size : { 10000, 5000, 64, 10000, 3, 7000 })
+    {
+        std::vector<element> to_sort;
+        for (size_t i = 0; i < size; ++i)
+            to_sort.emplace_back(distribution(randomness), i);
+        std::vector<element> sorted = to_sort;
+        std::stable_sort(sorted.begin(), sorted.end(), [](const element & l, const element & r){ return l.first < r.first; });
+        sorter.sort(to_sort.begin(), to_sort.end(), [](const element & e){ return e.first; });
+        ASSERT_EQ(sorted, to_sort);
+    }
+    ASSERT_EQ(1, num_allocations);
+    ASSERT_EQ(10000u, sorter.capacity());
+    sorter.release_memory();
+    ASSERT_EQ(0u, sorter.capacity());
+}
+TEST(radix_sorter, unequal_allocators_dont_swap)
+{
+    // a single byte key takes one pass, so the result ends up in the buffer
+    std::mt19937_64 randomness(17);
+    int data_allocations = 0;
+    int buffer_allocations = 0;
+    typedef std::pair<uint8_t, size_t> element;
+    static_assert(!std::allocator_traits<CountingAllocator<element>>::propagate_on_container_swap::value, "the test needs an allocator that doesn't propagate");
+    radix_sorter<element, CountingAllocator<element>> sorter{ CountingAllocator<element>(&buffer_allocations) };
+    std::vector<element, CountingAllocator<element>> to_sort{ CountingAllocator<element>(&data_allocations) };
+    to_sort.reserve(10000);
+    for (size_t i = 0; i < 10000; ++i)
+        to_sort.emplace_back(static_cast<uint8_t>(randomness()), i);
+    const element * storage = to_sort.data();
+    std::vector<element> sorted(to_sort.begin(), to_sort.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [](const element & l, const element & r){ return l.first < r.first; });
+    sorter.sort(to_sort, [](const element & e){ return e.first; });
+    ASSERT_TRUE(std::equal(sorted.begin(), sorted.end(), to_sort.begin(), to_sort.end()));
+    ASSERT_EQ(storage, to_sort.data());
+    ASSERT_TRUE(to_sort.get_allocator() == CountingAllocator<element>(&data_allocations));
+    ASSERT_EQ(1, data_allocations);
+    ASSERT_EQ(1, buffer_allocations);
+    ASSERT_EQ(10000u, sorter.capacity());
+}
+TEST(radix_sorter, buffer_doesnt_shrink)
+{
+    // single byte keys take one pass, so the result ends up in the buffer.
+    // the big vector gets the storage of the buffer and the other way around,
+    // the small one has to get its elements moved back
+    std::mt19937_64 randomness(17);
+    radix_sorter<uint8_t> sorter;
+    for (size_t size : { 100000, 100 })
+    {
+        std::vector<uint8_t> to_sort(size);
+        for (uint8_t & i : to_sort)
+            i = static_cast<uint8_t>(randomness());
+        std::vector<uint8_t> sorted = to_sort;
+        std::sort(sorted.begin(), sorted.end());
+        sorter.sort(to_sort);
+        ASSERT_EQ(sorted, to_sort);
+        ASSERT_EQ(size, to_sort.size());
+        ASSERT_EQ(100000u, sorter.capacity());
+    }
+    std::vector<uint8_t> small(100);
+    sorter.sort(small);
+    ASSERT_LT(small.capacity(), 1000u);
+}
+TEST(radix_sorter, small_sorts_dont_allocate)
+{
+    radix_sorter<std::string> sorter;
+    std::vector<std::string> to_sort = { "foo", "bar", "", "baz", "foobar", "ba", std::string(1, '\xff'), std::string(1, '\0') };
+    std::vector<std::string> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    sorter.sort(to_sort);
+    ASSERT_EQ(sorted, to_sort);
+    std::vector<std::tuple<float, bool>> tuples = { { 1.5f, true }, { -2.0f, false }, { 1.5f, false }, { 0.0f, true } };
+    radix_sorter<std::tuple<float, bool>> tuple_sorter;
+    tuple_sorter.sort(tuples.begin(), tuples.end(), [](auto & t){ return std::make_tuple(radix_sort_descending(std::get<0>(t)), std::get<1>(t)); });
+    std::vector<std::tuple<float, bool>> sorted_tuples = { { 1.5f, false }, { 1.5f, true }, { 0.0f, true }, { -2.0f, false } };
+    ASSERT_EQ(sorted_tuples, tuples);
+    ASSERT_EQ(0u, sorter.capacity());
+    ASSERT_EQ(0u, tuple_sorter.capacity());
+}
+TEST(radix_sorter, vector_and_list)
+{
+    std::vector<std::string> strings = create_strings(5000);
+    std::vector<std::string> sorted = strings;
+    std::sort(sorted.begin(), sorted.end());
+    radix_sorter<std::string> sorter;
+    std::vector<std::string> to_sort = strings;
+    sorter.sort(to_sort);
+    ASSERT_EQ(sorted, to_sort);
+    std::list<std::string> list(strings.begin(), strings.end());
+    sorter.sort(list.begin(), list.end());
+    ASSERT_TRUE(std::equal(sorted.begin(), sorted.end(), list.begin(), list.end()));
+    std::mt19937_64 randomness(5);
+    std::vector<uint64_t> numbers(10000);
+    for (uint64_t & i : numbers)
+        i = randomness();
+    std::vector<uint64_t> sorted_numbers = numbers;
+    std::sort(sorted_numbers.begin(), sorted_numbers.end());
+    radix_sorter<uint64_t> number_sorter;
+    number_sorter.sort(numbers);
+    ASSERT_EQ(sorted_numbers, numbers);
+}
+
+TEST(indirect_radix_sort, is_stable)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(-1000, 1000);
+    std::vector<std::tuple<int16_t, size_t, std::array<uint8_t, 48>>> to_sort;
+    for (size_t i = 0; i < 10000; ++i)
+        to_sort.emplace_back(static_cast<int16_t>(distribution(randomness)), i, std::array<uint8_t, 48>{});
+    std::vector<std::tuple<int16_t, size_t, std::array<uint8_t, 48>>> result(to_sort.size());
+    std::vector<std::tuple<int16_t, size_t, std::array<uint8_t, 48>>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    ASSERT_TRUE(indirect_radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i){ return std::get<0>(i); }));
+    ASSERT_EQ(sorted, result);
+}
+TEST(indirect_radix_sort, string_key)
+{
+    std::vector<std::pair<std::string, int>> to_sort = { { "b", 1 }, { "abc", 2 }, { "", 3 }, { "ab", 4 }, { "b", 5 }, { "abc", 6 } };
+    std::vector<std::pair<std::string, int>> result(to_sort.size());
+    std::vector<std::pair<std::string, int>> sorted = to_sort;
+    std::stable_sort(sorted.begin(), sorted.end(), [](auto & l, auto & r){ return l.first < r.first; });
+    ASSERT_TRUE(indirect_radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i) -> const std::string & { return i.first; }));
+    ASSERT_EQ(sorted, result);
+}
+TEST(cached_key_radix_sort, calls_extract_key_once)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<int64_t> to_sort(10000);
+    for (int64_t & i : to_sort)
+        i = static_cast<int64_t>(randomness());
+    std::vector<int64_t> result(to_sort.size());
+    std::vector<int64_t> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    size_t num_calls = 0;
+    bool which_buffer = cached_key_radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [&](int64_t i){ ++num_calls; return i; });
+    ASSERT_EQ(to_sort.size(), num_calls);
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(cached_key_radix_sort, pair_is_stable)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(-10, 10);
+    std::vector<std::pair<std::pair<int, float>, size_t>> to_sort;
+    for (size_t i = 0; i < 10000; ++i)
+        to_sort.emplace_back(std::make_pair(distribution(randomness), distribution(randomness) * 0.5f), i);
+    std::vector<std::pair<std::pair<int, float>, size_t>> result(to_sort.size());
+    std::vector<std::pair<std::pair<int, float>, size_t>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = cached_key_radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i){ return i.first; });
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(cached_key_radix_sort, tuple)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(-1000, 1000);
+    std::vector<std::tuple<bool, int, double>> to_sort;
+    for (size_t i = 0; i < 10000; ++i)
+        to_sort.emplace_back(distribution(randomness) > 0, distribution(randomness), distribution(randomness) * 0.25);
+    std::vector<std::tuple<bool, int, double>> result(to_sort.size());
+    std::vector<std::tuple<bool, int, double>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    bool which_buffer = cached_key_radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i){ return i; });
+    if (which_buffer)
+        ASSERT_EQ(sorted, result);
+    else
+        ASSERT_EQ(sorted, to_sort);
+}
+TEST(radix_sort_by_key, single_column)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<uint32_t> distribution(0, 5000);
+    std::vector<uint32_t> keys(200000);
+    std::vector<uint64_t> values(keys.size());
+    std::vector<std::pair<uint32_t, uint64_t>> sorted;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        keys[i] = distribution(randomness);
+        values[i] = i;
+        sorted.emplace_back(keys[i], i);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](auto & l, auto & r){ return l.first < r.first; });
+    std::vector<uint32_t> key_buffer(keys.size());
+    std::vector<uint64_t> value_buffer(keys.size());
+    radix_sort_by_key(keys.begin(), keys.end(), values.begin(), key_buffer.begin(), value_buffer.begin());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        ASSERT_EQ(sorted[i].first, keys[i]);
+        ASSERT_EQ(sorted[i].second, values[i]);
+    }
+}
+TEST(radix_sort_by_key, big_columns)
+{
+    // big enough for the write combining scatter of every column. the
+    // second round only has keys that differ in bits 4 to 11, so its
+    // digits aren't whole bytes
+    std::mt19937_64 randomness(22);
+    for (int round = 0; round < 2; ++round)
+    {
+        std::vector<int32_t> keys(600000);
+        std::vector<uint64_t> indices(keys.size());
+        std::vector<uint8_t> bytes(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            keys[i] = round == 0 ? static_cast<int32_t>(randomness()) : static_cast<int32_t>(randomness() % 256) << 4;
+            indices[i] = i;
+            bytes[i] = static_cast<uint8_t>(i * 7);
+        }
+        std::vector<uint64_t> sorted = indices;
+        std::stable_sort(sorted.begin(), sorted.end(), [&](uint64_t l, uint64_t r){ return keys[l] < keys[r]; });
+        std::vector<int32_t> original_keys = keys;
+        std::vector<int32_t> key_buffer(keys.size());
+        std::vector<uint64_t> index_buffer(keys.size());
+        std::vector<uint8_t> byte_buffer(keys.size());
+        radix_sort_by_key(keys.begin(), keys.end(), std::make_tuple(indices.begin(), bytes.begin()), key_buffer.begin(), std::make_tuple(index_buffer.begin(), byte_buffer.begin()));
+        ASSERT_EQ(sorted, indices);
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            ASSERT_EQ(original_keys[sorted[i]], keys[i]);
+            ASSERT_EQ(static_cast<uint8_t>(sorted[i] * 7), bytes[i]);
+        }
+    }
+}
+TEST(radix_sort_by_key, several_columns)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(-100, 100);
+    std::vector<float> keys;
+    std::vector<int> indices;
+    std::vector<std::string> names;
+    for (int i = 0; i < 1000; ++i)
+    {
+        keys.push_back(distribution(randomness) * 0.5f);
+        indices.push_back(i);
+        names.push_back(std::to_string(i));
+    }
+    std::vector<int> sorted = indices;
+    std::stable_sort(sorted.begin(), sorted.end(), [&](int l, int r){ return keys[l] < keys[r]; });
+    std::vector<float> key_buffer(keys.size());
+    std::vector<int> index_buffer(keys.size());
+    std::vector<std::string> name_buffer(keys.size());
+    std::vector<float> original_keys = keys;
+    radix_sort_by_key(keys.begin(), keys.end(), std::make_tuple(indices.begin(), names.begin()), key_buffer.begin(), std::make_tuple(index_buffer.begin(), name_buffer.begin()));
+    ASSERT_EQ(sorted, indices);
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        ASSERT_EQ(original_keys[sorted[i]], keys[i]);
+        ASSERT_EQ(std::to_string(sorted[i]), names[i]);
+    }
+}
+TEST(radix_argsort, packed_keys)
+{
+    std::mt19937_64 randomness(5);
+    std::uniform_int_distribution<int> distribution(-100, 100);
+    std::vector<int16_t> to_sort(10000);
+    for (int16_t & i : to_sort)
+        i = static_cast<int16_t>(distribution(randomness));
+    std::vector<uint32_t> sorted(to_sort.size());
+    for (size_t i = 0; i < sorted.size(); ++i)
+        sorted[i] = static_cast<uint32_t>(i);
+    std::stable_sort(sorted.begin(), sorted.end(), [&](uint32_t l, uint32_t r){ return to_sort[l] < to_sort[r]; });
+    std::vector<uint32_t> indices(to_sort.size());
+    ASSERT_EQ(indices.end(), radix_argsort(to_sort.begin(), to_sort.end(), indices.begin()));
+    ASSERT_EQ(sorted, indices);
+}
+TEST(radix_argsort, composite_and_string_keys)
+{
+    std::vector<std::pair<std::string, float>> to_sort = { { "b", 1.0f }, { "abc", -2.0f }, { "", 3.0f }, { "ab", 4.0f }, { "b", 0.5f }, { "abc", -2.0f } };
+    std::vector<size_t> by_string;
+    radix_argsort(to_sort.begin(), to_sort.end(), std::back_inserter(by_string), [](auto & i) -> const std::string & { return i.first; });
+    ASSERT_EQ(std::vector<size_t>({ 2, 3, 1, 5, 0, 4 }), by_string);
+    std::vector<size_t> by_pair(to_sort.size());
+    radix_argsort(to_sort.begin(), to_sort.end(), by_pair.begin(), [](auto & i){ return std::make_pair(radix_sort_descending(i.second), i.first.size()); });
+    ASSERT_EQ(std::vector<size_t>({ 3, 2, 0, 4, 1, 5 }), by_pair);
+}
+TEST(apply_permutation, columns)
 {
-    std::mt19937_64 randomness(77342348);
-    auto buffer = create_radix_sort_data(randomness, state.range(0));
-    while (state.KeepRunning())
+    std::vector<uint64_t> keys = { 5, 3, 9, 3, 1 };
+    std::vector<std::string> names = { "five", "three", "nine", "three again", "one" };
+    std::vector<uint32_t> permutation(keys.size());
+    radix_argsort(keys.begin(), keys.end(), permutation.begin());
+    std::vector<uint64_t> sorted_keys(keys.size());
+    std::vector<std::string> sorted_names(keys.size());
+    apply_permutation(permutation.begin(), permutation.end(), std::make_tuple(keys.begin(), names.begin()), std::make_tuple(sorted_keys.begin(), sorted_names.begin()));
+    ASSERT_EQ(std::vector<uint64_t>({ 1, 3, 3, 5, 9 }), sorted_keys);
+    ASSERT_EQ(std::vector<std::string>({ "one", "three", "three again", "five", "nine" }), sorted_names);
+    std::vector<std::string> unsorted_names(keys.size());
+    apply_inverse_permutation(permutation.begin(), permutation.end(), sorted_names.begin(), unsorted_names.begin());
+    ASSERT_EQ(names, unsorted_names);
+}
+TEST(linear_sort, big_elements)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<std::pair<int64_t, std::array<uint64_t, 7>>> to_sort(5000);
+    for (std::pair<int64_t, std::array<uint64_t, 7>> & i : to_sort)
     {
-        auto to_sort = create_radix_sort_data(randomness, state.range(0));
-#ifdef SORT_ON_FIRST_ONLY
-        radix_sort(to_sort.begin(), to_sort.end(), buffer.begin(), [](auto && a){ return std::get<0>(a); });
-#else
-        bool which = radix_sort(to_sort.begin(), to_sort.end(), buffer.begin());
-        if (which)
-            assert(std::is_sorted(buffer.begin(), buffer.end()));
+        i.first = static_cast<int64_t>(randomness());
+        i.second.fill(static_cast<uint64_t>(i.first));
+    }
+    std::vector<std::pair<int64_t, std::array<uint64_t, 7>>> result(to_sort.size());
+    std::vector<std::pair<int64_t, std::array<uint64_t, 7>>> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    // the elements are much bigger than the keys, so this uses the indirect
+    // sort, which always leaves the result in the buffer
+    ASSERT_TRUE(linear_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i){ return i.first; }));
+    ASSERT_EQ(sorted, result);
+}
+TEST(linear_sort, list)
+{
+    std::mt19937_64 randomness(5);
+    std::list<uint64_t> to_sort;
+    for (size_t i = 0; i < 5000; ++i)
+        to_sort.push_back(randomness());
+    std::list<uint64_t> sorted = to_sort;
+    sorted.sort();
+    ASSERT_FALSE(linear_sort(to_sort.begin(), to_sort.end(), to_sort.begin()));
+    ASSERT_EQ(sorted, to_sort);
+}
+
+TEST(linear_sort, descending)
+{
+    std::mt19937_64 randomness(5);
+    for (size_t size : { 10, 5000 })
+    {
+        std::vector<int64_t> to_sort(size);
+        for (int64_t & i : to_sort)
+            i = static_cast<int64_t>(randomness());
+        std::vector<int64_t> result(to_sort.size());
+        std::vector<int64_t> sorted = to_sort;
+        std::sort(sorted.begin(), sorted.end(), std::greater<>());
+        bool which_buffer = linear_sort(to_sort.begin(), to_sort.end(), result.begin(), [](int64_t i){ return i; }, radix_sort_order::descending);
+        if (which_buffer)
+            ASSERT_EQ(sorted, result);
         else
-            assert(std::is_sorted(to_sort.begin(), to_sort.end()));
-#endif
+            ASSERT_EQ(sorted, to_sort);
     }
 }
-BENCHMARK(benchmark_radix_sort)->RangeMultiplier(profile_multiplier)->Range(profile_multiplier, max_profile_range);
 
-static void benchmark_linear_sort(benchmark::State & state)
+TEST(linear_sort, thresholds)
 {
-    std::mt19937_64 randomness(77342348);
-    auto buffer = create_radix_sort_data(randomness, state.range(0));
-    while (state.KeepRunning())
+    std::ptrdiff_t threshold = detail::linear_sort_threshold<uint32_t, uint32_t>();
+    ASSERT_EQ(threshold, (detail::linear_sort_thresholds[3][2]));
+    ASSERT_EQ(detail::linear_sort_never, (detail::linear_sort_threshold<std::array<uint64_t, 4>, const std::array<uint64_t, 4> &>()));
+    std::mt19937_64 randomness(5);
+    for (std::ptrdiff_t size : { threshold - 1, threshold })
     {
-        auto to_sort = create_radix_sort_data(randomness, state.range(0));
-#ifdef SORT_ON_FIRST_ONLY
-        linear_sort(to_sort.begin(), to_sort.end(), buffer.begin(), [](auto && a){ return std::get<0>(a); });
-#else
-        bool which = linear_sort(to_sort.begin(), to_sort.end(), buffer.begin());
-        if (which)
-            assert(std::is_sorted(buffer.begin(), buffer.end()));
+        std::vector<uint32_t> to_sort(size);
+        for (uint32_t & i : to_sort)
+            i = static_cast<uint32_t>(randomness());
+        std::vector<uint32_t> sorted = to_sort;
+        std::sort(sorted.begin(), sorted.end());
+        std::vector<uint32_t> result(to_sort.size());
+        bool which_buffer = linear_sort(to_sort.begin(), to_sort.end(), result.begin());
+        if (size < threshold)
+        {
+            ASSERT_FALSE(which_buffer);
+        }
+        if (which_buffer)
+            ASSERT_EQ(sorted, result);
         else
-            assert(std::is_sorted(to_sort.begin(), to_sort.end()));
-#endif
+            ASSERT_EQ(sorted, to_sort);
     }
 }
-BENCHMARK(benchmark_linear_sort)->RangeMultiplier(profile_multiplier)->Range(profile_multiplier, max_profile_range);
+struct recording_observer : radix_sort_null_observer
+{
+    struct pass
+    {
+        radix_sort_pass_info info;
+        std::uint64_t histogram_total;
+    };
+    std::vector<pass> passes;
+    std::vector<linear_sort_info> linear_sorts;
 
-static void benchmark_std_sort(benchmark::State & state)
+    void on_pass(const radix_sort_pass_info & info)
+    {
+        passes.push_back({ info, std::accumulate(info.histogram, info.histogram + info.num_buckets, std::uint64_t(0)) });
+    }
+    void on_linear_sort(const linear_sort_info & info)
+    {
+        linear_sorts.push_back(info);
+    }
+};
+TEST(radix_sort_observer, passes)
 {
-    std::mt19937_64 randomness(77342348);
-    while (state.KeepRunning())
+    // the two upper bytes are the same in every key, so their passes are
+    // trivial
+    std::mt19937_64 randomness(5);
+    std::vector<uint32_t> to_sort(1000);
+    for (uint32_t & i : to_sort)
+        i = 0x12000000u | static_cast<uint32_t>(randomness() & 0xffff);
+    std::vector<uint32_t> sorted = to_sort;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<uint32_t> result(to_sort.size());
+    recording_observer observer;
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](uint32_t i){ return i; }, observer);
+    ASSERT_FALSE(which_buffer);
+    ASSERT_EQ(sorted, to_sort);
+    ASSERT_EQ(4u, observer.passes.size());
+    size_t num_trivial = 0;
+    for (const recording_observer::pass & pass : observer.passes)
     {
-        auto to_sort = create_radix_sort_data(randomness, state.range(0));
-#ifdef SORT_ON_FIRST_ONLY
-        std::sort(to_sort.begin(), to_sort.end(), [](auto && l, auto && r){ return std::get<0>(l) < std::get<0>(r); });
-#else
-        std::sort(to_sort.begin(), to_sort.end());
-        assert(std::is_sorted(to_sort.begin(), to_sort.end()));
-#endif
+        ASSERT_EQ(1000u, pass.histogram_total);
+        ASSERT_EQ(256u, pass.info.num_buckets);
+        if (pass.info.trivial)
+        {
+            ++num_trivial;
+            ASSERT_GE(pass.info.digit_index, 2u);
+            ASSERT_EQ(1u, pass.info.non_empty_buckets);
+            ASSERT_EQ(1.0, pass.info.largest_bucket_share);
+            ASSERT_EQ(0u, pass.info.bytes_moved);
+        }
+        else
+        {
+            ASSERT_LT(pass.info.digit_index, 2u);
+            ASSERT_GT(pass.info.non_empty_buckets, 200u);
+            ASSERT_LT(pass.info.largest_bucket_share, 0.1);
+            ASSERT_EQ(1000u * sizeof(uint32_t), pass.info.bytes_moved);
+        }
     }
+    ASSERT_EQ(2u, num_trivial);
+}
+TEST(radix_sort_observer, counters)
+{
+    std::vector<std::pair<bool, uint8_t>> to_sort;
+    for (int i = 0; i < 300; ++i)
+        to_sort.emplace_back(i % 5 == 0, static_cast<uint8_t>(i % 7 ? 3 : i));
+    std::vector<std::pair<bool, uint8_t>> result(to_sort.size());
+    radix_sort_counters counters;
+    bool which_buffer = radix_sort(to_sort.begin(), to_sort.end(), result.begin(), [](auto & i) -> decltype(auto){ return i; }, counters);
+    ASSERT_TRUE(std::is_sorted(which_buffer ? result.begin() : to_sort.begin(), which_buffer ? result.end() : to_sort.end()));
+    ASSERT_EQ(2u, counters.num_passes);
+    ASSERT_EQ(0u, counters.num_trivial_passes);
+    // four out of five bools are false, and the uint8_t is 3 for six out of
+    // seven elements
+    ASSERT_EQ(2u, counters.num_skewed_passes);
+    ASSERT_GT(counters.max_bucket_share, 0.8);
+    ASSERT_EQ(2 * 300 * sizeof(std::pair<bool, uint8_t>), counters.bytes_moved);
+}
+TEST(radix_sort_observer, linear_sort_path)
+{
+    recording_observer observer;
+    std::vector<uint64_t> small = { 5, 3, 4 };
+    std::vector<uint64_t> buffer(small.size());
+    ASSERT_FALSE(linear_sort(small.begin(), small.end(), buffer.begin(), [](uint64_t i){ return i; }, observer));
+    ASSERT_EQ((std::vector<uint64_t>{ 3, 4, 5 }), small);
+    ASSERT_EQ(1u, observer.linear_sorts.size());
+    ASSERT_EQ(linear_sort_path::std_sort, observer.linear_sorts[0].path);
+    ASSERT_EQ(linear_sort_reason::few_elements, observer.linear_sorts[0].reason);
+    ASSERT_TRUE(observer.passes.empty());
+
+    std::mt19937_64 randomness(5);
+    std::vector<uint64_t> big(10000);
+    for (uint64_t & i : big)
+        i = randomness();
+    buffer.resize(big.size());
+    linear_sort(big.begin(), big.end(), buffer.begin(), [](uint64_t i){ return i; }, observer);
+    ASSERT_EQ(2u, observer.linear_sorts.size());
+    ASSERT_EQ(linear_sort_path::radix_sort, observer.linear_sorts[1].path);
+    ASSERT_EQ(linear_sort_reason::many_elements, observer.linear_sorts[1].reason);
+    ASSERT_FALSE(observer.passes.empty());
+
+    radix_sort_null_observer null_observer;
+    std::shuffle(big.begin(), big.end(), randomness);
+    bool which_buffer = linear_sort(big.begin(), big.end(), buffer.begin(), [](uint64_t i){ return i; }, null_observer);
+    ASSERT_TRUE(std::is_sorted(which_buffer ? buffer.begin() : big.begin(), which_buffer ? buffer.end() : big.end()));
+}
+TEST(linear_sort, tuple)
+{
+    std::vector<std::tuple<bool, int, bool>> to_sort = { std::tuple<bool, int, bool>{ true, 5, true }, std::tuple<bool, int, bool>{ true, 5, false }, std::tuple<bool, int, bool>{ false, 6, false }, std::tuple<bool, int, bool>{ true, 7, true }, std::tuple<bool, int, bool>{ true, 4, false }, std::tuple<bool, int, bool>{ false, 4, true }, std::tuple<bool, int, bool>{ false, 5, false } };
+    std::vector<std::tuple<bool, int, bool>> result = to_sort;
+    bool which_buffer = linear_sort(to_sort.begin(), to_sort.end(), result.begin());
+    if (which_buffer)
+        std::sort(to_sort.begin(), to_sort.end());
+    else
+        std::sort(result.begin(), result.end());
+    ASSERT_EQ(result, to_sort);
 }
-BENCHMARK(benchmark_std_sort)->RangeMultiplier(profile_multiplier)->Range(profile_multiplier, max_profile_range);
 
 #endif
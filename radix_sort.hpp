@@ -5,21 +5,365 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <type_traits>
 #include <tuple>
 #include <utility>
+#include <vector>
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#define RADIX_SORT_HAS_CPP17
+#include <optional>
+#include <string_view>
+#endif
+
+#ifdef __SIZEOF_INT128__
+#define RADIX_SORT_HAS_INT128
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RADIX_SORT_HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define RADIX_SORT_HAS_RDTSC
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#define RADIX_SORT_HAS_RDTSC
+#include <x86intrin.h>
+#endif
+
+// radix_sort_calibrate writes a header with the linear_sort thresholds and
+// the size at which the hybrid MSD/LSD sort starts for the machine that it
+// runs on. define this to the name of that header to use those thresholds
+// instead of the built in ones
+#ifdef RADIX_SORT_THRESHOLDS_HEADER
+#include RADIX_SORT_THRESHOLDS_HEADER
+#endif
+
+// a simple thread pool that can be passed to radix_sort. you can also pass
+// your own thread pool type as long as it has the same two member functions:
+// num_threads() and parallel_for(num_tasks, f)
+class radix_sort_thread_pool
+{
+public:
+    explicit radix_sort_thread_pool(std::size_t num_threads = std::thread::hardware_concurrency())
+    {
+        if (num_threads == 0)
+            num_threads = 1;
+        workers.reserve(num_threads - 1);
+        for (std::size_t i = 1; i < num_threads; ++i)
+            workers.emplace_back([this]{ worker_loop(); });
+    }
+    ~radix_sort_thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shutting_down = true;
+        }
+        wake_workers.notify_all();
+        for (std::thread & worker : workers)
+            worker.join();
+    }
+    radix_sort_thread_pool(const radix_sort_thread_pool &) = delete;
+    radix_sort_thread_pool & operator=(const radix_sort_thread_pool &) = delete;
+
+    std::size_t num_threads() const
+    {
+        return workers.size() + 1;
+    }
+
+    // calls f(i) for every i in [0, num_tasks) and returns once all calls
+    // have finished. the calling thread works on tasks as well. if a task
+    // throws, the first exception is rethrown here
+    template<typename F>
+    void parallel_for(std::size_t num_tasks, F && f)
+    {
+        if (num_tasks <= 1 || workers.empty())
+        {
+            for (std::size_t i = 0; i < num_tasks; ++i)
+                f(i);
+            return;
+        }
+        std::lock_guard<std::mutex> run_lock(run_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job_function = &run_task<typename std::remove_reference<F>::type>;
+            job_argument = std::addressof(f);
+            job_size = num_tasks;
+            next_task = 0;
+            busy_workers = workers.size();
+            first_exception = nullptr;
+            ++generation;
+        }
+        wake_workers.notify_all();
+        work_on_tasks();
+        std::unique_lock<std::mutex> lock(mutex);
+        workers_done.wait(lock, [&]{ return busy_workers == 0; });
+        if (first_exception)
+            std::rethrow_exception(first_exception);
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex run_mutex;
+    std::mutex mutex;
+    std::condition_variable wake_workers;
+    std::condition_variable workers_done;
+    void (*job_function)(void *, std::size_t) = nullptr;
+    void * job_argument = nullptr;
+    std::size_t job_size = 0;
+    std::atomic<std::size_t> next_task{0};
+    std::size_t busy_workers = 0;
+    std::size_t generation = 0;
+    std::exception_ptr first_exception;
+    bool shutting_down = false;
+
+    template<typename F>
+    static void run_task(void * f, std::size_t i)
+    {
+        (*static_cast<F *>(f))(i);
+    }
+
+    void work_on_tasks()
+    {
+        try
+        {
+            for (std::size_t i = next_task++; i < job_size; i = next_task++)
+                job_function(job_argument, i);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!first_exception)
+                first_exception = std::current_exception();
+            // skip the remaining tasks
+            next_task = job_size;
+        }
+    }
+
+    void worker_loop()
+    {
+        std::size_t seen_generation = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake_workers.wait(lock, [&]{ return shutting_down || generation != seen_generation; });
+                if (shutting_down)
+                    return;
+                seen_generation = generation;
+            }
+            work_on_tasks();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy_workers == 0)
+                workers_done.notify_one();
+        }
+    }
+};
+
+// how many bits radix_sort sorts by in one pass. wider digits need fewer
+// passes but bigger histograms, and they scatter into more places at once.
+// automatic picks a width based on the key size and the number of elements
+enum class radix_sort_digits
+{
+    automatic,
+    bits_8,
+    bits_11,
+    bits_16
+};
+
+// the order that radix_sort and linear_sort sort the keys in
+enum class radix_sort_order
+{
+    ascending,
+    descending
+};
+// a key that is sorted in descending order. radix_sort_descending makes one,
+// and it can be a part of a pair or tuple key. for example to sort by a in
+// ascending order and then by b in descending order, return
+//     std::make_tuple(t.a, radix_sort_descending(t.b))
+// from the extract_key function. the sorts flip the bytes of the key instead
+// of comparing differently, so this costs no extra passes and keeps the sort
+// stable
+template<typename T>
+struct radix_sort_descending_key
+{
+    T key;
+};
+template<typename T>
+bool operator<(const radix_sort_descending_key<T> & lhs, const radix_sort_descending_key<T> & rhs)
+{
+    return rhs.key < lhs.key;
+}
+#ifdef RADIX_SORT_HAS_CPP17
+// std::optional keys sort the empty optionals first, like operator< does.
+// this key sorts them after all the values instead. radix_sort_nulls_last
+// makes one. either way the empty state is packed into the key next to the
+// value, so it doesn't cost a pass of its own
+template<typename T>
+struct radix_sort_nulls_last_key
+{
+    std::optional<T> key;
+};
+template<typename T>
+bool operator<(const radix_sort_nulls_last_key<T> & lhs, const radix_sort_nulls_last_key<T> & rhs)
+{
+    return lhs.key && (!rhs.key || *lhs.key < *rhs.key);
+}
+#endif
+
+// what radix_sort tells an observer about every pass. passes over digits
+// that are the same in all elements are skipped, and those get reported
+// with trivial set and without bytes_moved or cycles
+struct radix_sort_pass_info
+{
+    // counts digits of digit_bits bits starting at the least significant
+    // end of the key. for pairs, tuples and arrays of scalars the digits of
+    // all members are counted together. other pairs, tuples and arrays sort
+    // their members one after another, and each member counts from 0 again
+    std::size_t digit_index = 0;
+    unsigned digit_bits = 8;
+    // how many elements had each value of the digit. only valid during the
+    // call to the observer
+    const std::uint64_t * histogram = nullptr;
+    std::size_t num_buckets = 0;
+    std::size_t num_elements = 0;
+    std::size_t non_empty_buckets = 0;
+    double largest_bucket_share = 0.0;
+    bool trivial = false;
+    std::size_t bytes_moved = 0;
+    // from the time stamp counter on x86, nanoseconds everywhere else
+    std::uint64_t cycles = 0;
+};
+
+enum class linear_sort_path
+{
+    std_sort,
+    radix_sort,
+    indirect_radix_sort
+};
+enum class linear_sort_reason
+{
+    // fewer elements than the threshold for the key and the element size
+    few_elements,
+    // the key needs so many passes that std::sort is always faster
+    too_many_passes,
+    // the elements are big compared to their keys
+    big_elements,
+    many_elements
+};
+struct linear_sort_info
+{
+    linear_sort_path path = linear_sort_path::std_sort;
+    linear_sort_reason reason = linear_sort_reason::few_elements;
+    std::size_t num_elements = 0;
+    std::size_t element_size = 0;
+    std::size_t pass_count = 0;
+    std::ptrdiff_t threshold = 0;
+};
+
+// observers get passed to radix_sort and linear_sort and get called for
+// every pass and for the choice that linear_sort makes. derive from this to
+// only handle some of the calls. sorting with this observer compiles to the
+// same code as sorting without an observer
+struct radix_sort_null_observer
+{
+    void on_pass(const radix_sort_pass_info &)
+    {
+    }
+    void on_linear_sort(const linear_sort_info &)
+    {
+    }
+};
+
+// adds up the reports of many sorts, for example to export them as metrics.
+// skewed passes are passes where one bucket got more than half the elements
+struct radix_sort_counters : radix_sort_null_observer
+{
+    std::uint64_t num_passes = 0;
+    std::uint64_t num_trivial_passes = 0;
+    std::uint64_t num_skewed_passes = 0;
+    std::uint64_t bytes_moved = 0;
+    std::uint64_t cycles = 0;
+    double max_bucket_share = 0.0;
+    std::uint64_t linear_sort_paths[3] = {};
+
+    void on_pass(const radix_sort_pass_info & pass)
+    {
+        ++num_passes;
+        if (pass.trivial)
+            ++num_trivial_passes;
+        else if (pass.largest_bucket_share > 0.5)
+            ++num_skewed_passes;
+        if (!pass.trivial)
+            max_bucket_share = std::max(max_bucket_share, pass.largest_bucket_share);
+        bytes_moved += pass.bytes_moved;
+        cycles += pass.cycles;
+    }
+    void on_linear_sort(const linear_sort_info & info)
+    {
+        ++linear_sort_paths[static_cast<std::size_t>(info.path)];
+    }
+};
 
 namespace detail
 {
+// when neighboring elements fall into the same bucket, every increment of a
+// histogram has to wait for the store of the previous one. on data with few
+// distinct values that is the bottleneck of the counting read. so for bigger
+// inputs we count neighboring elements into separate histograms and add them
+// up at the end. this was 3 times faster for a single byte histogram of
+// constant data, and equally fast on random data. the counting stays scalar:
+// an AVX2 kernel that transposes the bytes of the keys and an AVX-512 kernel
+// that gathers, adds the conflicts and scatters were both tried, and neither
+// was faster than this loop for 32 or 64 bit keys. the gather and scatter
+// version was about half as fast
+static constexpr std::ptrdiff_t sub_histogram_threshold = 1024;
+
+template<typename count_type, typename It, typename ExtractByte>
+void count_bytes(It begin, It end, count_type * counts, ExtractByte && extract_byte)
+{
+    if (end - begin < sub_histogram_threshold)
+    {
+        for (; begin != end; ++begin)
+            ++counts[extract_byte(*begin)];
+        return;
+    }
+    count_type sub_counts[3][256] = {};
+    for (; end - begin >= 4; begin += 4)
+    {
+        ++counts[extract_byte(begin[0])];
+        ++sub_counts[0][extract_byte(begin[1])];
+        ++sub_counts[1][extract_byte(begin[2])];
+        ++sub_counts[2][extract_byte(begin[3])];
+    }
+    for (; begin != end; ++begin)
+        ++counts[extract_byte(*begin)];
+    for (int i = 0; i < 256; ++i)
+        counts[i] += sub_counts[0][i] + sub_counts[1][i] + sub_counts[2][i];
+}
+
 template<typename count_type, typename It, typename OutIt, typename ExtractKey>
 void counting_sort_impl(It begin, It end, OutIt out_begin, ExtractKey && extract_key)
 {
     count_type counts[256] = {};
-    for (It it = begin; it != end; ++it)
-    {
-        ++counts[extract_key(*it)];
-    }
+    count_bytes(begin, end, counts, extract_key);
     count_type total = 0;
     for (count_type & count : counts)
     {
@@ -46,647 +390,3633 @@ void counting_sort_impl(It begin, It end, OutIt out_begin, ExtractKey && extract
     else
         counting_sort_impl<std::uint64_t>(begin, end, out_begin, extract_key);
 }
-inline bool to_unsigned(bool b)
+
+inline std::uint64_t big_endian_to_native(std::uint64_t value)
 {
-    return b;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_bswap64(value);
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return value;
+#else
+    unsigned char bytes[8];
+    std::memcpy(bytes, &value, 8);
+    std::uint64_t result = 0;
+    for (int i = 0; i < 8; ++i)
+        result = (result << 8) | bytes[i];
+    return result;
+#endif
 }
-inline unsigned char to_unsigned(unsigned char c)
+
+// sequences that have a data() member which points at their elements
+template<typename T>
+struct is_contiguous_sequence : std::false_type
 {
-    return c;
-}
-inline unsigned char to_unsigned(signed char c)
+};
+template<typename CharT, typename Traits, typename Allocator>
+struct is_contiguous_sequence<std::basic_string<CharT, Traits, Allocator>> : std::true_type
 {
-    return static_cast<unsigned char>(c) + 128;
-}
-inline unsigned char to_unsigned(char c)
+};
+#ifdef RADIX_SORT_HAS_CPP17
+template<typename CharT, typename Traits>
+struct is_contiguous_sequence<std::basic_string_view<CharT, Traits>> : std::true_type
 {
-    return static_cast<unsigned char>(c);
-}
-inline std::uint16_t to_unsined(char16_t c)
+};
+#endif
+template<typename T, typename Allocator>
+struct is_contiguous_sequence<std::vector<T, Allocator>> : std::true_type
 {
-    return static_cast<std::uint16_t>(c);
-}
-inline std::uint32_t to_unsined(char32_t c)
+};
+template<typename Allocator>
+struct is_contiguous_sequence<std::vector<bool, Allocator>> : std::false_type
 {
-    return static_cast<std::uint32_t>(c);
-}
-inline std::uint32_t to_unsined(wchar_t c)
+};
+
+template<typename count_type>
+void counts_to_offsets(count_type * counts)
 {
-    return static_cast<std::uint32_t>(c);
+    count_type total = 0;
+    for (int i = 0; i < 256; ++i)
+    {
+        count_type old_count = counts[i];
+        counts[i] = total;
+        total += old_count;
+    }
 }
-inline unsigned short to_unsigned(short i)
+
+// how a scatter pass writes its output. the direct mode writes every element
+// straight to its bucket. that is fastest as long as the output fits in the
+// cache, but on bigger inputs every one of the 256 write positions is a cache
+// miss and a TLB miss. the write combining mode collects the elements for
+// each bucket in a few cache lines on the stack and only writes whole lines
+// to the output. the non temporal mode writes those lines past the cache so
+// that they don't evict the input. on x86-64 that was always faster than
+// plain write combining, so we only use plain write combining without SSE2
+enum class ScatterMode
 {
-    return static_cast<unsigned short>(i) + static_cast<unsigned short>(1 << (sizeof(short) * 8 - 1));
-}
-inline unsigned short to_unsigned(unsigned short i)
+    direct,
+    write_combining,
+    non_temporal
+};
+
+static constexpr std::size_t scatter_cache_line_size = 64;
+static constexpr std::size_t scatter_block_size = 4 * scatter_cache_line_size;
+// the crossover point in bytes of input, measured on x86-64 for 8, 16 and 32
+// byte elements. below this the output mostly stays in the cache
+static constexpr std::size_t write_combining_threshold = std::size_t(1) << 21;
+static constexpr std::size_t scatter_prefetch_bytes = 1024;
+
+// write combining copies the elements with memcpy. pairs, tuples and arrays
+// of trivially copyable types are not trivially copyable themselves because
+// they have assignment operators, but they can still be copied as bytes
+template<typename T>
+struct is_memcpyable : std::is_trivially_copyable<T>
 {
-    return i;
-}
-inline unsigned int to_unsigned(int i)
+};
+template<typename T, typename U>
+struct is_memcpyable<std::pair<T, U>> : std::integral_constant<bool, is_memcpyable<T>::value && is_memcpyable<U>::value>
 {
-    return static_cast<unsigned int>(i) + static_cast<unsigned int>(1 << (sizeof(int) * 8 - 1));
-}
-inline unsigned int to_unsigned(unsigned int i)
+};
+template<>
+struct is_memcpyable<std::tuple<>> : std::true_type
 {
-    return i;
-}
-inline unsigned long to_unsigned(long l)
+};
+template<typename First, typename... More>
+struct is_memcpyable<std::tuple<First, More...>> : std::integral_constant<bool, is_memcpyable<First>::value && is_memcpyable<std::tuple<More...>>::value>
 {
-    return static_cast<unsigned long>(l) + static_cast<unsigned long>(1l << (sizeof(long) * 8 - 1));
-}
-inline unsigned long to_unsigned(unsigned long l)
+};
+template<typename T, size_t Size>
+struct is_memcpyable<std::array<T, Size>> : is_memcpyable<T>
 {
-    return l;
-}
-inline unsigned long long to_unsigned(long long l)
+};
+
+// write combining needs a pointer to the elements. we also only do it if
+// enough elements fit into a block
+template<typename It>
+struct is_pointer_like_iterator
 {
-    return static_cast<unsigned long long>(l) + static_cast<unsigned long long>(1ll << (sizeof(long long) * 8 - 1));
-}
-inline unsigned long long to_unsigned(unsigned long long l)
+    typedef typename std::iterator_traits<It>::value_type value_type;
+    static constexpr bool value = std::is_pointer<It>::value
+        || std::is_same<It, typename std::vector<value_type>::iterator>::value;
+};
+template<>
+struct is_pointer_like_iterator<std::vector<bool>::iterator> : std::false_type
 {
-    return l;
-}
-inline std::uint32_t to_unsigned(float f)
+};
+template<typename It, typename OutIt>
+struct can_write_combine
 {
-    union
-    {
-        float f;
-        std::uint32_t u;
-    } as_union = { f };
-    std::uint32_t sign_bit = -std::int32_t(as_union.u >> 31);
-    return as_union.u ^ (sign_bit | 0x80000000);
-}
-inline std::uint64_t to_unsigned(double f)
+    typedef typename std::iterator_traits<It>::value_type value_type;
+    static constexpr bool value = is_pointer_like_iterator<It>::value
+        && is_pointer_like_iterator<OutIt>::value
+        && std::is_same<value_type, typename std::iterator_traits<OutIt>::value_type>::value
+        && is_memcpyable<value_type>::value
+        && sizeof(value_type) * 8 <= scatter_block_size;
+};
+
+template<typename It, typename OutIt>
+ScatterMode choose_scatter_mode(std::ptrdiff_t num_elements)
 {
-    union
-    {
-        double d;
-        std::uint64_t u;
-    } as_union = { f };
-    std::uint64_t sign_bit = -std::int64_t(as_union.u >> 63);
-    return as_union.u ^ (sign_bit | 0x8000000000000000);
+    typedef typename std::iterator_traits<It>::value_type value_type;
+    if (!can_write_combine<It, OutIt>::value)
+        return ScatterMode::direct;
+    std::size_t num_bytes = static_cast<std::size_t>(num_elements) * sizeof(value_type);
+    if (num_bytes < write_combining_threshold)
+        return ScatterMode::direct;
+#ifdef RADIX_SORT_HAS_SSE2
+    return ScatterMode::non_temporal;
+#else
+    return ScatterMode::write_combining;
+#endif
 }
 
-template<size_t>
-struct SizedRadixSorter;
-
-template<>
-struct SizedRadixSorter<1>
+template<typename count_type, typename It, typename OutIt, typename ExtractDigit>
+void direct_scatter(It begin, It end, OutIt out_begin, count_type * offsets, ExtractDigit && extract_digit)
 {
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
+    for (; begin != end; ++begin)
     {
-        counting_sort_impl(begin, end, buffer_begin, [&](auto && o)
-        {
-            return to_unsigned(extract_key(o));
-        });
-        return true;
+        auto digit = extract_digit(*begin);
+        out_begin[offsets[digit]++] = std::move(*begin);
     }
+}
 
-    static constexpr size_t pass_count = 2;
-};
+template<bool NonTemporal>
+inline void write_block(unsigned char * out, const unsigned char * block)
+{
+    std::memcpy(out, block, scatter_block_size);
+}
+#ifdef RADIX_SORT_HAS_SSE2
 template<>
-struct SizedRadixSorter<2>
+inline void write_block<true>(unsigned char * out, const unsigned char * block)
 {
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
+    for (std::size_t i = 0; i < scatter_block_size; i += 16)
+        _mm_stream_si128(reinterpret_cast<__m128i *>(out + i), _mm_load_si128(reinterpret_cast<const __m128i *>(block + i)));
+}
+#endif
+
+// the first flush of every bucket only goes up to the next cache line
+// boundary in the output. after that every flush writes one aligned block.
+// if the output is not aligned to the element size, the blocks can never be
+// aligned, so then we only combine writes and don't stream them
+template<bool NonTemporal, typename T, typename count_type, typename ExtractDigit>
+void write_combining_scatter(T * begin, T * end, T * out_begin, count_type * offsets, ExtractDigit & extract_digit)
+{
+    static constexpr std::size_t per_block = scatter_block_size / sizeof(T);
+    static constexpr std::ptrdiff_t prefetch_distance = scatter_prefetch_bytes / sizeof(T);
+    alignas(scatter_cache_line_size) unsigned char blocks[256][scatter_block_size];
+    std::uint16_t num_staged[256];
+    std::uint16_t flush_at[256];
+    unsigned char * out_bytes = reinterpret_cast<unsigned char *>(out_begin);
+    bool aligned_blocks = (sizeof(T) & (sizeof(T) - 1)) == 0 && reinterpret_cast<std::uintptr_t>(out_begin) % sizeof(T) == 0;
+    for (int i = 0; i < 256; ++i)
     {
-        std::ptrdiff_t num_elements = end - begin;
-        if (num_elements <= (1 << 8))
-            return sort_inline<uint8_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key);
-        else if (num_elements <= (1 << 16))
-            return sort_inline<uint16_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key);
-        else if (num_elements <= (1ll << 32))
-            return sort_inline<uint32_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key);
+        num_staged[i] = 0;
+        std::size_t misalignment = reinterpret_cast<std::uintptr_t>(out_bytes + offsets[i] * sizeof(T)) % scatter_cache_line_size;
+        if (aligned_blocks && misalignment)
+            flush_at[i] = static_cast<std::uint16_t>((scatter_cache_line_size - misalignment) / sizeof(T));
         else
-            return sort_inline<uint64_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key);
+            flush_at[i] = static_cast<std::uint16_t>(per_block);
     }
-
-    template<typename count_type, typename It, typename OutIt, typename ExtractKey>
-    static bool sort_inline(It begin, It end, OutIt out_begin, OutIt out_end, ExtractKey && extract_key)
+    auto stage = [&](T & element)
     {
-        count_type counts0[256] = {};
-        count_type counts1[256] = {};
-
-        for (It it = begin; it != end; ++it)
+        std::uint8_t digit = extract_digit(element);
+        std::uint16_t staged = num_staged[digit];
+        std::memcpy(blocks[digit] + staged * sizeof(T), &element, sizeof(T));
+        if (++staged != flush_at[digit])
         {
-            uint16_t key = to_unsigned(extract_key(*it));
-            ++counts0[key & 0xff];
-            ++counts1[(key >> 8) & 0xff];
+            num_staged[digit] = staged;
+            return;
         }
-        count_type total0 = 0;
-        count_type total1 = 0;
-        for (int i = 0; i < 256; ++i)
-        {
-            count_type old_count0 = counts0[i];
-            count_type old_count1 = counts1[i];
-            counts0[i] = total0;
-            counts1[i] = total1;
-            total0 += old_count0;
-            total1 += old_count1;
-        }
-        for (It it = begin; it != end; ++it)
-        {
-            std::uint8_t key = to_unsigned(extract_key(*it));
-            out_begin[counts0[key]++] = std::move(*it);
-        }
-        for (OutIt it = out_begin; it != out_end; ++it)
+        unsigned char * out = out_bytes + offsets[digit] * sizeof(T);
+        if (staged == per_block && aligned_blocks)
+            write_block<NonTemporal>(out, blocks[digit]);
+        else
+            std::memcpy(out, blocks[digit], staged * sizeof(T));
+        offsets[digit] += staged;
+        num_staged[digit] = 0;
+        flush_at[digit] = static_cast<std::uint16_t>(per_block);
+    };
+    if (end - begin > prefetch_distance)
+    {
+        for (T * prefetch_end = end - prefetch_distance; begin != prefetch_end; ++begin)
         {
-            std::uint8_t key = to_unsigned(extract_key(*it)) >> 8;
-            begin[counts1[key]++] = std::move(*it);
+#ifdef __GNUC__
+            __builtin_prefetch(begin + prefetch_distance);
+#elif defined(RADIX_SORT_HAS_SSE2)
+            _mm_prefetch(reinterpret_cast<const char *>(begin + prefetch_distance), _MM_HINT_T0);
+#endif
+            stage(*begin);
         }
-        return false;
     }
+    for (; begin != end; ++begin)
+        stage(*begin);
+    for (int i = 0; i < 256; ++i)
+    {
+        std::memcpy(out_bytes + offsets[i] * sizeof(T), blocks[i], num_staged[i] * sizeof(T));
+        offsets[i] += num_staged[i];
+    }
+#ifdef RADIX_SORT_HAS_SSE2
+    if (NonTemporal)
+        _mm_sfence();
+#endif
+}
 
-    static constexpr size_t pass_count = 3;
-};
-template<>
-struct SizedRadixSorter<4>
+template<typename count_type, typename It, typename OutIt, typename ExtractDigit>
+void radix_scatter(It begin, It end, OutIt out_begin, count_type * offsets, ExtractDigit && extract_digit, ScatterMode mode, std::true_type)
+{
+    if (begin == end)
+        return;
+    if (mode == ScatterMode::write_combining)
+        write_combining_scatter<false>(&*begin, &*begin + (end - begin), &*out_begin, offsets, extract_digit);
+    else if (mode == ScatterMode::non_temporal)
+        write_combining_scatter<true>(&*begin, &*begin + (end - begin), &*out_begin, offsets, extract_digit);
+    else
+        direct_scatter(begin, end, out_begin, offsets, extract_digit);
+}
+template<typename count_type, typename It, typename OutIt, typename ExtractDigit>
+void radix_scatter(It begin, It end, OutIt out_begin, count_type * offsets, ExtractDigit && extract_digit, ScatterMode, std::false_type)
+{
+    direct_scatter(begin, end, out_begin, offsets, extract_digit);
+}
+template<typename count_type, typename It, typename OutIt, typename ExtractDigit>
+void radix_scatter(It begin, It end, OutIt out_begin, count_type * offsets, ExtractDigit && extract_digit, ScatterMode mode)
 {
+    radix_scatter(begin, end, out_begin, offsets, extract_digit, mode, std::integral_constant<bool, can_write_combine<It, OutIt>::value>{});
+}
 
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
+// where a sort should leave its result. the sorters that know their number
+// of passes before the first scatter plan for it, see should_fold_copy. the
+// others ignore it, and the caller has to copy back if they missed
+enum class ResultPlacement
+{
+    anywhere,
+    in_input,
+    in_buffer
+};
+
+struct SerialExecutor
+{
+    std::size_t num_threads() const
     {
-        std::ptrdiff_t num_elements = end - begin;
-        if (num_elements <= (1 << 8))
-            return sort_inline<uint8_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key);
-        else if (num_elements <= (1 << 16))
-            return sort_inline<uint16_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key);
-        else if (num_elements <= (1ll << 32))
-            return sort_inline<uint32_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key);
-        else
-            return sort_inline<uint64_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key);
+        return 1;
     }
-    template<typename count_type, typename It, typename OutIt, typename ExtractKey>
-    static bool sort_inline(It begin, It end, OutIt out_begin, OutIt out_end, ExtractKey && extract_key)
+    template<typename F>
+    void parallel_for(std::size_t num_tasks, F && f)
     {
-        count_type counts0[256] = {};
-        count_type counts1[256] = {};
-        count_type counts2[256] = {};
-        count_type counts3[256] = {};
-
-        for (It it = begin; it != end; ++it)
-        {
-            uint32_t key = to_unsigned(extract_key(*it));
-            ++counts0[key & 0xff];
-            ++counts1[(key >> 8) & 0xff];
-            ++counts2[(key >> 16) & 0xff];
-            ++counts3[(key >> 24) & 0xff];
-        }
-        count_type total0 = 0;
-        count_type total1 = 0;
-        count_type total2 = 0;
-        count_type total3 = 0;
-        for (int i = 0; i < 256; ++i)
-        {
-            count_type old_count0 = counts0[i];
-            count_type old_count1 = counts1[i];
-            count_type old_count2 = counts2[i];
-            count_type old_count3 = counts3[i];
-            counts0[i] = total0;
-            counts1[i] = total1;
-            counts2[i] = total2;
-            counts3[i] = total3;
-            total0 += old_count0;
-            total1 += old_count1;
-            total2 += old_count2;
-            total3 += old_count3;
-        }
-        for (It it = begin; it != end; ++it)
-        {
-            std::uint8_t key = to_unsigned(extract_key(*it));
-            out_begin[counts0[key]++] = std::move(*it);
-        }
-        for (OutIt it = out_begin; it != out_end; ++it)
-        {
-            std::uint8_t key = to_unsigned(extract_key(*it)) >> 8;
-            begin[counts1[key]++] = std::move(*it);
-        }
-        for (It it = begin; it != end; ++it)
-        {
-            std::uint8_t key = to_unsigned(extract_key(*it)) >> 16;
-            out_begin[counts2[key]++] = std::move(*it);
-        }
-        for (OutIt it = out_begin; it != out_end; ++it)
-        {
-            std::uint8_t key = to_unsigned(extract_key(*it)) >> 24;
-            begin[counts3[key]++] = std::move(*it);
-        }
-        return false;
+        for (std::size_t i = 0; i < num_tasks; ++i)
+            f(i);
     }
 
-    static constexpr size_t pass_count = 5;
+    // only the single threaded sort supports digits wider than a byte, so
+    // the serial executor is where the choice is stored
+    radix_sort_digits digits = radix_sort_digits::automatic;
+    // the threads of a parallel sort can't share the counting read, so only
+    // the serial executor has a placement to plan for
+    ResultPlacement placement = ResultPlacement::anywhere;
 };
-template<>
-struct SizedRadixSorter<8>
-{
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
+
+// below these sizes the cost of synchronizing threads is bigger than the
+// time we would save by running the passes in parallel
+static constexpr std::ptrdiff_t parallel_sort_threshold = 1 << 16;
+static constexpr std::ptrdiff_t min_elements_per_thread = 1 << 14;
+
+template<typename Executor>
+bool should_sort_in_parallel(Executor & executor, std::ptrdiff_t num_elements)
+{
+    return executor.num_threads() > 1 && num_elements >= parallel_sort_threshold;
+}
+inline bool should_sort_in_parallel(SerialExecutor &, std::ptrdiff_t)
+{
+    return false;
+}
+
+// a serial executor that also reports every pass to an observer. the other
+// executors get the empty versions of the functions below, so for them the
+// observation compiles to nothing
+template<typename Observer>
+struct ObservedSerialExecutor : SerialExecutor
+{
+    explicit ObservedSerialExecutor(Observer & observer)
+        : observer(observer)
+    {
+    }
+
+    Observer & observer;
+    std::vector<std::uint64_t> histogram;
+};
+template<typename Observer>
+bool should_sort_in_parallel(ObservedSerialExecutor<Observer> &, std::ptrdiff_t)
+{
+    return false;
+}
+
+inline std::uint64_t read_cycle_counter()
+{
+#ifdef RADIX_SORT_HAS_RDTSC
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+template<typename It>
+std::size_t range_bytes(It begin, It end)
+{
+    return static_cast<std::size_t>(end - begin) * sizeof(typename std::iterator_traits<It>::value_type);
+}
+
+struct NoPassObservation
+{
+};
+struct PassObservation
+{
+    radix_sort_pass_info info;
+    std::uint64_t start_cycles;
+};
+// call begin_observed_pass before turning the counts into offsets, and
+// end_observed_pass after the scatter
+template<typename Executor, typename count_type>
+NoPassObservation begin_observed_pass(Executor &, std::size_t, unsigned, const count_type *, std::size_t, std::size_t)
+{
+    return {};
+}
+template<typename Executor>
+void end_observed_pass(Executor &, NoPassObservation, std::size_t)
+{
+}
+template<typename Observer, typename count_type>
+PassObservation begin_observed_pass(ObservedSerialExecutor<Observer> & executor, std::size_t digit_index, unsigned digit_bits, const count_type * counts, std::size_t num_buckets, std::size_t num_elements)
+{
+    PassObservation observation;
+    radix_sort_pass_info & info = observation.info;
+    executor.histogram.assign(counts, counts + num_buckets);
+    std::uint64_t largest = 0;
+    for (std::uint64_t count : executor.histogram)
+    {
+        if (count)
+            ++info.non_empty_buckets;
+        largest = std::max(largest, count);
+    }
+    info.digit_index = digit_index;
+    info.digit_bits = digit_bits;
+    info.histogram = executor.histogram.data();
+    info.num_buckets = num_buckets;
+    info.num_elements = num_elements;
+    info.largest_bucket_share = num_elements ? static_cast<double>(largest) / num_elements : 0.0;
+    info.trivial = largest == num_elements;
+    observation.start_cycles = read_cycle_counter();
+    return observation;
+}
+template<typename Observer>
+void end_observed_pass(ObservedSerialExecutor<Observer> & executor, PassObservation & observation, std::size_t bytes_moved)
+{
+    if (!observation.info.trivial)
+    {
+        observation.info.cycles = read_cycle_counter() - observation.start_cycles;
+        observation.info.bytes_moved = bytes_moved;
+    }
+    executor.observer.on_pass(observation.info);
+}
+template<typename Executor>
+void observe_linear_sort(Executor &, const linear_sort_info &)
+{
+}
+template<typename T, typename = void>
+struct is_radix_sort_observer : std::false_type
+{
+};
+template<typename T>
+struct is_radix_sort_observer<T, decltype(static_cast<void>(std::declval<T &>().on_pass(std::declval<const radix_sort_pass_info &>())))> : std::true_type
+{
+};
+// the null observer gets the executor without observation
+inline SerialExecutor make_observed_executor(radix_sort_null_observer &)
+{
+    return {};
+}
+template<typename Observer>
+ObservedSerialExecutor<Observer> make_observed_executor(Observer & observer)
+{
+    return ObservedSerialExecutor<Observer>(observer);
+}
+template<typename Observer>
+void observe_linear_sort(ObservedSerialExecutor<Observer> & executor, const linear_sort_info & info)
+{
+    executor.observer.on_linear_sort(info);
+}
+
+// the parallel passes split the input into one contiguous chunk per thread
+template<typename Executor>
+std::size_t parallel_num_chunks(Executor & executor, std::ptrdiff_t num_elements)
+{
+    return std::max(std::size_t(1), std::min(executor.num_threads(), static_cast<std::size_t>(num_elements / min_elements_per_thread)));
+}
+inline std::ptrdiff_t parallel_chunk_offset(std::ptrdiff_t num_elements, std::size_t chunk, std::size_t num_chunks)
+{
+    return static_cast<std::ptrdiff_t>(static_cast<std::size_t>(num_elements) * chunk / num_chunks);
+}
+
+template<typename It, typename ExtractDigit, typename Executor>
+std::vector<std::array<std::size_t, 256>> parallel_count(It begin, It end, std::size_t num_chunks, ExtractDigit && extract_digit, Executor & executor)
+{
+    std::ptrdiff_t num_elements = end - begin;
+    std::vector<std::array<std::size_t, 256>> counts(num_chunks);
+    executor.parallel_for(num_chunks, [&](std::size_t chunk)
+    {
+        count_bytes(begin + parallel_chunk_offset(num_elements, chunk, num_chunks), begin + parallel_chunk_offset(num_elements, chunk + 1, num_chunks), counts[chunk].data(), extract_digit);
+    });
+    return counts;
+}
+
+// the scatter half of a stable counting sort pass that is split over several
+// threads. every thread has counted its own contiguous chunk of the input.
+// then we do a prefix sum over all the histograms, ordered first by bucket
+// and then by thread, which gives every thread its own write position in
+// every bucket. that keeps the sort stable even though all threads scatter
+// at the same time
+template<typename It, typename OutIt, typename ExtractDigit, typename Executor>
+void parallel_scatter(It begin, It end, OutIt out_begin, std::vector<std::array<std::size_t, 256>> & counts, ExtractDigit && extract_digit, Executor & executor)
+{
+    std::ptrdiff_t num_elements = end - begin;
+    std::size_t num_chunks = counts.size();
+    std::size_t total = 0;
+    for (int i = 0; i < 256; ++i)
+    {
+        for (std::array<std::size_t, 256> & chunk_counts : counts)
+        {
+            std::size_t old_count = chunk_counts[i];
+            chunk_counts[i] = total;
+            total += old_count;
+        }
+    }
+    ScatterMode mode = choose_scatter_mode<It, OutIt>(num_elements);
+    executor.parallel_for(num_chunks, [&](std::size_t chunk)
+    {
+        radix_scatter(begin + parallel_chunk_offset(num_elements, chunk, num_chunks), begin + parallel_chunk_offset(num_elements, chunk + 1, num_chunks), out_begin, counts[chunk].data(), extract_digit, mode);
+    });
+}
+
+// one stable counting sort pass over several threads. returns false without
+// moving anything if all elements are in the same bucket
+template<typename It, typename OutIt, typename ExtractDigit, typename Executor>
+bool parallel_counting_sort_impl(It begin, It end, OutIt out_begin, ExtractDigit && extract_digit, Executor & executor)
+{
+    std::ptrdiff_t num_elements = end - begin;
+    std::vector<std::array<std::size_t, 256>> counts = parallel_count(begin, end, parallel_num_chunks(executor, num_elements), extract_digit, executor);
+    std::size_t totals[256] = {};
+    for (const std::array<std::size_t, 256> & chunk_counts : counts)
+    {
+        for (int i = 0; i < 256; ++i)
+            totals[i] += chunk_counts[i];
+    }
+    if (num_elements == 0 || totals[extract_digit(*begin)] == static_cast<std::size_t>(num_elements))
+        return false;
+    parallel_scatter(begin, end, out_begin, counts, extract_digit, executor);
+    return true;
+}
+
+inline bool to_unsigned(bool b)
+{
+    return b;
+}
+inline unsigned char to_unsigned(unsigned char c)
+{
+    return c;
+}
+inline unsigned char to_unsigned(signed char c)
+{
+    return static_cast<unsigned char>(c) + 128;
+}
+inline unsigned char to_unsigned(char c)
+{
+    return static_cast<unsigned char>(c);
+}
+inline std::uint16_t to_unsigned(char16_t c)
+{
+    return static_cast<std::uint16_t>(c);
+}
+inline std::uint32_t to_unsigned(char32_t c)
+{
+    return static_cast<std::uint32_t>(c);
+}
+inline std::uint32_t to_unsigned(wchar_t c)
+{
+    return static_cast<std::uint32_t>(c);
+}
+inline unsigned short to_unsigned(short i)
+{
+    return static_cast<unsigned short>(i) + static_cast<unsigned short>(1 << (sizeof(short) * 8 - 1));
+}
+inline unsigned short to_unsigned(unsigned short i)
+{
+    return i;
+}
+inline unsigned int to_unsigned(int i)
+{
+    return static_cast<unsigned int>(i) + static_cast<unsigned int>(1 << (sizeof(int) * 8 - 1));
+}
+inline unsigned int to_unsigned(unsigned int i)
+{
+    return i;
+}
+inline unsigned long to_unsigned(long l)
+{
+    return static_cast<unsigned long>(l) + static_cast<unsigned long>(1l << (sizeof(long) * 8 - 1));
+}
+inline unsigned long to_unsigned(unsigned long l)
+{
+    return l;
+}
+inline unsigned long long to_unsigned(long long l)
+{
+    return static_cast<unsigned long long>(l) + static_cast<unsigned long long>(1ll << (sizeof(long long) * 8 - 1));
+}
+inline unsigned long long to_unsigned(unsigned long long l)
+{
+    return l;
+}
+#ifdef RADIX_SORT_HAS_INT128
+inline unsigned __int128 to_unsigned(__int128 i)
+{
+    return static_cast<unsigned __int128>(i) + (static_cast<unsigned __int128>(1) << 127);
+}
+inline unsigned __int128 to_unsigned(unsigned __int128 i)
+{
+    return i;
+}
+#endif
+inline std::uint32_t to_unsigned(float f)
+{
+    union
+    {
+        float f;
+        std::uint32_t u;
+    } as_union = { f };
+    std::uint32_t sign_bit = -std::int32_t(as_union.u >> 31);
+    return as_union.u ^ (sign_bit | 0x80000000);
+}
+inline std::uint64_t to_unsigned(double f)
+{
+    union
+    {
+        double d;
+        std::uint64_t u;
+    } as_union = { f };
+    std::uint64_t sign_bit = -std::int64_t(as_union.u >> 63);
+    return as_union.u ^ (sign_bit | 0x8000000000000000);
+}
+// enums sort by their underlying type, so an enum with a uint8_t underlying
+// type is one byte wide. this also covers std::byte
+template<typename T>
+auto to_unsigned(T e) -> typename std::enable_if<std::is_enum<T>::value, decltype(to_unsigned(static_cast<typename std::underlying_type<T>::type>(e)))>::type
+{
+    return to_unsigned(static_cast<typename std::underlying_type<T>::type>(e));
+}
+template<typename Rep, typename Period>
+auto to_unsigned(std::chrono::duration<Rep, Period> d) -> decltype(to_unsigned(d.count()))
+{
+    return to_unsigned(d.count());
+}
+template<typename Clock, typename Duration>
+auto to_unsigned(std::chrono::time_point<Clock, Duration> t) -> decltype(to_unsigned(t.time_since_epoch()))
+{
+    return to_unsigned(t.time_since_epoch());
+}
+template<typename T>
+struct is_character : std::false_type
+{
+};
+template<>
+struct is_character<char> : std::true_type
+{
+};
+template<>
+struct is_character<wchar_t> : std::true_type
+{
+};
+template<>
+struct is_character<char16_t> : std::true_type
+{
+};
+template<>
+struct is_character<char32_t> : std::true_type
+{
+};
+#ifdef __cpp_char8_t
+template<>
+struct is_character<char8_t> : std::true_type
+{
+};
+#endif
+// pointers sort by address. pointers to characters are strings, and those
+// are sorted by their characters instead
+template<typename T>
+typename std::enable_if<!is_character<typename std::remove_cv<T>::type>::value, std::uintptr_t>::type to_unsigned(T * p)
+{
+    return reinterpret_cast<std::uintptr_t>(p);
+}
+#ifdef RADIX_SORT_HAS_CPP17
+// an unsigned type that has room for one more value than a key of Size bytes
+template<size_t Size>
+struct WiderUnsigned
+{
+};
+template<>
+struct WiderUnsigned<1>
+{
+    typedef std::uint16_t type;
+};
+template<>
+struct WiderUnsigned<2>
+{
+    typedef std::uint32_t type;
+};
+template<>
+struct WiderUnsigned<4>
+{
+    typedef std::uint64_t type;
+};
+#ifdef RADIX_SORT_HAS_INT128
+template<>
+struct WiderUnsigned<8>
+{
+    typedef unsigned __int128 type;
+};
+#endif
+// an empty optional is 0 and a value is one more than its key, so a null
+// never needs a pass of its own. the bytes above the value stay the same
+// unless the biggest value is in the input, and those get skipped
+template<typename T>
+auto to_unsigned(const std::optional<T> & o) -> typename WiderUnsigned<sizeof(to_unsigned(*o))>::type
+{
+    typedef typename WiderUnsigned<sizeof(to_unsigned(*o))>::type wide_type;
+    return o ? static_cast<wide_type>(static_cast<wide_type>(to_unsigned(*o)) + 1) : wide_type();
+}
+// for nulls last the value is the key itself and an empty optional is the
+// first value that doesn't fit into the key
+template<typename T>
+auto to_unsigned(const radix_sort_nulls_last_key<T> & key) -> decltype(to_unsigned(key.key))
+{
+    typedef decltype(to_unsigned(key.key)) wide_type;
+    return key.key ? static_cast<wide_type>(to_unsigned(*key.key)) : static_cast<wide_type>(static_cast<wide_type>(1) << (sizeof(to_unsigned(*key.key)) * 8));
+}
+#endif
+// descending keys flip every bit of the ascending key
+inline bool to_unsigned(const radix_sort_descending_key<bool> & key)
+{
+    return !key.key;
+}
+template<typename T>
+auto to_unsigned(const radix_sort_descending_key<T> & key) -> decltype(to_unsigned(key.key))
+{
+    return static_cast<decltype(to_unsigned(key.key))>(~to_unsigned(key.key));
+}
+
+// makes a key descending. scalars are copied, pairs, tuples and arrays are
+// made descending component by component, and for everything else we keep a
+// reference unless the key is a temporary
+template<typename T, typename = void>
+struct DescendingKey
+{
+    template<typename U>
+    static radix_sort_descending_key<typename std::conditional<std::is_lvalue_reference<U>::value, const T &, T>::type> make(U && key)
+    {
+        return { std::forward<U>(key) };
+    }
+};
+template<typename T>
+struct DescendingKey<T, decltype(static_cast<void>(to_unsigned(std::declval<T>())))>
+{
+    static radix_sort_descending_key<T> make(const T & key)
+    {
+        return { key };
+    }
+};
+template<typename K, typename V>
+struct DescendingKey<std::pair<K, V>>
+{
+    template<typename U>
+    static auto make(U && key)
+    {
+        return std::make_pair(DescendingKey<typename std::decay<K>::type>::make(std::get<0>(std::forward<U>(key))),
+                              DescendingKey<typename std::decay<V>::type>::make(std::get<1>(std::forward<U>(key))));
+    }
+};
+template<typename... Args>
+struct DescendingKey<std::tuple<Args...>>
+{
+    template<typename U>
+    static auto make(U && key)
+    {
+        return make_elements(std::forward<U>(key), std::index_sequence_for<Args...>{});
+    }
+
+private:
+    template<typename U, size_t... Indices>
+    static auto make_elements(U && key, std::index_sequence<Indices...>)
+    {
+        return std::make_tuple(DescendingKey<typename std::decay<Args>::type>::make(std::get<Indices>(std::forward<U>(key)))...);
+    }
+};
+template<typename T, size_t S>
+struct DescendingKey<std::array<T, S>>
+{
+    template<typename U>
+    static auto make(U && key)
+    {
+        return make_elements(std::forward<U>(key), std::make_index_sequence<S>{});
+    }
+
+private:
+    template<typename U, size_t... Indices>
+    static auto make_elements(U && key, std::index_sequence<Indices...>)
+    {
+        typedef typename std::conditional<std::is_lvalue_reference<U>::value, const T &, T>::type element_key;
+        typedef decltype(DescendingKey<T>::make(std::declval<element_key>())) element_type;
+        return std::array<element_type, S>{{ DescendingKey<T>::make(std::get<Indices>(std::forward<U>(key)))... }};
+    }
+};
+
+// the digits that we sort by, one scatter pass per digit. usually that is one
+// pass per byte, but we skip bytes that are the same in every key. and if the
+// bits that do differ are spread unevenly over the bytes, we re-plan the
+// digits so that each one starts at the lowest bit that still differs. for
+// example if only bits 4 to 19 differ, we do two passes instead of three
+template<size_t NumBytes>
+struct RadixPassPlan
+{
+    unsigned shifts[NumBytes];
+    size_t num_passes = 0;
+    // if this is true, the digits are whole bytes and we can use the
+    // histograms of the first counting pass. otherwise we have to count again
+    bool byte_aligned = true;
+};
+
+// returns which bits of a byte differ between the keys, or 0 if the byte is
+// the same in all keys. counts is the histogram for that byte
+template<typename count_type>
+unsigned varying_bits_in_byte(const count_type * counts, count_type num_elements)
+{
+    int first = 0;
+    while (counts[first] == 0)
+        ++first;
+    if (counts[first] == num_elements)
+        return 0;
+    unsigned result = 0;
+    for (int i = first + 1; i < 256; ++i)
+    {
+        if (counts[i])
+            result |= static_cast<unsigned>(i ^ first);
+    }
+    return result;
+}
+
+// reports the bytes that the pass plan of the 8 bit sort skips because they
+// are the same in every key
+template<typename Executor, size_t NumBytes, typename count_type>
+void observe_constant_bytes(Executor &, const count_type (&)[NumBytes][256], std::size_t)
+{
+}
+template<typename Observer, size_t NumBytes, typename count_type>
+void observe_constant_bytes(ObservedSerialExecutor<Observer> & executor, const count_type (&counts)[NumBytes][256], std::size_t num_elements)
+{
+    for (size_t i = 0; i < NumBytes; ++i)
+    {
+        if (!varying_bits_in_byte(counts[i], static_cast<count_type>(num_elements)))
+        {
+            PassObservation observation = begin_observed_pass(executor, i, 8, counts[i], 256, num_elements);
+            end_observed_pass(executor, observation, 0);
+        }
+    }
+}
+
+template<size_t NumBytes, typename count_type>
+RadixPassPlan<NumBytes> plan_radix_passes(const count_type (*counts)[256], count_type num_elements)
+{
+    RadixPassPlan<NumBytes> byte_plan;
+    // one word for every eight bytes, so that 16 byte keys fit
+    std::uint64_t varying[(NumBytes + 7) / 8] = {};
+    for (size_t i = 0; i < NumBytes; ++i)
+    {
+        std::uint64_t varying_in_byte = varying_bits_in_byte(counts[i], num_elements);
+        if (varying_in_byte)
+        {
+            byte_plan.shifts[byte_plan.num_passes++] = static_cast<unsigned>(i * 8);
+            varying[i / 8] |= varying_in_byte << (i % 8 * 8);
+        }
+    }
+    RadixPassPlan<NumBytes> bit_plan;
+    bit_plan.byte_aligned = false;
+    for (unsigned bit = 0; bit < NumBytes * 8; bit += 8)
+    {
+        while (bit < NumBytes * 8 && !((varying[bit / 64] >> (bit % 64)) & 1))
+            ++bit;
+        if (bit == NumBytes * 8)
+            break;
+        bit_plan.shifts[bit_plan.num_passes++] = bit;
+    }
+    // counting again is a lot cheaper than a scatter pass, so the bit plan is
+    // worth it as soon as it saves one pass
+    if (bit_plan.num_passes < byte_plan.num_passes)
+        return bit_plan;
+    else
+        return byte_plan;
+}
+
+// the sorters shift their digits out of a uint64_t, or out of the key
+// itself if it's wider than that
+template<typename T>
+std::uint64_t widen_key(T key)
+{
+    return key;
+}
+#ifdef RADIX_SORT_HAS_INT128
+inline unsigned __int128 widen_key(unsigned __int128 key)
+{
+    return key;
+}
+#endif
+inline std::uint8_t radix_digit(std::uint64_t key, unsigned shift)
+{
+    return static_cast<std::uint8_t>(key >> shift);
+}
+#ifdef RADIX_SORT_HAS_INT128
+// a digit that doesn't cross the middle of the key only needs one half of
+// it, and shifting one half is a lot cheaper than shifting the whole key
+inline std::uint8_t radix_digit(unsigned __int128 key, unsigned shift)
+{
+    if (shift <= 56)
+        return static_cast<std::uint8_t>(static_cast<std::uint64_t>(key) >> shift);
+    else if (shift >= 64)
+        return static_cast<std::uint8_t>(static_cast<std::uint64_t>(key >> 64) >> (shift - 64));
+    else
+        return static_cast<std::uint8_t>(key >> shift);
+}
+#endif
+
+template<typename ExtractKey>
+struct ExtractRadixDigit
+{
+    ExtractKey & extract_key;
+    unsigned shift;
+
+    template<typename T>
+    std::uint8_t operator()(T && o) const
+    {
+        return radix_digit(widen_key(to_unsigned(extract_key(o))), shift);
+    }
+};
+template<typename ExtractKey>
+ExtractRadixDigit<ExtractKey> extract_radix_digit(ExtractKey & extract_key, unsigned shift)
+{
+    return { extract_key, shift };
+}
+
+// counts all NumBytes bytes of every key in one read. with more than one
+// table the stalls are smaller than in count_bytes, so two interleaved sets
+// of histograms are enough. those made the read 10 to 20 percent faster for
+// uint64_t keys, for random keys as well as for keys with few values
+template<size_t NumBytes, typename count_type, typename It, typename ExtractKey, typename Counts>
+void count_key_bytes(It begin, It end, Counts & counts, ExtractKey & extract_key)
+{
+    if (NumBytes == 1)
+    {
+        count_bytes(begin, end, &counts[0][0], [&](auto && element)
+        {
+            return static_cast<std::uint8_t>(to_unsigned(extract_key(element)));
+        });
+        return;
+    }
+    if (end - begin < sub_histogram_threshold)
+    {
+        for (; begin != end; ++begin)
+        {
+            auto key = widen_key(to_unsigned(extract_key(*begin)));
+            for (size_t i = 0; i < NumBytes; ++i)
+                ++counts[i][(key >> (i * 8)) & 0xff];
+        }
+        return;
+    }
+    count_type odd_counts[NumBytes][256] = {};
+    for (; end - begin >= 2; begin += 2)
+    {
+        auto even_key = widen_key(to_unsigned(extract_key(begin[0])));
+        auto odd_key = widen_key(to_unsigned(extract_key(begin[1])));
+        for (size_t i = 0; i < NumBytes; ++i)
+        {
+            ++counts[i][(even_key >> (i * 8)) & 0xff];
+            ++odd_counts[i][(odd_key >> (i * 8)) & 0xff];
+        }
+    }
+    if (begin != end)
+    {
+        auto key = widen_key(to_unsigned(extract_key(*begin)));
+        for (size_t i = 0; i < NumBytes; ++i)
+            ++counts[i][(key >> (i * 8)) & 0xff];
+    }
+    for (size_t i = 0; i < NumBytes; ++i)
+    {
+        for (int j = 0; j < 256; ++j)
+            counts[i][j] += odd_counts[i][j];
+    }
+}
+
+template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+bool parallel_radix_sort_impl(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor, std::integral_constant<size_t, 1>)
+{
+    return parallel_counting_sort_impl(begin, end, buffer_begin, extract_radix_digit(extract_key, 0), executor);
+}
+// every thread counts all the bytes of its chunk in the first read. that is
+// enough to plan the passes, and the first pass can use those histograms
+// directly. the later passes have to count again because the chunks contain
+// different elements by then
+template<size_t NumBytes, typename It, typename OutIt, typename ExtractKey, typename Executor>
+bool parallel_radix_sort_impl(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor, std::integral_constant<size_t, NumBytes>)
+{
+    std::ptrdiff_t num_elements = end - begin;
+    OutIt buffer_end = buffer_begin + num_elements;
+    std::size_t num_chunks = parallel_num_chunks(executor, num_elements);
+    std::vector<std::array<std::array<std::size_t, 256>, NumBytes>> chunk_counts(num_chunks);
+    executor.parallel_for(num_chunks, [&](std::size_t chunk)
+    {
+        count_key_bytes<NumBytes, std::size_t>(begin + parallel_chunk_offset(num_elements, chunk, num_chunks), begin + parallel_chunk_offset(num_elements, chunk + 1, num_chunks), chunk_counts[chunk], extract_key);
+    });
+    std::size_t totals[NumBytes][256] = {};
+    for (const std::array<std::array<std::size_t, 256>, NumBytes> & counts : chunk_counts)
+    {
+        for (size_t i = 0; i < NumBytes; ++i)
+        {
+            for (int j = 0; j < 256; ++j)
+                totals[i][j] += counts[i][j];
+        }
+    }
+    RadixPassPlan<NumBytes> plan = plan_radix_passes<NumBytes>(totals, static_cast<std::size_t>(num_elements));
+    bool in_buffer = false;
+    for (size_t pass = 0; pass < plan.num_passes; ++pass)
+    {
+        auto extract_digit = extract_radix_digit(extract_key, plan.shifts[pass]);
+        std::vector<std::array<std::size_t, 256>> counts;
+        if (pass == 0 && plan.byte_aligned)
+        {
+            counts.resize(num_chunks);
+            for (std::size_t chunk = 0; chunk < num_chunks; ++chunk)
+                counts[chunk] = chunk_counts[chunk][plan.shifts[pass] / 8];
+        }
+        else if (in_buffer)
+            counts = parallel_count(buffer_begin, buffer_end, num_chunks, extract_digit, executor);
+        else
+            counts = parallel_count(begin, end, num_chunks, extract_digit, executor);
+        if (in_buffer)
+            parallel_scatter(buffer_begin, buffer_end, begin, counts, extract_digit, executor);
+        else
+            parallel_scatter(begin, end, buffer_begin, counts, extract_digit, executor);
+        in_buffer = !in_buffer;
+    }
+    return in_buffer;
+}
+
+template<typename Executor>
+radix_sort_digits executor_digits(Executor &)
+{
+    return radix_sort_digits::bits_8;
+}
+inline radix_sort_digits executor_digits(SerialExecutor & executor)
+{
+    return executor.digits;
+}
+template<typename Observer>
+radix_sort_digits executor_digits(ObservedSerialExecutor<Observer> & executor)
+{
+    return executor.digits;
+}
+
+// wide digits pay off once the histograms are small compared to the input,
+// and only until the 2048 write positions of the scatter start missing the
+// cache. above that the write combining scatter with 8 bit digits is faster.
+// measured with 4 and 8 byte keys on x86-64. 16 bit digits never won
+static constexpr std::ptrdiff_t wide_digits_min_elements = 1 << 12;
+static constexpr std::ptrdiff_t wide_digits_max_elements = 1 << 18;
+
+template<size_t NumBytes>
+radix_sort_digits choose_radix_digits(radix_sort_digits digits, std::ptrdiff_t num_elements)
+{
+    if (digits != radix_sort_digits::automatic)
+        return digits;
+    else if (NumBytes >= 4 && num_elements >= wide_digits_min_elements && num_elements < wide_digits_max_elements)
+        return radix_sort_digits::bits_11;
+    else
+        return radix_sort_digits::bits_8;
+}
+
+template<typename Executor>
+ResultPlacement wanted_placement(Executor &)
+{
+    return ResultPlacement::anywhere;
+}
+inline ResultPlacement wanted_placement(SerialExecutor & executor)
+{
+    return executor.placement;
+}
+template<typename Observer>
+ResultPlacement wanted_placement(ObservedSerialExecutor<Observer> & executor)
+{
+    return executor.placement;
+}
+template<typename Executor>
+void set_wanted_placement(Executor &, ResultPlacement)
+{
+}
+inline void set_wanted_placement(SerialExecutor & executor, ResultPlacement placement)
+{
+    executor.placement = placement;
+}
+template<typename Observer>
+void set_wanted_placement(ObservedSerialExecutor<Observer> & executor, ResultPlacement placement)
+{
+    executor.placement = placement;
+}
+
+// the chained sorters of pairs, tuples and arrays sort the less significant
+// components with any placement, then hand the wanted placement to the most
+// significant component. if the others left the result in the buffer, that
+// component sorts from the buffer into the input, so the wanted placement
+// flips. that way at most one component has to fold a copy into its count
+inline ResultPlacement next_placement(ResultPlacement wanted, bool in_buffer)
+{
+    if (!in_buffer || wanted == ResultPlacement::anywhere)
+        return wanted;
+    else if (wanted == ResultPlacement::in_input)
+        return ResultPlacement::in_buffer;
+    else
+        return ResultPlacement::in_input;
+}
+
+// with an odd number of passes the result ends up in the buffer. if it's
+// wanted in the input, moving the elements into the buffer during the
+// counting read and starting the passes there costs one write per element.
+// copying back at the end costs a read and a write. the number of passes is
+// only known after counting, because bytes that are the same in every key
+// are skipped, so this plans with the number of digits of the key. while
+// the input fits into the cache the copy back is just as fast, and then it
+// is better to not risk copying for nothing. measured with 1 byte keys:
+// 15 percent faster for 2 MB, the same for 256 kB
+static constexpr std::size_t fold_copy_min_bytes = 1 << 20;
+
+inline bool should_fold_copy(ResultPlacement wanted, std::size_t planned_passes, std::size_t num_bytes)
+{
+    return wanted != ResultPlacement::anywhere && num_bytes >= fold_copy_min_bytes && (planned_passes % 2 == 1) != (wanted == ResultPlacement::in_buffer);
+}
+// whether the first pass reads from the buffer. after a folded copy of
+// elements that can be copied with memcpy, the input still holds the same
+// elements, so if skipped bytes changed the number of passes we can start
+// from the input instead
+template<typename T>
+bool start_in_buffer(bool folded, std::size_t num_passes, ResultPlacement wanted)
+{
+    if (!folded)
+        return false;
+    else if (!is_memcpyable<T>::value)
+        return true;
+    else
+        return (num_passes % 2 == 1) != (wanted == ResultPlacement::in_buffer);
+}
+
+// the blocks are small enough to still be in the L2 cache when count reads
+// them, so the input is only read from memory once
+static constexpr std::size_t fold_copy_block_bytes = 1 << 16;
+
+// moves [begin, end) to out_begin and calls count on the moved elements
+template<typename It, typename OutIt, typename Count>
+void move_and_count(It begin, It end, OutIt out_begin, Count && count)
+{
+    std::ptrdiff_t block_size = static_cast<std::ptrdiff_t>(std::max(std::size_t(1), fold_copy_block_bytes / sizeof(typename std::iterator_traits<It>::value_type)));
+    while (begin != end)
+    {
+        It block_end = begin + std::min(block_size, end - begin);
+        OutIt out_end = std::move(begin, block_end, out_begin);
+        count(out_begin, out_end);
+        begin = block_end;
+        out_begin = out_end;
+    }
+}
+
+// above this size every LSD pass has to stream the whole input from memory,
+// so sort_hybrid splits it into buckets that fit into the cache first. that
+// only pays off where the scatter passes are limited by the memory bandwidth.
+// on the machines this was measured on, with 2 MB of L2 cache and a big L3
+// cache, the non temporal stores of the LSD passes kept up with it and the
+// hybrid sort was 1.3 to 2.3 times slower from 32 MB to 512 MB of keys. so
+// by default it's off. radix_sort_calibrate measures it from 16 MB to 512 MB
+// and sets RADIX_SORT_HYBRID_SORT_MIN_BYTES in its header to where it's
+// faster on the machine that it runs on
+#ifdef RADIX_SORT_HYBRID_SORT_MIN_BYTES
+static constexpr std::size_t hybrid_sort_min_bytes = RADIX_SORT_HYBRID_SORT_MIN_BYTES;
+#else
+static constexpr std::size_t hybrid_sort_min_bytes = std::numeric_limits<std::size_t>::max();
+#endif
+// a bucket and its part of the buffer have to fit into the cache together.
+// that's the same cache size that fold_copy_min_bytes assumes
+#ifdef RADIX_SORT_HYBRID_BUCKET_MAX_BYTES
+static constexpr std::size_t hybrid_bucket_max_bytes = RADIX_SORT_HYBRID_BUCKET_MAX_BYTES;
+#else
+static constexpr std::size_t hybrid_bucket_max_bytes = fold_copy_min_bytes / 2;
+#endif
+// two passes split 8 GB of data into buckets of 128 kB on average, which is
+// enough for any input that fits into memory together with its buffer
+static constexpr int hybrid_max_msd_passes = 2;
+
+template<size_t NumBytes>
+struct SizedRadixSorter
+{
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor)
+    {
+        std::ptrdiff_t num_elements = end - begin;
+        if (num_elements <= 1)
+            return false;
+        else if (should_sort_in_parallel(executor, num_elements))
+            return parallel_radix_sort_impl(begin, end, buffer_begin, extract_key, executor, std::integral_constant<size_t, NumBytes>{});
+        radix_sort_digits digits = choose_radix_digits<NumBytes>(executor_digits(executor), num_elements);
+        if (digits == radix_sort_digits::bits_8 && range_bytes(begin, end) >= hybrid_sort_min_bytes)
+            return sort_hybrid(begin, end, buffer_begin, extract_key, executor, hybrid_max_msd_passes, wanted_placement(executor));
+        return sort_lsd(begin, end, buffer_begin, extract_key, executor, digits);
+    }
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort_lsd(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor, radix_sort_digits digits)
+    {
+        std::ptrdiff_t num_elements = end - begin;
+        if (digits == radix_sort_digits::bits_11)
+            return sort_wide<11>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key, executor);
+        else if (digits == radix_sort_digits::bits_16)
+            return sort_wide<16>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key, executor);
+        else if (num_elements < (1 << 8))
+            return sort_inline<uint8_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key, executor);
+        else if (num_elements < (1 << 16))
+            return sort_inline<uint16_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key, executor);
+        else if (num_elements < (1ll << 32))
+            return sort_inline<uint32_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key, executor);
+        else
+            return sort_inline<uint64_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key, executor);
+    }
+    // one scatter pass on the highest byte that varies, most significant
+    // digit first, splits the input into 256 buckets in the buffer. every
+    // bucket is then sorted on its own, either with another of these passes
+    // if it's still too big for the cache, or with the LSD passes of
+    // sort_lsd, which now run in the cache. they skip the digit of the MSD
+    // pass and the bytes above it, because those are the same in the whole
+    // bucket. so the elements go through memory
+    // once for the counting, once for each MSD pass and once for the bucket
+    // sorts, instead of once for every byte. wanted is relative to this call,
+    // and all buckets have to end up in the same place. if it's anywhere the
+    // first bucket picks the place, and the buckets that end up somewhere
+    // else get moved while they are still in the cache
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort_hybrid(It begin, It end, OutIt out_begin, ExtractKey & extract_key, Executor & executor, int msd_passes_left, ResultPlacement wanted)
+    {
+        std::size_t num_elements = static_cast<std::size_t>(end - begin);
+        std::size_t counts[NumBytes][256] = {};
+        count_key_bytes<NumBytes, std::size_t>(begin, end, counts, extract_key);
+        size_t msd_byte = NumBytes;
+        while (msd_byte > 0 && !varying_bits_in_byte(counts[msd_byte - 1], num_elements))
+            --msd_byte;
+        if (msd_byte == 0)
+        {
+            if (wanted != ResultPlacement::in_buffer)
+                return false;
+            std::move(begin, end, out_begin);
+            return true;
+        }
+        --msd_byte;
+        std::size_t * bucket_sizes = counts[msd_byte];
+        std::size_t offsets[256];
+        std::copy(bucket_sizes, bucket_sizes + 256, offsets);
+        auto observation = begin_observed_pass(executor, msd_byte, 8, offsets, 256, num_elements);
+        counts_to_offsets(offsets);
+        radix_scatter(begin, end, out_begin, offsets, extract_radix_digit(extract_key, static_cast<unsigned>(msd_byte * 8)), choose_scatter_mode<It, OutIt>(end - begin));
+        end_observed_pass(executor, observation, range_bytes(begin, end));
+
+        // the buckets are in the buffer now, so for them the input of this
+        // call is the buffer
+        ResultPlacement bucket_wanted = wanted == ResultPlacement::in_buffer ? ResultPlacement::in_input
+                                      : wanted == ResultPlacement::in_input ? ResultPlacement::in_buffer
+                                      : ResultPlacement::anywhere;
+        std::ptrdiff_t bucket_begins[257];
+        bucket_begins[0] = 0;
+        for (int i = 0; i < 256; ++i)
+            bucket_begins[i + 1] = bucket_begins[i] + static_cast<std::ptrdiff_t>(bucket_sizes[i]);
+        auto sort_bucket = [&](int i)
+        {
+            OutIt bucket = out_begin + bucket_begins[i];
+            It bucket_buffer = begin + bucket_begins[i];
+            std::ptrdiff_t bucket_size = bucket_begins[i + 1] - bucket_begins[i];
+            bool in_bucket_buffer = false;
+            if (msd_passes_left > 1 && msd_byte > 0 && range_bytes(bucket, bucket + bucket_size) > hybrid_bucket_max_bytes)
+                in_bucket_buffer = sort_hybrid(bucket, bucket + bucket_size, bucket_buffer, extract_key, executor, msd_passes_left - 1, bucket_wanted);
+            else if (bucket_size > 1)
+            {
+                set_wanted_placement(executor, bucket_wanted);
+                in_bucket_buffer = sort_lsd(bucket, bucket + bucket_size, bucket_buffer, extract_key, executor, choose_radix_digits<NumBytes>(executor_digits(executor), bucket_size));
+            }
+            if (bucket_wanted == ResultPlacement::anywhere)
+                bucket_wanted = in_bucket_buffer ? ResultPlacement::in_buffer : ResultPlacement::in_input;
+            else if (in_bucket_buffer && bucket_wanted == ResultPlacement::in_input)
+                std::move(bucket_buffer, bucket_buffer + bucket_size, bucket);
+            else if (!in_bucket_buffer && bucket_wanted == ResultPlacement::in_buffer)
+                std::move(bucket, bucket + bucket_size, bucket_buffer);
+        };
+        // a bucket with a single element can't pick the place, so the first
+        // bigger bucket is sorted first
+        int first_sorted = 0;
+        while (first_sorted < 256 && bucket_sizes[first_sorted] < 2)
+            ++first_sorted;
+        if (first_sorted < 256)
+            sort_bucket(first_sorted);
+        else if (bucket_wanted == ResultPlacement::anywhere)
+            bucket_wanted = ResultPlacement::in_input;
+        for (int i = 0; i < 256; ++i)
+        {
+            if (i != first_sorted && bucket_sizes[i])
+                sort_bucket(i);
+        }
+        set_wanted_placement(executor, wanted);
+        return bucket_wanted == ResultPlacement::in_input;
+    }
+
+    template<typename count_type, typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort_inline(It begin, It end, OutIt out_begin, OutIt out_end, ExtractKey && extract_key, Executor & executor)
+    {
+        count_type counts[NumBytes][256] = {};
+        ResultPlacement wanted = wanted_placement(executor);
+        bool folded = should_fold_copy(wanted, NumBytes, range_bytes(begin, end));
+        if (folded)
+        {
+            move_and_count(begin, end, out_begin, [&](auto block_begin, auto block_end)
+            {
+                count_key_bytes<NumBytes, count_type>(block_begin, block_end, counts, extract_key);
+            });
+        }
+        else
+            count_key_bytes<NumBytes, count_type>(begin, end, counts, extract_key);
+        observe_constant_bytes(executor, counts, end - begin);
+        RadixPassPlan<NumBytes> plan = plan_radix_passes<NumBytes>(counts, static_cast<count_type>(end - begin));
+        if (!plan.byte_aligned)
+        {
+            for (size_t pass = 0; pass < plan.num_passes; ++pass)
+                std::fill(std::begin(counts[pass]), std::end(counts[pass]), count_type());
+            auto count_again = [&](auto it, auto last)
+            {
+                for (; it != last; ++it)
+                {
+                    auto key = widen_key(to_unsigned(extract_key(*it)));
+                    for (size_t pass = 0; pass < plan.num_passes; ++pass)
+                        ++counts[pass][(key >> plan.shifts[pass]) & 0xff];
+                }
+            };
+            // the input may have been moved from
+            if (folded)
+                count_again(out_begin, out_end);
+            else
+                count_again(begin, end);
+        }
+        ScatterMode mode = choose_scatter_mode<It, OutIt>(end - begin);
+        bool in_buffer = start_in_buffer<typename std::iterator_traits<It>::value_type>(folded, plan.num_passes, wanted);
+        for (size_t pass = 0; pass < plan.num_passes; ++pass)
+        {
+            count_type * pass_counts = plan.byte_aligned ? counts[plan.shifts[pass] / 8] : counts[pass];
+            auto observation = begin_observed_pass(executor, plan.shifts[pass] / 8, 8, pass_counts, 256, end - begin);
+            counts_to_offsets(pass_counts);
+            auto extract_digit = extract_radix_digit(extract_key, plan.shifts[pass]);
+            if (in_buffer)
+                radix_scatter(out_begin, out_end, begin, pass_counts, extract_digit, mode);
+            else
+                radix_scatter(begin, end, out_begin, pass_counts, extract_digit, mode);
+            end_observed_pass(executor, observation, range_bytes(begin, end));
+            in_buffer = !in_buffer;
+        }
+        return in_buffer;
+    }
+
+    template<unsigned DigitBits, typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort_wide(It begin, It end, OutIt out_begin, OutIt out_end, ExtractKey && extract_key, Executor & executor)
+    {
+        if (end - begin < (1ll << 32))
+            return sort_wide<DigitBits, std::uint32_t>(begin, end, out_begin, out_end, extract_key, executor);
+        else
+            return sort_wide<DigitBits, std::uint64_t>(begin, end, out_begin, out_end, extract_key, executor);
+    }
+    // same as sort_inline, but with digits of DigitBits bits. the last digit
+    // gets the remaining bits, so 32 bit keys with 11 bit digits are sorted
+    // in passes of 11, 11 and 10 bits. the histograms are too big for the
+    // stack, and they are too big for the write combining scatter
+    template<unsigned DigitBits, typename count_type, typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort_wide(It begin, It end, OutIt out_begin, OutIt out_end, ExtractKey && extract_key, Executor & executor)
+    {
+        static constexpr size_t num_buckets = size_t(1) << DigitBits;
+        static constexpr size_t num_digits = (NumBytes * 8 + DigitBits - 1) / DigitBits;
+        static constexpr std::uint64_t digit_mask = num_buckets - 1;
+        std::vector<count_type> counts(num_digits * num_buckets);
+        auto count_range = [&](auto it, auto last)
+        {
+            for (; it != last; ++it)
+            {
+                auto key = widen_key(to_unsigned(extract_key(*it)));
+                for (size_t i = 0; i < num_digits; ++i)
+                    ++counts[i * num_buckets + ((key >> (i * DigitBits)) & digit_mask)];
+            }
+        };
+        ResultPlacement wanted = wanted_placement(executor);
+        bool folded = should_fold_copy(wanted, num_digits, range_bytes(begin, end));
+        if (folded)
+            move_and_count(begin, end, out_begin, count_range);
+        else
+            count_range(begin, end);
+        count_type num_elements = static_cast<count_type>(end - begin);
+        size_t num_passes = 0;
+        for (size_t pass = 0; pass < num_digits; ++pass)
+        {
+            if (std::find(counts.begin() + pass * num_buckets, counts.begin() + (pass + 1) * num_buckets, num_elements) == counts.begin() + (pass + 1) * num_buckets)
+                ++num_passes;
+        }
+        bool in_buffer = start_in_buffer<typename std::iterator_traits<It>::value_type>(folded, num_passes, wanted);
+        for (size_t pass = 0; pass < num_digits; ++pass)
+        {
+            count_type * pass_counts = counts.data() + pass * num_buckets;
+            auto observation = begin_observed_pass(executor, pass, DigitBits, pass_counts, num_buckets, num_elements);
+            count_type total = 0;
+            bool is_constant = false;
+            for (size_t i = 0; i < num_buckets; ++i)
+            {
+                count_type old_count = pass_counts[i];
+                is_constant = is_constant || old_count == num_elements;
+                pass_counts[i] = total;
+                total += old_count;
+            }
+            if (is_constant)
+            {
+                end_observed_pass(executor, observation, 0);
+                continue;
+            }
+            unsigned shift = static_cast<unsigned>(pass * DigitBits);
+            auto extract_digit = [&](auto && o)
+            {
+                return static_cast<size_t>((widen_key(to_unsigned(extract_key(o))) >> shift) & digit_mask);
+            };
+            if (in_buffer)
+                direct_scatter(out_begin, out_end, begin, pass_counts, extract_digit);
+            else
+                direct_scatter(begin, end, out_begin, pass_counts, extract_digit);
+            end_observed_pass(executor, observation, range_bytes(begin, end));
+            in_buffer = !in_buffer;
+        }
+        return in_buffer;
+    }
+
+    static constexpr size_t pass_count = NumBytes + 1;
+};
+template<>
+struct SizedRadixSorter<1>
+{
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor)
+    {
+        std::ptrdiff_t num_elements = end - begin;
+        if (num_elements <= 1)
+            return false;
+        else if (should_sort_in_parallel(executor, num_elements))
+            return parallel_radix_sort_impl(begin, end, buffer_begin, extract_key, executor, std::integral_constant<size_t, 1>{});
+        else if (num_elements < (1 << 8))
+            return sort_inline<uint8_t>(begin, end, buffer_begin, extract_key, executor);
+        else if (num_elements < (1 << 16))
+            return sort_inline<uint16_t>(begin, end, buffer_begin, extract_key, executor);
+        else if (num_elements < (1ll << 32))
+            return sort_inline<uint32_t>(begin, end, buffer_begin, extract_key, executor);
+        else
+            return sort_inline<uint64_t>(begin, end, buffer_begin, extract_key, executor);
+    }
+    template<typename count_type, typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort_inline(It begin, It end, OutIt out_begin, ExtractKey && extract_key, Executor & executor)
+    {
+        count_type counts[256] = {};
+        ResultPlacement wanted = wanted_placement(executor);
+        bool folded = should_fold_copy(wanted, 1, range_bytes(begin, end));
+        if (folded)
+        {
+            move_and_count(begin, end, out_begin, [&](auto block_begin, auto block_end)
+            {
+                count_bytes(block_begin, block_end, counts, extract_radix_digit(extract_key, 0));
+            });
+        }
+        else
+            count_bytes(begin, end, counts, extract_radix_digit(extract_key, 0));
+        auto observation = begin_observed_pass(executor, 0, 8, counts, 256, end - begin);
+        bool is_constant = !varying_bits_in_byte(counts, static_cast<count_type>(end - begin));
+        bool in_buffer = start_in_buffer<typename std::iterator_traits<It>::value_type>(folded, is_constant ? 0 : 1, wanted);
+        if (is_constant)
+        {
+            end_observed_pass(executor, observation, 0);
+            return in_buffer;
+        }
+        counts_to_offsets(counts);
+        if (in_buffer)
+            radix_scatter(out_begin, out_begin + (end - begin), begin, counts, extract_radix_digit(extract_key, 0), choose_scatter_mode<OutIt, It>(end - begin));
+        else
+            radix_scatter(begin, end, out_begin, counts, extract_radix_digit(extract_key, 0), choose_scatter_mode<It, OutIt>(end - begin));
+        end_observed_pass(executor, observation, range_bytes(begin, end));
+        return !in_buffer;
+    }
+
+    static constexpr size_t pass_count = 2;
+};
+
+// a key made of pairs, tuples and std::arrays of scalars can be seen as a
+// flat list of scalar leaves. leaf 0 is the least significant one, so for a
+// pair the leaves of the second member come before the leaves of the first
+template<typename T, typename = void>
+struct FlatKey
+{
+    static constexpr bool value = false;
+    static constexpr size_t num_leaves = 0;
+};
+template<typename T, bool Wide = sizeof(decltype(to_unsigned(std::declval<T>()))) == 16>
+struct FlatScalarKey
+{
+    static constexpr bool value = true;
+    static constexpr size_t num_leaves = 1;
+
+    template<size_t L>
+    static auto leaf(const T & key)
+    {
+        return to_unsigned(key);
+    }
+};
+template<typename T>
+struct FlatKey<T, decltype(static_cast<void>(to_unsigned(std::declval<T>())))> : FlatScalarKey<T>
+{
+};
+template<typename K, typename V>
+struct FlatKey<std::pair<K, V>>
+{
+    static constexpr bool value = FlatKey<K>::value && FlatKey<V>::value;
+    static constexpr size_t num_leaves = FlatKey<K>::num_leaves + FlatKey<V>::num_leaves;
+
+    template<size_t L>
+    static auto leaf(const std::pair<K, V> & key)
+    {
+        return leaf<L>(key, std::integral_constant<bool, (L < FlatKey<V>::num_leaves)>{});
+    }
+
+private:
+    template<size_t L>
+    static auto leaf(const std::pair<K, V> & key, std::true_type)
+    {
+        return FlatKey<V>::template leaf<L>(key.second);
+    }
+    template<size_t L>
+    static auto leaf(const std::pair<K, V> & key, std::false_type)
+    {
+        return FlatKey<K>::template leaf<L - FlatKey<V>::num_leaves>(key.first);
+    }
+};
+template<size_t I, size_t S, typename Tuple>
+struct FlatTupleKey
+{
+    using ThisKey = FlatKey<typename std::tuple_element<I, Tuple>::type>;
+    using NextKey = FlatTupleKey<I + 1, S, Tuple>;
+
+    static constexpr bool value = ThisKey::value && NextKey::value;
+    static constexpr size_t num_leaves = ThisKey::num_leaves + NextKey::num_leaves;
+
+    template<size_t L>
+    static auto leaf(const Tuple & key)
+    {
+        return leaf<L>(key, std::integral_constant<bool, (L < NextKey::num_leaves)>{});
+    }
+
+private:
+    template<size_t L>
+    static auto leaf(const Tuple & key, std::true_type)
+    {
+        return NextKey::template leaf<L>(key);
+    }
+    template<size_t L>
+    static auto leaf(const Tuple & key, std::false_type)
+    {
+        return ThisKey::template leaf<L - NextKey::num_leaves>(std::get<I>(key));
+    }
+};
+template<size_t I, typename Tuple>
+struct FlatTupleKey<I, I, Tuple>
+{
+    static constexpr bool value = true;
+    static constexpr size_t num_leaves = 0;
+};
+template<typename... Args>
+struct FlatKey<std::tuple<Args...>> : FlatTupleKey<0, sizeof...(Args), std::tuple<Args...>>
+{
+};
+// an empty tuple has no leaves to sort by, so it takes the chained sorters
+template<>
+struct FlatKey<std::tuple<>>
+{
+    static constexpr bool value = false;
+    static constexpr size_t num_leaves = 0;
+};
+template<typename T, size_t S>
+struct FlatKey<std::array<T, S>>
+{
+    static constexpr bool value = FlatKey<T>::value;
+    static constexpr size_t num_leaves = FlatKey<T>::num_leaves * S;
+
+    template<size_t L>
+    static auto leaf(const std::array<T, S> & key)
+    {
+        return FlatKey<T>::template leaf<L % FlatKey<T>::num_leaves>(key[S - 1 - L / FlatKey<T>::num_leaves]);
+    }
+};
+#ifdef RADIX_SORT_HAS_INT128
+// keys that to_unsigned turns into 128 bits, like __int128 or an optional
+// int64_t, are two 64 bit leaves, because shifting a uint64_t is a lot
+// cheaper than shifting the whole key. that also keeps every leaf small
+// enough for the uint64_t leaves of external_radix_sort
+template<typename T>
+struct FlatScalarKey<T, true>
+{
+    static constexpr bool value = true;
+    static constexpr size_t num_leaves = 2;
+
+    template<size_t L, typename Key>
+    static std::uint64_t leaf(const Key & key)
+    {
+        return static_cast<std::uint64_t>(to_unsigned(key) >> (L * 64));
+    }
+};
+#endif
+
+template<typename Key, size_t L>
+struct FlatKeyLeaf
+{
+    static constexpr size_t num_bytes = sizeof(decltype(FlatKey<Key>::template leaf<L>(std::declval<const Key &>())));
+    // index of the histogram of the first byte of this leaf
+    static constexpr size_t offset = FlatKeyLeaf<Key, L - 1>::offset + FlatKeyLeaf<Key, L - 1>::num_bytes;
+};
+template<typename Key>
+struct FlatKeyLeaf<Key, 0>
+{
+    static constexpr size_t num_bytes = sizeof(decltype(FlatKey<Key>::template leaf<0>(std::declval<const Key &>())));
+    static constexpr size_t offset = 0;
+};
+
+template<typename F, size_t... Leaves>
+void for_each_leaf(F && f, std::index_sequence<Leaves...>)
+{
+    int unused[] = { 0, (f(std::integral_constant<size_t, Leaves>{}), 0)... };
+    static_cast<void>(unused);
+}
+
+// sorts a flat key with one counting read for all the bytes of all the
+// leaves, then does all the scatter passes back to back, skipping the bytes
+// that are the same in every key. the chained sorters of pairs, tuples and
+// arrays would do one counting read per leaf instead
+template<typename Key, bool = FlatKey<Key>::value && (FlatKey<Key>::num_leaves > 0)>
+struct FusedRadixSorter
+{
+    template<typename Executor>
+    static bool applies(Executor &, std::ptrdiff_t)
+    {
+        return false;
+    }
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It, It, OutIt, ExtractKey &&, Executor &)
+    {
+        return false;
+    }
+
+    static constexpr size_t pass_count = 0;
+};
+template<typename Key>
+struct FusedRadixSorter<Key, true>
+{
+    static constexpr size_t num_leaves = FlatKey<Key>::num_leaves;
+    static constexpr size_t num_bytes = FlatKeyLeaf<Key, num_leaves - 1>::offset + FlatKeyLeaf<Key, num_leaves - 1>::num_bytes;
+
+    // in parallel the chained sorters are used, because their passes are
+    // already split over the threads
+    template<typename Executor>
+    static bool applies(Executor & executor, std::ptrdiff_t num_elements)
+    {
+        return !should_sort_in_parallel(executor, num_elements);
+    }
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor)
+    {
+        std::ptrdiff_t num_elements = end - begin;
+        if (num_elements <= 1)
+            return false;
+        else if (num_elements < (1 << 8))
+            return sort_inline<uint8_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key, executor);
+        else if (num_elements < (1 << 16))
+            return sort_inline<uint16_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key, executor);
+        else if (num_elements < (1ll << 32))
+            return sort_inline<uint32_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key, executor);
+        else
+            return sort_inline<uint64_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key, executor);
+    }
+    template<typename count_type, typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort_inline(It begin, It end, OutIt out_begin, OutIt out_end, ExtractKey && extract_key, Executor & executor)
+    {
+        std::vector<std::array<count_type, 256>> counts(num_bytes);
+        auto count_range = [&](auto it, auto last)
+        {
+            for (; it != last; ++it)
+            {
+                auto && key = extract_key(*it);
+                for_each_leaf([&](auto leaf)
+                {
+                    constexpr size_t L = decltype(leaf)::value;
+                    auto value = widen_key(FlatKey<Key>::template leaf<L>(key));
+                    for (size_t i = 0; i < FlatKeyLeaf<Key, L>::num_bytes; ++i)
+                        ++counts[FlatKeyLeaf<Key, L>::offset + i][(value >> (i * 8)) & 0xff];
+                }, std::make_index_sequence<num_leaves>{});
+            }
+        };
+        // all the leaves are planned together, so a pair of a 4 byte and a 1
+        // byte key folds the copy, and a pair of two 4 byte keys doesn't
+        ResultPlacement wanted = wanted_placement(executor);
+        bool folded = should_fold_copy(wanted, num_bytes, range_bytes(begin, end));
+        if (folded)
+            move_and_count(begin, end, out_begin, count_range);
+        else
+            count_range(begin, end);
+        size_t num_passes = 0;
+        for (const std::array<count_type, 256> & byte_counts : counts)
+        {
+            if (varying_bits_in_byte(byte_counts.data(), static_cast<count_type>(end - begin)))
+                ++num_passes;
+        }
+        ScatterMode mode = choose_scatter_mode<It, OutIt>(end - begin);
+        bool in_buffer = start_in_buffer<typename std::iterator_traits<It>::value_type>(folded, num_passes, wanted);
+        for_each_leaf([&](auto leaf)
+        {
+            constexpr size_t L = decltype(leaf)::value;
+            for (size_t i = 0; i < FlatKeyLeaf<Key, L>::num_bytes; ++i)
+            {
+                count_type * pass_counts = counts[FlatKeyLeaf<Key, L>::offset + i].data();
+                auto observation = begin_observed_pass(executor, FlatKeyLeaf<Key, L>::offset + i, 8, pass_counts, 256, end - begin);
+                if (!varying_bits_in_byte(pass_counts, static_cast<count_type>(end - begin)))
+                {
+                    end_observed_pass(executor, observation, 0);
+                    continue;
+                }
+                counts_to_offsets(pass_counts);
+                auto extract_digit = [&, shift = i * 8](auto && o)
+                {
+                    return static_cast<std::uint8_t>(widen_key(FlatKey<Key>::template leaf<L>(extract_key(o))) >> shift);
+                };
+                if (in_buffer)
+                    radix_scatter(out_begin, out_end, begin, pass_counts, extract_digit, mode);
+                else
+                    radix_scatter(begin, end, out_begin, pass_counts, extract_digit, mode);
+                end_observed_pass(executor, observation, range_bytes(begin, end));
+                in_buffer = !in_buffer;
+            }
+        }, std::make_index_sequence<num_leaves>{});
+        return in_buffer;
+    }
+
+    static constexpr size_t pass_count = num_bytes + 1;
+};
+template<typename Key>
+constexpr size_t fused_pass_count(size_t chained_pass_count)
+{
+    return FlatKey<Key>::value ? FusedRadixSorter<Key>::pass_count : chained_pass_count;
+}
+
+template<typename>
+struct RadixSorter;
+template<>
+struct RadixSorter<bool>
+{
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor)
+    {
+        if (should_sort_in_parallel(executor, end - begin))
+        {
+            return parallel_counting_sort_impl(begin, end, buffer_begin, [&](auto && o) -> std::uint8_t
+            {
+                return extract_key(o) ? 1 : 0;
+            }, executor);
+        }
+        std::size_t false_count = 0;
+        for (It it = begin; it != end; ++it)
+        {
+            if (!extract_key(*it))
+                ++false_count;
+        }
+        std::size_t counts[2] = { false_count, static_cast<std::size_t>(end - begin) - false_count };
+        auto observation = begin_observed_pass(executor, 0, 1, counts, 2, end - begin);
+        if (false_count == 0 || false_count == static_cast<std::size_t>(end - begin))
+        {
+            end_observed_pass(executor, observation, 0);
+            return false;
+        }
+        std::size_t bytes_moved = range_bytes(begin, end);
+        size_t true_position = false_count;
+        false_count = 0;
+        for (; begin != end; ++begin)
+        {
+            if (extract_key(*begin))
+                buffer_begin[true_position++] = std::move(*begin);
+            else
+                buffer_begin[false_count++] = std::move(*begin);
+        }
+        end_observed_pass(executor, observation, bytes_moved);
+        return true;
+    }
+
+    static constexpr size_t pass_count = 2;
+};
+template<>
+struct RadixSorter<signed char> : SizedRadixSorter<sizeof(signed char)>
+{
+};
+template<>
+struct RadixSorter<unsigned char> : SizedRadixSorter<sizeof(unsigned char)>
+{
+};
+template<>
+struct RadixSorter<signed short> : SizedRadixSorter<sizeof(signed short)>
+{
+};
+template<>
+struct RadixSorter<unsigned short> : SizedRadixSorter<sizeof(unsigned short)>
+{
+};
+template<>
+struct RadixSorter<signed int> : SizedRadixSorter<sizeof(signed int)>
+{
+};
+template<>
+struct RadixSorter<unsigned int> : SizedRadixSorter<sizeof(unsigned int)>
+{
+};
+template<>
+struct RadixSorter<signed long> : SizedRadixSorter<sizeof(signed long)>
+{
+};
+template<>
+struct RadixSorter<unsigned long> : SizedRadixSorter<sizeof(unsigned long)>
+{
+};
+template<>
+struct RadixSorter<signed long long> : SizedRadixSorter<sizeof(signed long long)>
+{
+};
+template<>
+struct RadixSorter<unsigned long long> : SizedRadixSorter<sizeof(unsigned long long)>
+{
+};
+#ifdef RADIX_SORT_HAS_INT128
+// single threaded, a 128 bit key is sorted like a pair of uint64_t keys,
+// with one counting read for all 16 bytes. in parallel every pass is split
+// over the threads like for the other integers
+template<typename T>
+struct WideRadixSorter
+{
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor)
+    {
+        if (FusedRadixSorter<T>::applies(executor, end - begin))
+            return FusedRadixSorter<T>::sort(begin, end, buffer_begin, extract_key, executor);
+        return SizedRadixSorter<16>::sort(begin, end, buffer_begin, extract_key, executor);
+    }
+
+    static constexpr size_t pass_count = fused_pass_count<T>(SizedRadixSorter<16>::pass_count);
+};
+template<>
+struct RadixSorter<__int128> : WideRadixSorter<__int128>
+{
+};
+template<>
+struct RadixSorter<unsigned __int128> : WideRadixSorter<unsigned __int128>
+{
+};
+#endif
+template<>
+struct RadixSorter<float> : SizedRadixSorter<sizeof(float)>
+{
+};
+template<>
+struct RadixSorter<double> : SizedRadixSorter<sizeof(double)>
+{
+};
+template<>
+struct RadixSorter<char> : SizedRadixSorter<sizeof(char)>
+{
+};
+template<>
+struct RadixSorter<wchar_t> : SizedRadixSorter<sizeof(wchar_t)>
+{
+};
+template<>
+struct RadixSorter<char16_t> : SizedRadixSorter<sizeof(char16_t)>
+{
+};
+template<>
+struct RadixSorter<char32_t> : SizedRadixSorter<sizeof(char32_t)>
+{
+};
+template<typename K, typename V>
+struct RadixSorter<std::pair<K, V>>
+{
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor)
+    {
+        if (FusedRadixSorter<std::pair<K, V>>::applies(executor, end - begin))
+            return FusedRadixSorter<std::pair<K, V>>::sort(begin, end, buffer_begin, extract_key, executor);
+        ResultPlacement wanted = wanted_placement(executor);
+        set_wanted_placement(executor, ResultPlacement::anywhere);
+        bool first_result = RadixSorter<V>::sort(begin, end, buffer_begin, [&](auto && o)
+        {
+            return extract_key(o).second;
+        }, executor);
+        set_wanted_placement(executor, next_placement(wanted, first_result));
+        auto extract_first = [&](auto && o)
+        {
+            return extract_key(o).first;
+        };
+
+        if (first_result)
+        {
+            return !RadixSorter<K>::sort(buffer_begin, buffer_begin + (end - begin), begin, extract_first, executor);
+        }
+        else
+        {
+            return RadixSorter<K>::sort(begin, end, buffer_begin, extract_first, executor);
+        }
+    }
+
+    static constexpr size_t pass_count = fused_pass_count<std::pair<K, V>>(RadixSorter<K>::pass_count + RadixSorter<V>::pass_count);
+};
+template<typename K, typename V>
+struct RadixSorter<const std::pair<K, V> &>
+{
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor)
+    {
+        if (FusedRadixSorter<std::pair<K, V>>::applies(executor, end - begin))
+            return FusedRadixSorter<std::pair<K, V>>::sort(begin, end, buffer_begin, extract_key, executor);
+        ResultPlacement wanted = wanted_placement(executor);
+        set_wanted_placement(executor, ResultPlacement::anywhere);
+        bool first_result = RadixSorter<V>::sort(begin, end, buffer_begin, [&](auto && o) -> const V &
+        {
+            return extract_key(o).second;
+        }, executor);
+        set_wanted_placement(executor, next_placement(wanted, first_result));
+        auto extract_first = [&](auto && o) -> const K &
+        {
+            return extract_key(o).first;
+        };
+
+        if (first_result)
+        {
+            return !RadixSorter<K>::sort(buffer_begin, buffer_begin + (end - begin), begin, extract_first, executor);
+        }
+        else
+        {
+            return RadixSorter<K>::sort(begin, end, buffer_begin, extract_first, executor);
+        }
+    }
+
+    static constexpr size_t pass_count = fused_pass_count<std::pair<K, V>>(RadixSorter<K>::pass_count + RadixSorter<V>::pass_count);
+};
+template<size_t I, size_t S, typename Tuple>
+struct TupleRadixSorter
+{
+    using NextSorter = TupleRadixSorter<I + 1, S, Tuple>;
+    using ThisSorter = RadixSorter<typename std::tuple_element<I, Tuple>::type>;
+
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt out_begin, OutIt out_end, ExtractKey && extract_key, Executor & executor)
+    {
+        ResultPlacement wanted = wanted_placement(executor);
+        set_wanted_placement(executor, ResultPlacement::anywhere);
+        bool which = NextSorter::sort(begin, end, out_begin, out_end, extract_key, executor);
+        set_wanted_placement(executor, next_placement(wanted, which));
+        auto extract_i = [&](auto && o)
+        {
+            return std::get<I>(extract_key(o));
+        };
+        if (which)
+            return !ThisSorter::sort(out_begin, out_end, begin, extract_i, executor);
+        else
+            return ThisSorter::sort(begin, end, out_begin, extract_i, executor);
+    }
+
+    static constexpr size_t pass_count = ThisSorter::pass_count + NextSorter::pass_count;
+};
+template<size_t I, size_t S, typename Tuple>
+struct TupleRadixSorter<I, S, const Tuple &>
+{
+    using NextSorter = TupleRadixSorter<I + 1, S, const Tuple &>;
+    using ThisSorter = RadixSorter<typename std::tuple_element<I, Tuple>::type>;
+
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt out_begin, OutIt out_end, ExtractKey && extract_key, Executor & executor)
+    {
+        ResultPlacement wanted = wanted_placement(executor);
+        set_wanted_placement(executor, ResultPlacement::anywhere);
+        bool which = NextSorter::sort(begin, end, out_begin, out_end, extract_key, executor);
+        set_wanted_placement(executor, next_placement(wanted, which));
+        auto extract_i = [&](auto && o) -> decltype(auto)
+        {
+            return std::get<I>(extract_key(o));
+        };
+        if (which)
+            return !ThisSorter::sort(out_begin, out_end, begin, extract_i, executor);
+        else
+            return ThisSorter::sort(begin, end, out_begin, extract_i, executor);
+    }
+
+    static constexpr size_t pass_count = ThisSorter::pass_count + NextSorter::pass_count;
+};
+template<size_t I, typename Tuple>
+struct TupleRadixSorter<I, I, Tuple>
+{
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It, It, OutIt, OutIt, ExtractKey &&, Executor &)
+    {
+        return false;
+    }
+
+    static constexpr size_t pass_count = 0;
+};
+template<size_t I, typename Tuple>
+struct TupleRadixSorter<I, I, const Tuple &>
+{
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It, It, OutIt, OutIt, ExtractKey &&, Executor &)
+    {
+        return false;
+    }
+
+    static constexpr size_t pass_count = 0;
+};
+
+template<typename... Args>
+struct RadixSorter<std::tuple<Args...>>
+{
+    using SorterImpl = TupleRadixSorter<0, sizeof...(Args), std::tuple<Args...>>;
+
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor)
+    {
+        if (FusedRadixSorter<std::tuple<Args...>>::applies(executor, end - begin))
+            return FusedRadixSorter<std::tuple<Args...>>::sort(begin, end, buffer_begin, extract_key, executor);
+        return SorterImpl::sort(begin, end, buffer_begin, buffer_begin + (end - begin), extract_key, executor);
+    }
+
+    static constexpr size_t pass_count = fused_pass_count<std::tuple<Args...>>(SorterImpl::pass_count);
+};
+
+template<typename... Args>
+struct RadixSorter<const std::tuple<Args...> &>
+{
+    using SorterImpl = TupleRadixSorter<0, sizeof...(Args), const std::tuple<Args...> &>;
+
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor)
     {
-        std::ptrdiff_t num_elements = end - begin;
-        if (num_elements <= (1 << 8))
-            return sort_inline<uint8_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key);
-        else if (num_elements <= (1 << 16))
-            return sort_inline<uint16_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key);
-        else if (num_elements <= (1ll << 32))
-            return sort_inline<uint32_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key);
-        else
-            return sort_inline<uint64_t>(begin, end, buffer_begin, buffer_begin + num_elements, extract_key);
+        if (FusedRadixSorter<std::tuple<Args...>>::applies(executor, end - begin))
+            return FusedRadixSorter<std::tuple<Args...>>::sort(begin, end, buffer_begin, extract_key, executor);
+        return SorterImpl::sort(begin, end, buffer_begin, buffer_begin + (end - begin), extract_key, executor);
     }
-    template<typename count_type, typename It, typename OutIt, typename ExtractKey>
-    static bool sort_inline(It begin, It end, OutIt out_begin, OutIt out_end, ExtractKey && extract_key)
+
+    static constexpr size_t pass_count = fused_pass_count<std::tuple<Args...>>(SorterImpl::pass_count);
+};
+
+template<typename T, size_t S>
+struct RadixSorter<std::array<T, S>>
+{
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor)
     {
-        count_type counts0[256] = {};
-        count_type counts1[256] = {};
-        count_type counts2[256] = {};
-        count_type counts3[256] = {};
-        count_type counts4[256] = {};
-        count_type counts5[256] = {};
-        count_type counts6[256] = {};
-        count_type counts7[256] = {};
+        if (FusedRadixSorter<std::array<T, S>>::applies(executor, end - begin))
+            return FusedRadixSorter<std::array<T, S>>::sort(begin, end, buffer_begin, extract_key, executor);
+        auto buffer_end = buffer_begin + (end - begin);
+        ResultPlacement wanted = wanted_placement(executor);
+        bool which = false;
+        for (size_t i = S; i > 0; --i)
+        {
+            auto extract_i = [&, i = i - 1](auto && o)
+            {
+                return extract_key(o)[i];
+            };
+            set_wanted_placement(executor, i == 1 ? next_placement(wanted, which) : ResultPlacement::anywhere);
+            if (which)
+                which = !RadixSorter<T>::sort(buffer_begin, buffer_end, begin, extract_i, executor);
+            else
+                which = RadixSorter<T>::sort(begin, end, buffer_begin, extract_i, executor);
+        }
+        return which;
+    }
 
-        for (It it = begin; it != end; ++it)
+    static constexpr size_t pass_count = fused_pass_count<std::array<T, S>>(RadixSorter<T>::pass_count * S);
+};
+
+// keys of variable length are sorted most significant byte first. the sort
+// is stable so that they also work as components of pairs and tuples. there
+// is one extra bucket, end_bucket, for keys that end at the current byte. it
+// comes before the 256 byte buckets. SequenceKey treats a string or vector as a sequence of
+// bytes by encoding every element with to_unsigned in big endian order, so
+// comparing the bytes gives the same result as comparing the sequences
+template<typename T>
+struct SequenceKey
+{
+    using element_type = typename std::decay<decltype(to_unsigned(std::declval<typename T::value_type>()))>::type;
+    static constexpr size_t element_size = sizeof(element_type);
+    // for strings of char we can compare the memory directly
+    static constexpr bool is_contiguous_byte_sequence = is_contiguous_sequence<T>::value
+            && (std::is_same<typename T::value_type, char>::value || std::is_same<typename T::value_type, unsigned char>::value);
+    static constexpr unsigned end_bucket = 0;
+
+    static size_t num_bytes(const T & key)
+    {
+        return key.size() * element_size;
+    }
+    static std::uint8_t byte_at(const T & key, size_t index)
+    {
+        element_type element = to_unsigned(key[index / element_size]);
+        return static_cast<std::uint8_t>(static_cast<std::uint64_t>(element) >> ((element_size - 1 - index % element_size) * 8));
+    }
+    // 0 if the key ends before index, otherwise the byte at index plus one
+    static unsigned bucket(const T & key, size_t index)
+    {
+        if (index < num_bytes(key))
+            return byte_at(key, index) + 1u;
+        else
+            return 0;
+    }
+    // loads the eight bytes starting at index as one big endian number, so
+    // that they can be compared all at once. returns false if fewer than
+    // eight bytes are left, in which case the missing bytes are zero
+    static bool load_prefix(const T & key, size_t index, std::uint64_t & prefix)
+    {
+        size_t size = num_bytes(key);
+        size_t count = index < size ? std::min(size - index, size_t(8)) : 0;
+        prefix = load_prefix_impl(key, index, count, std::integral_constant<bool, is_contiguous_byte_sequence>{});
+        return count == 8;
+    }
+    // compares the keys starting at byte index, assuming that the bytes
+    // before that are equal
+    static bool less_from(const T & lhs, const T & rhs, size_t index)
+    {
+        for (;; index += 8)
         {
-            uint64_t key = to_unsigned(extract_key(*it));
-            ++counts0[key & 0xff];
-            ++counts1[(key >> 8) & 0xff];
-            ++counts2[(key >> 16) & 0xff];
-            ++counts3[(key >> 24) & 0xff];
-            ++counts4[(key >> 32) & 0xff];
-            ++counts5[(key >> 40) & 0xff];
-            ++counts6[(key >> 48) & 0xff];
-            ++counts7[(key >> 56) & 0xff];
-        }
-        count_type total0 = 0;
-        count_type total1 = 0;
-        count_type total2 = 0;
-        count_type total3 = 0;
-        count_type total4 = 0;
-        count_type total5 = 0;
-        count_type total6 = 0;
-        count_type total7 = 0;
-        for (int i = 0; i < 256; ++i)
+            std::uint64_t lhs_prefix;
+            std::uint64_t rhs_prefix;
+            bool lhs_full = load_prefix(lhs, index, lhs_prefix);
+            bool rhs_full = load_prefix(rhs, index, rhs_prefix);
+            if (lhs_prefix != rhs_prefix)
+                return lhs_prefix < rhs_prefix;
+            else if (!lhs_full || !rhs_full)
+                return num_bytes(lhs) < num_bytes(rhs);
+        }
+    }
+
+private:
+    static std::uint64_t load_prefix_impl(const T & key, size_t index, size_t count, std::true_type)
+    {
+        std::uint64_t prefix = 0;
+        std::memcpy(&prefix, key.data() + index, count);
+        return big_endian_to_native(prefix);
+    }
+    static std::uint64_t load_prefix_impl(const T & key, size_t index, size_t count, std::false_type)
+    {
+        std::uint64_t prefix = 0;
+        for (size_t i = 0; i < count; ++i)
+            prefix |= static_cast<std::uint64_t>(byte_at(key, index + i)) << ((7 - i) * 8);
+        return prefix;
+    }
+};
+// c strings end at the first zero byte. we never look past the end because
+// the sort only recurses into keys that haven't ended yet
+struct NullTerminatedKey
+{
+    static constexpr unsigned end_bucket = 0;
+
+    static unsigned bucket(const char * key, size_t index)
+    {
+        unsigned char c = static_cast<unsigned char>(key[index]);
+        return c ? c + 1u : 0u;
+    }
+    static bool load_prefix(const char * key, size_t index, std::uint64_t & prefix)
+    {
+        prefix = 0;
+        for (size_t i = 0; i < 8; ++i)
         {
-            count_type old_count0 = counts0[i];
-            count_type old_count1 = counts1[i];
-            count_type old_count2 = counts2[i];
-            count_type old_count3 = counts3[i];
-            count_type old_count4 = counts4[i];
-            count_type old_count5 = counts5[i];
-            count_type old_count6 = counts6[i];
-            count_type old_count7 = counts7[i];
-            counts0[i] = total0;
-            counts1[i] = total1;
-            counts2[i] = total2;
-            counts3[i] = total3;
-            counts4[i] = total4;
-            counts5[i] = total5;
-            counts6[i] = total6;
-            counts7[i] = total7;
-            total0 += old_count0;
-            total1 += old_count1;
-            total2 += old_count2;
-            total3 += old_count3;
-            total4 += old_count4;
-            total5 += old_count5;
-            total6 += old_count6;
-            total7 += old_count7;
+            unsigned char c = static_cast<unsigned char>(key[index + i]);
+            if (!c)
+                return false;
+            prefix |= static_cast<std::uint64_t>(c) << ((7 - i) * 8);
         }
-        for (It it = begin; it != end; ++it)
+        return true;
+    }
+    static bool less_from(const char * lhs, const char * rhs, size_t index)
+    {
+        return std::strcmp(lhs + index, rhs + index) < 0;
+    }
+};
+// descending variable length keys use the buckets in reverse order. so keys
+// that end at the current byte come last, after the longer keys that they
+// are a prefix of
+template<typename KeyTraits>
+struct DescendingKeyTraits
+{
+    static constexpr unsigned end_bucket = 256 - KeyTraits::end_bucket;
+
+    template<typename T>
+    static unsigned bucket(const radix_sort_descending_key<T> & key, size_t index)
+    {
+        return 256 - KeyTraits::bucket(key.key, index);
+    }
+    // the prefixes are only compared for equality
+    template<typename T>
+    static bool load_prefix(const radix_sort_descending_key<T> & key, size_t index, std::uint64_t & prefix)
+    {
+        return KeyTraits::load_prefix(key.key, index, prefix);
+    }
+    template<typename T>
+    static bool less_from(const radix_sort_descending_key<T> & lhs, const radix_sort_descending_key<T> & rhs, size_t index)
+    {
+        return KeyTraits::less_from(rhs.key, lhs.key, index);
+    }
+};
+
+// below this size a range of variable length keys is sorted by comparison
+static constexpr std::ptrdiff_t variable_length_fallback_threshold = 32;
+
+template<typename KeyTraits>
+struct VariableLengthRadixSorter
+{
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor &)
+    {
+        sort_from(begin, end, buffer_begin, extract_key, 0, false);
+        return false;
+    }
+
+    // linear_sort uses this to pick its threshold. the sort only reads the
+    // bytes that it needs to tell the keys apart, so there is no fixed
+    // number. in measurements std::sort was faster below about 64 random
+    // strings, and below about 1000 strings with a shared 25 byte prefix.
+    // counting the sort like an eight byte key puts std::string in the
+    // linear_sort row with a threshold of 128, between those two
+    static constexpr size_t pass_count = 8;
+
+private:
+    // sorts the keys in [begin, end) starting at byte index. out_begin is a
+    // range of the same size that is used as the buffer. result_in_out says
+    // which of the two ranges should hold the sorted elements at the end.
+    // the biggest bucket of every scatter is sorted in this loop instead of
+    // recursing. all other buckets are at most half as big as the range, so
+    // the recursion is at most log2(n) deep, even for long keys with shared
+    // prefixes like urls and paths. every scatter moves the biggest bucket
+    // to the other range, so one trip around the loop does two of them
+    template<typename It, typename OutIt, typename ExtractKey>
+    static void sort_from(It begin, It end, OutIt out_begin, ExtractKey & extract_key, size_t index, bool result_in_out)
+    {
+        std::ptrdiff_t offset = 0;
+        std::ptrdiff_t num_elements = end - begin;
+        for (;;)
         {
-            std::uint8_t key = to_unsigned(extract_key(*it));
-            out_begin[counts0[key]++] = std::move(*it);
+            if (!sort_all_but_biggest(begin + offset, num_elements, out_begin + offset, extract_key, index, result_in_out, offset))
+                return;
+            if (!sort_all_but_biggest(out_begin + offset, num_elements, begin + offset, extract_key, index, !result_in_out, offset))
+                return;
         }
-        for (OutIt it = out_begin; it != out_end; ++it)
+    }
+    // does one scatter from [begin, begin + num_elements) into out_begin and
+    // sorts all the buckets but the biggest one. returns false if nothing is
+    // left to sort. otherwise the biggest bucket is left in out_begin, and
+    // offset, num_elements and index are changed to describe it
+    template<typename It, typename OutIt, typename ExtractKey>
+    static bool sort_all_but_biggest(It begin, std::ptrdiff_t & num_elements, OutIt out_begin, ExtractKey & extract_key, size_t & index, bool result_in_out, std::ptrdiff_t & offset)
+    {
+        It end = begin + num_elements;
+        if (num_elements <= variable_length_fallback_threshold)
         {
-            std::uint8_t key = to_unsigned(extract_key(*it)) >> 8;
-            begin[counts1[key]++] = std::move(*it);
+            insertion_sort(begin, end, extract_key, index);
+            if (result_in_out)
+                std::move(begin, end, out_begin);
+            return false;
         }
-        for (It it = begin; it != end; ++it)
+        std::size_t counts[257];
+        bool skip_prefixes = false;
+        for (;;)
         {
-            std::uint8_t key = to_unsigned(extract_key(*it)) >> 16;
-            out_begin[counts2[key]++] = std::move(*it);
+            // after finding a byte that is the same in all keys, there are
+            // often more of them, so check eight bytes at a time
+            if (skip_prefixes && all_share_prefix(begin, end, extract_key, index))
+            {
+                index += 8;
+                continue;
+            }
+            std::fill(std::begin(counts), std::end(counts), std::size_t(0));
+            for (It it = begin; it != end; ++it)
+                ++counts[KeyTraits::bucket(extract_key(*it), index)];
+            unsigned first_bucket = KeyTraits::bucket(extract_key(*begin), index);
+            if (counts[first_bucket] != static_cast<std::size_t>(num_elements))
+                break;
+            else if (first_bucket == KeyTraits::end_bucket)
+            {
+                // all keys are equal
+                if (result_in_out)
+                    std::move(begin, end, out_begin);
+                return false;
+            }
+            ++index;
+            skip_prefixes = true;
         }
-        for (OutIt it = out_begin; it != out_end; ++it)
+        std::size_t offsets[257];
+        std::size_t total = 0;
+        unsigned biggest = KeyTraits::end_bucket;
+        for (unsigned i = 0; i < 257; ++i)
         {
-            std::uint8_t key = to_unsigned(extract_key(*it)) >> 24;
-            begin[counts3[key]++] = std::move(*it);
+            offsets[i] = total;
+            total += counts[i];
+            if (i != KeyTraits::end_bucket && (biggest == KeyTraits::end_bucket || counts[i] > counts[biggest]))
+                biggest = i;
         }
         for (It it = begin; it != end; ++it)
+            out_begin[offsets[KeyTraits::bucket(extract_key(*it), index)]++] = std::move(*it);
+        std::ptrdiff_t bucket_end = 0;
+        std::ptrdiff_t biggest_begin = 0;
+        for (unsigned i = 0; i < 257; ++i)
         {
-            std::uint8_t key = to_unsigned(extract_key(*it)) >> 32;
-            out_begin[counts4[key]++] = std::move(*it);
+            std::ptrdiff_t bucket_begin = bucket_end;
+            bucket_end += static_cast<std::ptrdiff_t>(counts[i]);
+            if (bucket_begin == bucket_end)
+                continue;
+            else if (i == KeyTraits::end_bucket)
+            {
+                // these keys have ended, so they are all equal
+                if (!result_in_out)
+                    std::move(out_begin + bucket_begin, out_begin + bucket_end, begin + bucket_begin);
+            }
+            else if (i == biggest)
+                biggest_begin = bucket_begin;
+            else
+                sort_from(out_begin + bucket_begin, out_begin + bucket_end, begin + bucket_begin, extract_key, index + 1, !result_in_out);
         }
-        for (OutIt it = out_begin; it != out_end; ++it)
+        // the end bucket can't be the biggest because the keys didn't all end
+        offset += biggest_begin;
+        num_elements = static_cast<std::ptrdiff_t>(counts[biggest]);
+        ++index;
+        return true;
+    }
+
+    template<typename It, typename ExtractKey>
+    static bool all_share_prefix(It begin, It end, ExtractKey & extract_key, size_t index)
+    {
+        std::uint64_t first_prefix;
+        if (!KeyTraits::load_prefix(extract_key(*begin), index, first_prefix))
+            return false;
+        for (It it = std::next(begin); it != end; ++it)
         {
-            std::uint8_t key = to_unsigned(extract_key(*it)) >> 40;
-            begin[counts5[key]++] = std::move(*it);
+            std::uint64_t prefix;
+            if (!KeyTraits::load_prefix(extract_key(*it), index, prefix) || prefix != first_prefix)
+                return false;
         }
-        for (It it = begin; it != end; ++it)
+        return true;
+    }
+
+    // stable, and it doesn't need to allocate memory like std::stable_sort
+    template<typename It, typename ExtractKey>
+    static void insertion_sort(It begin, It end, ExtractKey & extract_key, size_t index)
+    {
+        if (begin == end)
+            return;
+        for (It it = std::next(begin); it != end; ++it)
         {
-            std::uint8_t key = to_unsigned(extract_key(*it)) >> 48;
-            out_begin[counts6[key]++] = std::move(*it);
+            It previous = std::prev(it);
+            if (!KeyTraits::less_from(extract_key(*it), extract_key(*previous), index))
+                continue;
+            typename std::iterator_traits<It>::value_type to_insert = std::move(*it);
+            It hole = it;
+            do
+            {
+                *hole = std::move(*previous);
+                hole = previous;
+            }
+            while (hole != begin && KeyTraits::less_from(extract_key(to_insert), extract_key(*--previous), index));
+            *hole = std::move(to_insert);
         }
-        for (OutIt it = out_begin; it != out_end; ++it)
+    }
+};
+
+template<typename CharT, typename Traits, typename Allocator>
+struct RadixSorter<std::basic_string<CharT, Traits, Allocator>> : VariableLengthRadixSorter<SequenceKey<std::basic_string<CharT, Traits, Allocator>>>
+{
+};
+#ifdef RADIX_SORT_HAS_CPP17
+template<typename CharT, typename Traits>
+struct RadixSorter<std::basic_string_view<CharT, Traits>> : VariableLengthRadixSorter<SequenceKey<std::basic_string_view<CharT, Traits>>>
+{
+};
+#endif
+template<typename T, typename Allocator>
+struct RadixSorter<std::vector<T, Allocator>> : VariableLengthRadixSorter<SequenceKey<std::vector<T, Allocator>>>
+{
+};
+template<>
+struct RadixSorter<const char *> : VariableLengthRadixSorter<NullTerminatedKey>
+{
+};
+template<>
+struct RadixSorter<char *> : VariableLengthRadixSorter<NullTerminatedKey>
+{
+};
+template<>
+struct RadixSorter<const char * const> : VariableLengthRadixSorter<NullTerminatedKey>
+{
+};
+template<>
+struct RadixSorter<char * const> : VariableLengthRadixSorter<NullTerminatedKey>
+{
+};
+
+
+// scalars are sorted as their descending encoding, variable length keys with
+// the buckets in reverse order
+template<typename T>
+struct DescendingRadixSorter
+{
+    typedef decltype(to_unsigned(std::declval<radix_sort_descending_key<T>>())) encoded_type;
+
+    template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Executor & executor)
+    {
+        return RadixSorter<encoded_type>::sort(begin, end, buffer_begin, [&](auto && o)
         {
-            std::uint8_t key = to_unsigned(extract_key(*it)) >> 56;
-            begin[counts7[key]++] = std::move(*it);
-        }
+            return to_unsigned(extract_key(o));
+        }, executor);
+    }
+
+    static constexpr size_t pass_count = RadixSorter<encoded_type>::pass_count;
+};
+template<typename CharT, typename Traits, typename Allocator>
+struct DescendingRadixSorter<std::basic_string<CharT, Traits, Allocator>> : VariableLengthRadixSorter<DescendingKeyTraits<SequenceKey<std::basic_string<CharT, Traits, Allocator>>>>
+{
+};
+#ifdef RADIX_SORT_HAS_CPP17
+template<typename CharT, typename Traits>
+struct DescendingRadixSorter<std::basic_string_view<CharT, Traits>> : VariableLengthRadixSorter<DescendingKeyTraits<SequenceKey<std::basic_string_view<CharT, Traits>>>>
+{
+};
+#endif
+template<typename T, typename Allocator>
+struct DescendingRadixSorter<std::vector<T, Allocator>> : VariableLengthRadixSorter<DescendingKeyTraits<SequenceKey<std::vector<T, Allocator>>>>
+{
+};
+template<>
+struct DescendingRadixSorter<const char *> : VariableLengthRadixSorter<DescendingKeyTraits<NullTerminatedKey>>
+{
+};
+template<>
+struct DescendingRadixSorter<char *> : VariableLengthRadixSorter<DescendingKeyTraits<NullTerminatedKey>>
+{
+};
+template<typename T>
+struct RadixSorter<radix_sort_descending_key<T>> : DescendingRadixSorter<typename std::decay<T>::type>
+{
+};
+
+template<typename T>
+struct RadixSorter<T &> : RadixSorter<const T &>
+{
+};
+template<typename T>
+struct RadixSorter<T &&> : RadixSorter<T>
+{
+};
+template<typename T>
+struct RadixSorter<const T &> : RadixSorter<T>
+{
+};
+template<typename T>
+struct RadixSorter<const T &&> : RadixSorter<T>
+{
+};
+template<typename T>
+struct RadixSorter : RadixSorter<decltype(to_unsigned(std::declval<T>()))>
+{
+};
+
+template<typename T>
+size_t radix_sort_pass_count = RadixSorter<T>::pass_count;
+
+// the key that the indirect sort and the cached key sort store for every
+// element. scalars are stored already converted by to_unsigned, pairs,
+// tuples and arrays are converted component by component, and everything
+// else is stored as a copy of the key
+template<typename T, typename = void>
+struct CachedKey
+{
+    typedef T type;
+
+    static const T & encode(const T & key)
+    {
+        return key;
+    }
+};
+template<typename T>
+struct CachedKey<T, typename std::enable_if<std::is_arithmetic<T>::value>::type>
+{
+    typedef decltype(to_unsigned(std::declval<T>())) type;
+
+    static type encode(T key)
+    {
+        return to_unsigned(key);
+    }
+};
+template<typename T>
+struct CachedKey<radix_sort_descending_key<T>>
+{
+    typedef radix_sort_descending_key<typename CachedKey<typename std::decay<T>::type>::type> type;
+
+    static type encode(const radix_sort_descending_key<T> & key)
+    {
+        return { CachedKey<typename std::decay<T>::type>::encode(key.key) };
+    }
+};
+template<typename K, typename V>
+struct CachedKey<std::pair<K, V>>
+{
+    typedef std::pair<typename CachedKey<K>::type, typename CachedKey<V>::type> type;
+
+    static type encode(const std::pair<K, V> & key)
+    {
+        return type(CachedKey<K>::encode(key.first), CachedKey<V>::encode(key.second));
+    }
+};
+template<typename... Args>
+struct CachedKey<std::tuple<Args...>>
+{
+    typedef std::tuple<typename CachedKey<Args>::type...> type;
+
+    static type encode(const std::tuple<Args...> & key)
+    {
+        return encode(key, std::index_sequence_for<Args...>{});
+    }
+
+private:
+    template<size_t... Indices>
+    static type encode(const std::tuple<Args...> & key, std::index_sequence<Indices...>)
+    {
+        return type(CachedKey<Args>::encode(std::get<Indices>(key))...);
+    }
+};
+template<typename T, size_t Size>
+struct CachedKey<std::array<T, Size>>
+{
+    typedef std::array<typename CachedKey<T>::type, Size> type;
+
+    static type encode(const std::array<T, Size> & key)
+    {
+        type result;
+        for (size_t i = 0; i < Size; ++i)
+            result[i] = CachedKey<T>::encode(key[i]);
+        return result;
+    }
+};
+
+// how many elements ahead of the gather position we prefetch the source
+static constexpr std::ptrdiff_t indirect_prefetch_distance = 8;
+
+template<typename It>
+void prefetch_element(It it, std::true_type)
+{
+#ifdef __GNUC__
+    __builtin_prefetch(&*it);
+#elif defined(RADIX_SORT_HAS_SSE2)
+    _mm_prefetch(reinterpret_cast<const char *>(&*it), _MM_HINT_T0);
+#endif
+}
+template<typename It>
+void prefetch_element(It, std::false_type)
+{
+}
+
+// sorts (key, index) pairs instead of the elements, then moves every element
+// into the buffer exactly once. the moves read from random positions but
+// write sequentially, and we prefetch the reads. for big elements this is a
+// lot less memory traffic than moving the whole element in every pass
+// sorts the cached keys of the elements together with the index of their
+// element and returns the sorted pairs, which are in one of the two vectors
+template<typename index_type, typename Key, typename It, typename ExtractKey, typename Executor>
+const std::pair<typename CachedKey<Key>::type, index_type> * sort_indexed_keys(It begin, It end, ExtractKey & extract_key, Executor & executor, std::vector<std::pair<typename CachedKey<Key>::type, index_type>> & keys, std::vector<std::pair<typename CachedKey<Key>::type, index_type>> & key_buffer)
+{
+    typedef typename CachedKey<Key>::type key_type;
+    typedef std::pair<key_type, index_type> indexed_key;
+    keys.reserve(end - begin);
+    index_type index = 0;
+    for (It it = begin; it != end; ++it, ++index)
+        keys.emplace_back(CachedKey<Key>::encode(extract_key(*it)), index);
+    key_buffer.resize(keys.size());
+    bool in_buffer = RadixSorter<const key_type &>::sort(keys.begin(), keys.end(), key_buffer.begin(), [](const indexed_key & key) -> const key_type &
+    {
+        return key.first;
+    }, executor);
+    return in_buffer ? key_buffer.data() : keys.data();
+}
+template<typename index_type, typename Key, typename It, typename OutIt, typename ExtractKey, typename Executor>
+bool indirect_radix_sort_impl(It begin, It end, OutIt buffer_begin, ExtractKey & extract_key, Executor & executor)
+{
+    std::ptrdiff_t num_elements = end - begin;
+    std::vector<std::pair<typename CachedKey<Key>::type, index_type>> keys;
+    std::vector<std::pair<typename CachedKey<Key>::type, index_type>> key_buffer;
+    const auto * sorted = sort_indexed_keys<index_type, Key>(begin, end, extract_key, executor, keys, key_buffer);
+    std::integral_constant<bool, is_pointer_like_iterator<It>::value> can_prefetch;
+    for (std::ptrdiff_t i = 0; i < num_elements; ++i)
+    {
+        if (i + indirect_prefetch_distance < num_elements)
+            prefetch_element(begin + sorted[i + indirect_prefetch_distance].second, can_prefetch);
+        buffer_begin[i] = std::move(begin[sorted[i].second]);
+    }
+    return true;
+}
+template<typename Key, typename It, typename OutIt, typename ExtractKey, typename Executor>
+bool indirect_radix_sort_impl(It begin, It end, OutIt buffer_begin, ExtractKey & extract_key, Executor & executor)
+{
+    std::ptrdiff_t num_elements = end - begin;
+    if (num_elements <= 1)
         return false;
+    else if (num_elements < (1ll << 32))
+        return indirect_radix_sort_impl<std::uint32_t, Key>(begin, end, buffer_begin, extract_key, executor);
+    else
+        return indirect_radix_sort_impl<std::uint64_t, Key>(begin, end, buffer_begin, extract_key, executor);
+}
+
+// radix_argsort packs the key and the index into one integer with the key in
+// the high bits if they fit into 64 bits together. then every pass moves 8
+// bytes per element, and the sort only does passes over the key bits
+template<typename index_type, typename Key, typename CachedKeyType = typename CachedKey<Key>::type>
+struct argsort_packs_key : std::integral_constant<bool, std::is_integral<CachedKeyType>::value
+    && std::is_unsigned<CachedKeyType>::value
+    && sizeof(CachedKeyType) + sizeof(index_type) <= sizeof(std::uint64_t)>
+{
+};
+
+template<typename index_type, typename Key, typename It, typename IndexOutIt, typename ExtractKey, typename Executor>
+IndexOutIt radix_argsort_impl(It begin, It end, IndexOutIt index_out, ExtractKey & extract_key, Executor & executor, std::true_type)
+{
+    typedef typename CachedKey<Key>::type key_type;
+    static constexpr unsigned key_shift = sizeof(index_type) * 8;
+    std::vector<std::uint64_t> packed;
+    packed.reserve(end - begin);
+    index_type index = 0;
+    for (It it = begin; it != end; ++it, ++index)
+        packed.push_back((static_cast<std::uint64_t>(CachedKey<Key>::encode(extract_key(*it))) << key_shift) | index);
+    std::vector<std::uint64_t> buffer(packed.size());
+    bool in_buffer = RadixSorter<key_type>::sort(packed.begin(), packed.end(), buffer.begin(), [](std::uint64_t p)
+    {
+        return static_cast<key_type>(p >> key_shift);
+    }, executor);
+    for (std::uint64_t p : in_buffer ? buffer : packed)
+    {
+        *index_out = static_cast<index_type>(p);
+        ++index_out;
+    }
+    return index_out;
+}
+template<typename index_type, typename Key, typename It, typename IndexOutIt, typename ExtractKey, typename Executor>
+IndexOutIt radix_argsort_unpacked(It begin, It end, IndexOutIt index_out, ExtractKey & extract_key, Executor & executor, std::true_type)
+{
+    std::vector<std::pair<typename CachedKey<Key>::type, index_type>> keys;
+    std::vector<std::pair<typename CachedKey<Key>::type, index_type>> key_buffer;
+    const auto * sorted = sort_indexed_keys<index_type, Key>(begin, end, extract_key, executor, keys, key_buffer);
+    for (std::ptrdiff_t i = 0; i < end - begin; ++i)
+    {
+        *index_out = sorted[i].second;
+        ++index_out;
+    }
+    return index_out;
+}
+// variable length keys can't be cached, so this sorts the indices and looks
+// up the key of the element on every pass
+template<typename index_type, typename Key, typename It, typename IndexOutIt, typename ExtractKey, typename Executor>
+IndexOutIt radix_argsort_unpacked(It begin, It end, IndexOutIt index_out, ExtractKey & extract_key, Executor & executor, std::false_type)
+{
+    std::vector<index_type> indices(end - begin);
+    for (std::size_t i = 0; i < indices.size(); ++i)
+        indices[i] = static_cast<index_type>(i);
+    std::vector<index_type> buffer(indices.size());
+    bool in_buffer = RadixSorter<Key>::sort(indices.begin(), indices.end(), buffer.begin(), [&](index_type index) -> decltype(auto)
+    {
+        return extract_key(begin[index]);
+    }, executor);
+    return std::copy(in_buffer ? buffer.begin() : indices.begin(), in_buffer ? buffer.end() : indices.end(), index_out);
+}
+template<typename index_type, typename Key, typename It, typename IndexOutIt, typename ExtractKey, typename Executor>
+IndexOutIt radix_argsort_impl(It begin, It end, IndexOutIt index_out, ExtractKey & extract_key, Executor & executor, std::false_type)
+{
+    return radix_argsort_unpacked<index_type, Key>(begin, end, index_out, extract_key, executor, is_memcpyable<typename CachedKey<Key>::type>{});
+}
+template<typename Key, typename It, typename IndexOutIt, typename ExtractKey, typename Executor>
+IndexOutIt radix_argsort_impl(It begin, It end, IndexOutIt index_out, ExtractKey & extract_key, Executor & executor)
+{
+    std::ptrdiff_t num_elements = end - begin;
+    if (num_elements < (1ll << 32))
+        return radix_argsort_impl<std::uint32_t, Key>(begin, end, index_out, extract_key, executor, argsort_packs_key<std::uint32_t, Key>{});
+    else
+        return radix_argsort_impl<std::uint64_t, Key>(begin, end, index_out, extract_key, executor, argsort_packs_key<std::uint64_t, Key>{});
+}
+
+// the gather and the scatter of apply_permutation and
+// apply_inverse_permutation. they go over one column at a time, so that each
+// column only has one stream of random accesses, and they prefetch those
+template<typename IndexIt, typename It, typename OutIt>
+OutIt gather_column(IndexIt permutation_begin, IndexIt permutation_end, It column, OutIt out)
+{
+    std::ptrdiff_t num_elements = permutation_end - permutation_begin;
+    std::integral_constant<bool, is_pointer_like_iterator<It>::value> can_prefetch;
+    for (std::ptrdiff_t i = 0; i < num_elements; ++i, ++out)
+    {
+        if (i + indirect_prefetch_distance < num_elements)
+            prefetch_element(column + permutation_begin[i + indirect_prefetch_distance], can_prefetch);
+        *out = column[permutation_begin[i]];
+    }
+    return out;
+}
+template<typename IndexIt, typename It, typename OutIt>
+void scatter_column(IndexIt permutation_begin, IndexIt permutation_end, It column, OutIt out)
+{
+    std::ptrdiff_t num_elements = permutation_end - permutation_begin;
+    std::integral_constant<bool, is_pointer_like_iterator<OutIt>::value> can_prefetch;
+    for (std::ptrdiff_t i = 0; i < num_elements; ++i, ++column)
+    {
+        if (i + indirect_prefetch_distance < num_elements)
+            prefetch_element(out + permutation_begin[i + indirect_prefetch_distance], can_prefetch);
+        out[permutation_begin[i]] = *column;
     }
+}
+template<typename IndexIt, typename... Its, typename... OutIts, size_t... Indices>
+void gather_columns(IndexIt permutation_begin, IndexIt permutation_end, const std::tuple<Its...> & columns, const std::tuple<OutIts...> & outs, std::index_sequence<Indices...>)
+{
+    int unused[] = { 0, (gather_column(permutation_begin, permutation_end, std::get<Indices>(columns), std::get<Indices>(outs)), 0)... };
+    static_cast<void>(unused);
+}
+template<typename IndexIt, typename... Its, typename... OutIts, size_t... Indices>
+void scatter_columns(IndexIt permutation_begin, IndexIt permutation_end, const std::tuple<Its...> & columns, const std::tuple<OutIts...> & outs, std::index_sequence<Indices...>)
+{
+    int unused[] = { 0, (scatter_column(permutation_begin, permutation_end, std::get<Indices>(columns), std::get<Indices>(outs)), 0)... };
+    static_cast<void>(unused);
+}
+
+// linear_sort uses the indirect sort if the elements are much bigger than the
+// (key, index) pairs. the factor was measured with int64_t keys and
+// SizedStruct payloads in the benchmarks
+static constexpr std::size_t indirect_sort_size_factor = 2;
+
+template<typename T, typename Key>
+struct prefer_indirect_sort
+{
+    typedef typename CachedKey<Key>::type key_type;
+    static constexpr bool value = is_memcpyable<key_type>::value
+        && sizeof(T) >= indirect_sort_size_factor * sizeof(std::pair<key_type, std::uint32_t>);
+};
 
-    static constexpr size_t pass_count = 9;
+// linear_sort uses std::sort for fewer elements than these. rows are for keys
+// that take 1, 2, up to 4, up to 8, up to 16, up to 32 and more than 32
+// passes of radix_sort, columns for elements of 1, 2, up to 4, ... up to 256
+// and more than 256 bytes. the defaults were measured with
+// radix_sort_calibrate on a x86-64 Xeon. the radix sort for big elements is
+// the indirect sort, which is why the big columns come back down
+static constexpr std::ptrdiff_t linear_sort_never = std::numeric_limits<std::ptrdiff_t>::max();
+static constexpr std::size_t linear_sort_pass_buckets = 7;
+static constexpr std::size_t linear_sort_size_buckets = 10;
+static constexpr std::ptrdiff_t linear_sort_thresholds[linear_sort_pass_buckets][linear_sort_size_buckets] =
+#ifdef RADIX_SORT_LINEAR_SORT_THRESHOLDS
+    RADIX_SORT_LINEAR_SORT_THRESHOLDS;
+#else
+{
+    { 64, 64, 64, 32, 64, 32, 32, 32, 16, 8 },
+    { 64, 64, 64, 32, 64, 32, 32, 32, 16, 8 },
+    { 256, 256, 256, 256, 128, 128, 64, 64, 64, 16 },
+    { 512, 512, 512, 512, 2048, 128, 128, 64, 64, 16 },
+    { 2048, 2048, 2048, 2048, 4096, 4096, 4096, 2048, 512, 32 },
+    { linear_sort_never, linear_sort_never, linear_sort_never, linear_sort_never, linear_sort_never, linear_sort_never, linear_sort_never, linear_sort_never, linear_sort_never, 128 },
+    { linear_sort_never, linear_sort_never, linear_sort_never, linear_sort_never, linear_sort_never, linear_sort_never, linear_sort_never, linear_sort_never, linear_sort_never, linear_sort_never },
 };
+#endif
 
-template<typename>
-struct RadixSorter;
-template<>
-struct RadixSorter<bool>
+// rounds up to a power of two and returns the exponent, but at most
+// num_buckets - 1
+constexpr std::size_t linear_sort_bucket(std::size_t value, std::size_t num_buckets)
 {
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
+    std::size_t bucket = 0;
+    while (bucket + 1 < num_buckets && (std::size_t(1) << bucket) < value)
+        ++bucket;
+    return bucket;
+}
+template<typename T, typename Key>
+constexpr std::ptrdiff_t linear_sort_threshold()
+{
+    return linear_sort_thresholds[linear_sort_bucket(RadixSorter<Key>::pass_count, linear_sort_pass_buckets)][linear_sort_bucket(sizeof(T), linear_sort_size_buckets)];
+}
+
+// an iterator over a column of keys and one or more columns of values at the
+// same time. moving through it moves the key together with its values, so
+// the columns stay in the same order. the sorters only read the key, so the
+// histograms only touch the key column. cached_key_radix_sort uses it for an
+// array of cached keys and the elements, radix_sort_by_key for columns
+template<typename KeyIt, typename... ValueIts>
+struct KeyValueReference
+{
+    typename std::iterator_traits<KeyIt>::reference key;
+    std::tuple<typename std::iterator_traits<ValueIts>::reference...> values;
+
+    KeyValueReference(typename std::iterator_traits<KeyIt>::reference key, std::tuple<typename std::iterator_traits<ValueIts>::reference...> values)
+        : key(key), values(values)
     {
-        std::size_t false_count = 0;
-        for (It it = begin; it != end; ++it)
-        {
-            if (!extract_key(*it))
-                ++false_count;
-        }
-        size_t true_position = false_count;
-        false_count = 0;
-        for (; begin != end; ++begin)
-        {
-            if (extract_key(*begin))
-                buffer_begin[true_position++] = std::move(*begin);
-            else
-                buffer_begin[false_count++] = std::move(*begin);
-        }
-        return true;
+    }
+    KeyValueReference(const KeyValueReference &) = default;
+    KeyValueReference & operator=(KeyValueReference && other)
+    {
+        key = std::move(other.key);
+        assign_values(std::move(other), std::index_sequence_for<ValueIts...>{});
+        return *this;
+    }
+    KeyValueReference & operator=(const KeyValueReference & other)
+    {
+        key = other.key;
+        assign_values(other, std::index_sequence_for<ValueIts...>{});
+        return *this;
     }
 
-    static constexpr size_t pass_count = 2;
+private:
+    template<size_t... Indices>
+    void assign_values(KeyValueReference && other, std::index_sequence<Indices...>)
+    {
+        int unused[] = { 0, (std::get<Indices>(values) = std::move(std::get<Indices>(other.values)), 0)... };
+        static_cast<void>(unused);
+    }
+    template<size_t... Indices>
+    void assign_values(const KeyValueReference & other, std::index_sequence<Indices...>)
+    {
+        int unused[] = { 0, (std::get<Indices>(values) = std::get<Indices>(other.values), 0)... };
+        static_cast<void>(unused);
+    }
 };
-template<>
-struct RadixSorter<signed char> : SizedRadixSorter<sizeof(signed char)>
+template<typename KeyIt, typename... ValueIts>
+struct KeyValueIterator
 {
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef std::tuple<typename std::iterator_traits<KeyIt>::value_type, typename std::iterator_traits<ValueIts>::value_type...> value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef void pointer;
+    typedef KeyValueReference<KeyIt, ValueIts...> reference;
+
+    KeyIt key;
+    std::tuple<ValueIts...> values;
+
+    reference operator*() const
+    {
+        return index_values(0, std::index_sequence_for<ValueIts...>{});
+    }
+    reference operator[](difference_type index) const
+    {
+        return index_values(index, std::index_sequence_for<ValueIts...>{});
+    }
+    KeyValueIterator & operator++()
+    {
+        return *this += 1;
+    }
+    KeyValueIterator & operator+=(difference_type offset)
+    {
+        key += offset;
+        advance_values(offset, std::index_sequence_for<ValueIts...>{});
+        return *this;
+    }
+    KeyValueIterator operator+(difference_type offset) const
+    {
+        KeyValueIterator result = *this;
+        return result += offset;
+    }
+    difference_type operator-(const KeyValueIterator & other) const
+    {
+        return key - other.key;
+    }
+    bool operator==(const KeyValueIterator & other) const
+    {
+        return key == other.key;
+    }
+    bool operator!=(const KeyValueIterator & other) const
+    {
+        return key != other.key;
+    }
+
+private:
+    template<size_t... Indices>
+    reference index_values(difference_type index, std::index_sequence<Indices...>) const
+    {
+        return { key[index], std::tuple<typename std::iterator_traits<ValueIts>::reference...>(std::get<Indices>(values)[index]...) };
+    }
+    template<size_t... Indices>
+    void advance_values(difference_type offset, std::index_sequence<Indices...>)
+    {
+        int unused[] = { 0, (std::get<Indices>(values) += offset, 0)... };
+        static_cast<void>(unused);
+    }
 };
-template<>
-struct RadixSorter<unsigned char> : SizedRadixSorter<sizeof(unsigned char)>
+// calls extract_key once per element and stores the converted keys in an
+// array that gets sorted together with the elements. all passes only read
+// the keys from that array
+template<typename Key, typename It, typename OutIt, typename ExtractKey, typename Executor>
+bool cached_key_radix_sort_impl(It begin, It end, OutIt buffer_begin, ExtractKey & extract_key, Executor & executor, std::true_type)
 {
-};
-template<>
-struct RadixSorter<signed short> : SizedRadixSorter<sizeof(signed short)>
+    typedef typename CachedKey<Key>::type key_type;
+    std::ptrdiff_t num_elements = end - begin;
+    if (num_elements <= 1)
+        return false;
+    std::vector<key_type> keys;
+    keys.reserve(num_elements);
+    for (It it = begin; it != end; ++it)
+        keys.push_back(CachedKey<Key>::encode(extract_key(*it)));
+    std::vector<key_type> key_buffer(keys.size());
+    KeyValueIterator<key_type *, It> zip_begin = { keys.data(), std::make_tuple(begin) };
+    KeyValueIterator<key_type *, OutIt> zip_buffer = { key_buffer.data(), std::make_tuple(buffer_begin) };
+    return RadixSorter<const key_type &>::sort(zip_begin, zip_begin + num_elements, zip_buffer, [](const auto & reference) -> const key_type &
+    {
+        return reference.key;
+    }, executor);
+}
+// variable length keys would have to be copied into the cache, so for those
+// we call extract_key on every pass
+template<typename Key, typename It, typename OutIt, typename ExtractKey, typename Executor>
+bool cached_key_radix_sort_impl(It begin, It end, OutIt buffer_begin, ExtractKey & extract_key, Executor & executor, std::false_type)
+{
+    return RadixSorter<Key>::sort(begin, end, buffer_begin, extract_key, executor);
+}
+
+// compares keys in the same order that the radix sorts use. that is not
+// always the same as operator<, for example for NaNs or for -0.0 and 0.0
+template<typename T>
+struct RadixLess
 {
+    static bool less(const T & lhs, const T & rhs)
+    {
+        return to_unsigned(lhs) < to_unsigned(rhs);
+    }
 };
-template<>
-struct RadixSorter<unsigned short> : SizedRadixSorter<sizeof(unsigned short)>
+template<typename K, typename V>
+struct RadixLess<std::pair<K, V>>
 {
+    static bool less(const std::pair<K, V> & lhs, const std::pair<K, V> & rhs)
+    {
+        if (RadixLess<K>::less(lhs.first, rhs.first))
+            return true;
+        else if (RadixLess<K>::less(rhs.first, lhs.first))
+            return false;
+        else
+            return RadixLess<V>::less(lhs.second, rhs.second);
+    }
 };
-template<>
-struct RadixSorter<signed int> : SizedRadixSorter<sizeof(signed int)>
+template<size_t I, size_t S, typename Tuple>
+struct TupleRadixLess
 {
+    using ThisLess = RadixLess<typename std::tuple_element<I, Tuple>::type>;
+
+    static bool less(const Tuple & lhs, const Tuple & rhs)
+    {
+        if (ThisLess::less(std::get<I>(lhs), std::get<I>(rhs)))
+            return true;
+        else if (ThisLess::less(std::get<I>(rhs), std::get<I>(lhs)))
+            return false;
+        else
+            return TupleRadixLess<I + 1, S, Tuple>::less(lhs, rhs);
+    }
 };
-template<>
-struct RadixSorter<unsigned int> : SizedRadixSorter<sizeof(unsigned int)>
+template<size_t I, typename Tuple>
+struct TupleRadixLess<I, I, Tuple>
 {
+    static bool less(const Tuple &, const Tuple &)
+    {
+        return false;
+    }
 };
-template<>
-struct RadixSorter<signed long> : SizedRadixSorter<sizeof(signed long)>
+template<typename... Args>
+struct RadixLess<std::tuple<Args...>> : TupleRadixLess<0, sizeof...(Args), std::tuple<Args...>>
 {
 };
-template<>
-struct RadixSorter<unsigned long> : SizedRadixSorter<sizeof(unsigned long)>
+template<typename T, size_t S>
+struct RadixLess<std::array<T, S>>
 {
+    static bool less(const std::array<T, S> & lhs, const std::array<T, S> & rhs)
+    {
+        for (size_t i = 0; i < S; ++i)
+        {
+            if (RadixLess<T>::less(lhs[i], rhs[i]))
+                return true;
+            else if (RadixLess<T>::less(rhs[i], lhs[i]))
+                return false;
+        }
+        return false;
+    }
 };
-template<>
-struct RadixSorter<signed long long> : SizedRadixSorter<sizeof(signed long long)>
+template<typename T>
+struct RadixLess<radix_sort_descending_key<T>>
 {
+    static bool less(const radix_sort_descending_key<T> & lhs, const radix_sort_descending_key<T> & rhs)
+    {
+        return RadixLess<typename std::decay<T>::type>::less(rhs.key, lhs.key);
+    }
 };
-template<>
-struct RadixSorter<unsigned long long> : SizedRadixSorter<sizeof(unsigned long long)>
+template<typename T>
+struct RadixLess<T &> : RadixLess<typename std::decay<T>::type>
 {
 };
-template<>
-struct RadixSorter<float> : SizedRadixSorter<sizeof(float)>
+// variable length keys compare like VariableLengthRadixSorter sorts them
+template<typename KeyTraits, typename T>
+struct VariableLengthRadixLess
 {
+    static bool less(const T & lhs, const T & rhs)
+    {
+        return KeyTraits::less_from(lhs, rhs, 0);
+    }
 };
-template<>
-struct RadixSorter<double> : SizedRadixSorter<sizeof(double)>
+template<typename CharT, typename Traits, typename Allocator>
+struct RadixLess<std::basic_string<CharT, Traits, Allocator>> : VariableLengthRadixLess<SequenceKey<std::basic_string<CharT, Traits, Allocator>>, std::basic_string<CharT, Traits, Allocator>>
 {
 };
-template<>
-struct RadixSorter<char> : SizedRadixSorter<sizeof(char)>
+#ifdef RADIX_SORT_HAS_CPP17
+template<typename CharT, typename Traits>
+struct RadixLess<std::basic_string_view<CharT, Traits>> : VariableLengthRadixLess<SequenceKey<std::basic_string_view<CharT, Traits>>, std::basic_string_view<CharT, Traits>>
 {
 };
-template<>
-struct RadixSorter<wchar_t> : SizedRadixSorter<sizeof(wchar_t)>
+#endif
+template<typename T, typename Allocator>
+struct RadixLess<std::vector<T, Allocator>> : VariableLengthRadixLess<SequenceKey<std::vector<T, Allocator>>, std::vector<T, Allocator>>
 {
 };
 template<>
-struct RadixSorter<char16_t> : SizedRadixSorter<sizeof(char16_t)>
+struct RadixLess<const char *> : VariableLengthRadixLess<NullTerminatedKey, const char *>
 {
 };
 template<>
-struct RadixSorter<char32_t> : SizedRadixSorter<sizeof(char32_t)>
+struct RadixLess<char *> : VariableLengthRadixLess<NullTerminatedKey, const char *>
 {
 };
-template<typename K, typename V>
-struct RadixSorter<std::pair<K, V>>
+
+// below this many elements radix_sorter uses an insertion sort. radix_sort
+// clears and sums a histogram for every byte of the key, and for 64 uint64_t
+// that took 7x longer than the whole insertion sort
+static constexpr std::ptrdiff_t small_sort_threshold = 64;
+
+// stable, and it doesn't need a buffer
+template<typename Key, typename It, typename ExtractKey>
+void small_radix_sort(It begin, It end, ExtractKey & extract_key)
 {
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
+    if (begin == end)
+        return;
+    for (It it = std::next(begin); it != end; ++it)
     {
-        bool first_result = RadixSorter<V>::sort(begin, end, buffer_begin, [&](auto && o)
+        It previous = std::prev(it);
+        if (!RadixLess<Key>::less(extract_key(*it), extract_key(*previous)))
+            continue;
+        typename std::iterator_traits<It>::value_type to_insert = std::move(*it);
+        It hole = it;
+        do
         {
-            return extract_key(o).second;
-        });
-        auto extract_first = [&](auto && o)
-        {
-            return extract_key(o).first;
-        };
+            *hole = std::move(*previous);
+            hole = previous;
+        }
+        while (hole != begin && RadixLess<Key>::less(extract_key(to_insert), extract_key(*--previous)));
+        *hole = std::move(to_insert);
+    }
+}
 
-        if (first_result)
+// if the key was returned by reference, we can return references to its
+// members. otherwise the key is a temporary and we have to copy the member
+template<typename Key, typename Member>
+using member_key_t = typename std::conditional<std::is_lvalue_reference<Key>::value, const Member &, Member>::type;
+
+// below this size the in-place sort calls the fallback comparison sort
+static constexpr std::ptrdiff_t in_place_fallback_threshold = 128;
+// radix_select uses a branchless partition unless fewer than one in this
+// many elements go to one side
+static constexpr std::ptrdiff_t branchless_partition_min_fraction = 16;
+
+// the in-place sorters ask this before they sort a bucket, passing it the
+// fallback. a full sort needs every bucket, radix_select and
+// radix_partial_sort overload this to skip the ones that they don't need
+template<typename Fallback, typename It>
+bool in_place_wants_range(Fallback &, It, It)
+{
+    return true;
+}
+
+// the in-place sorters work most significant digit first. they sort their
+// part of the key, and then they call sort_next on every range of elements
+// whose part of the key is equal, so that the next component of a pair or
+// tuple can sort that range. small ranges are given to the fallback which
+// sorts them by the whole key
+template<size_t NumBytes>
+struct SizedInPlaceRadixSorter
+{
+    template<typename It, typename ExtractKey, typename SortNext, typename Fallback>
+    static void sort(It begin, It end, ExtractKey & extract_key, SortNext & sort_next, Fallback & fallback)
+    {
+        sort_from_byte(begin, end, extract_key, sort_next, fallback, NumBytes - 1);
+    }
+
+    template<typename It, typename ExtractKey, typename SortNext, typename Fallback>
+    static void sort_from_byte(It begin, It end, ExtractKey & extract_key, SortNext & sort_next, Fallback & fallback, size_t byte)
+    {
+        for (;;)
         {
-            return !RadixSorter<K>::sort(buffer_begin, buffer_begin + (end - begin), begin, extract_first);
+            std::ptrdiff_t num_elements = end - begin;
+            if (num_elements <= 1)
+                return;
+            else if (num_elements <= in_place_fallback_threshold)
+            {
+                fallback(begin, end);
+                return;
+            }
+            auto extract_digit = extract_radix_digit(extract_key, static_cast<unsigned>(byte * 8));
+            std::size_t counts[256] = {};
+            for (It it = begin; it != end; ++it)
+                ++counts[extract_digit(*it)];
+            if (!varying_bits_in_byte(counts, static_cast<std::size_t>(num_elements)))
+            {
+                // this byte is the same in all keys. look at the next one
+                if (byte == 0)
+                {
+                    sort_next(begin, end);
+                    return;
+                }
+                --byte;
+                continue;
+            }
+            std::size_t bucket_begins[256];
+            std::size_t bucket_ends[256];
+            compute_bucket_ranges(counts, bucket_begins, bucket_ends);
+            int first_wanted = 0;
+            int last_wanted = 255;
+            while (first_wanted < 255 && (!counts[first_wanted] || !in_place_wants_range(fallback, begin + static_cast<std::ptrdiff_t>(bucket_begins[first_wanted]), begin + static_cast<std::ptrdiff_t>(bucket_ends[first_wanted]))))
+                ++first_wanted;
+            while (last_wanted > first_wanted && (!counts[last_wanted] || !in_place_wants_range(fallback, begin + static_cast<std::ptrdiff_t>(bucket_begins[last_wanted]), begin + static_cast<std::ptrdiff_t>(bucket_ends[last_wanted]))))
+                --last_wanted;
+            if (bucket_begins[first_wanted] == 0 && bucket_ends[last_wanted] == static_cast<std::size_t>(num_elements))
+                american_flag_permute(begin, bucket_begins, bucket_ends, extract_digit);
+            else
+                permute_wanted_buckets(begin, counts, bucket_begins, bucket_ends, first_wanted, last_wanted, extract_digit, is_memcpyable<typename std::iterator_traits<It>::value_type>{});
+            for (int i = first_wanted; i <= last_wanted; ++i)
+            {
+                It bucket_begin = begin + static_cast<std::ptrdiff_t>(bucket_ends[i] - counts[i]);
+                It bucket_end = begin + static_cast<std::ptrdiff_t>(bucket_ends[i]);
+                if (counts[i] <= 1 || !in_place_wants_range(fallback, bucket_begin, bucket_end))
+                    continue;
+                else if (byte == 0)
+                    sort_next(bucket_begin, bucket_end);
+                else
+                    sort_from_byte(bucket_begin, bucket_end, extract_key, sort_next, fallback, byte - 1);
+            }
+            return;
         }
-        else
+    }
+
+    static void compute_bucket_ranges(const std::size_t * counts, std::size_t * bucket_begins, std::size_t * bucket_ends)
+    {
+        std::size_t total = 0;
+        for (int i = 0; i < 256; ++i)
         {
-            return RadixSorter<K>::sort(begin, end, buffer_begin, extract_first);
+            bucket_begins[i] = total;
+            total += counts[i];
+            bucket_ends[i] = total;
         }
     }
 
-    static constexpr size_t pass_count = RadixSorter<K>::pass_count + RadixSorter<V>::pass_count;
-};
-template<typename K, typename V>
-struct RadixSorter<const std::pair<K, V> &>
-{
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
+    // for radix_select and radix_partial_sort, which only need the buckets
+    // from first_wanted to last_wanted. the elements below and above those
+    // are split off with branchless partitions. they swap every element, but
+    // they don't mispredict on random keys like std::partition does, which
+    // made selecting the median of 10M random uint32_t 4x faster
+    template<typename It, typename ExtractDigit>
+    static void permute_wanted_buckets(It begin, std::size_t *, std::size_t * bucket_begins, const std::size_t * bucket_ends, int first_wanted, int last_wanted, ExtractDigit & extract_digit, std::true_type)
     {
-        bool first_result = RadixSorter<V>::sort(begin, end, buffer_begin, [&](auto && o) -> const V &
+        It wanted_begin = begin + static_cast<std::ptrdiff_t>(bucket_begins[first_wanted]);
+        It wanted_end = begin + static_cast<std::ptrdiff_t>(bucket_ends[last_wanted]);
+        It end = begin + static_cast<std::ptrdiff_t>(bucket_ends[255]);
+        if (wanted_begin != begin)
         {
-            return extract_key(o).second;
-        });
-        auto extract_first = [&](auto && o) -> const K &
+            partition(begin, wanted_begin, end, [&](auto && o)
+            {
+                return extract_digit(o) < first_wanted;
+            });
+        }
+        if (wanted_end != end)
         {
-            return extract_key(o).first;
-        };
-
-        if (first_result)
+            partition(wanted_begin, wanted_end, end, [&](auto && o)
+            {
+                return extract_digit(o) <= last_wanted;
+            });
+        }
+        if (first_wanted == last_wanted)
+            return;
+        // only the wanted buckets are left to permute
+        std::copy(bucket_ends, bucket_ends + first_wanted, bucket_begins);
+        std::copy(bucket_ends + last_wanted + 1, bucket_ends + 256, bucket_begins + last_wanted + 1);
+        american_flag_permute(begin, bucket_begins, bucket_ends, extract_digit);
+    }
+    // elements that can't be copied cheaply merge the buckets below and
+    // above the wanted ones into one bucket each, so that we don't move
+    // elements between buckets that we won't look at
+    template<typename It, typename ExtractDigit>
+    static void permute_wanted_buckets(It begin, std::size_t * counts, std::size_t * bucket_begins, std::size_t * bucket_ends, int first_wanted, int last_wanted, ExtractDigit & extract_digit, std::false_type)
+    {
+        std::size_t num_elements = bucket_ends[255];
+        int below = first_wanted - 1;
+        int above = last_wanted + 1;
+        if (below >= 0)
         {
-            return !RadixSorter<K>::sort(buffer_begin, buffer_begin + (end - begin), begin, extract_first);
+            std::fill(counts, counts + below, std::size_t(0));
+            counts[below] = bucket_begins[first_wanted];
         }
+        if (above <= 255)
+        {
+            counts[above] = num_elements - bucket_ends[last_wanted];
+            std::fill(counts + above + 1, counts + 256, std::size_t(0));
+        }
+        compute_bucket_ranges(counts, bucket_begins, bucket_ends);
+        auto extract_merged_digit = [&](auto && o) -> std::uint8_t
+        {
+            return static_cast<std::uint8_t>(std::min(std::max(static_cast<int>(extract_digit(o)), below), above));
+        };
+        american_flag_permute(begin, bucket_begins, bucket_ends, extract_merged_digit);
+    }
+    // moves the elements for which predicate is true to the front, ending at
+    // middle. if almost all elements go to one side std::partition predicts
+    // well and moves less, otherwise the branchless partition is faster
+    template<typename It, typename Predicate>
+    static void partition(It begin, It middle, It end, Predicate && predicate)
+    {
+        std::ptrdiff_t smaller_side = std::min(middle - begin, end - middle);
+        if (smaller_side * branchless_partition_min_fraction < end - begin)
+            std::partition(begin, end, predicate);
         else
+            branchless_partition(begin, end, predicate);
+    }
+    // swaps every element, either with itself or with the first element that
+    // goes to the back, so there is no branch that depends on the predicate
+    template<typename It, typename Predicate>
+    static void branchless_partition(It begin, It end, Predicate & predicate)
+    {
+        It out = begin;
+        for (It it = begin; it != end; ++it)
         {
-            return RadixSorter<K>::sort(begin, end, buffer_begin, extract_first);
+            bool to_front = predicate(*it);
+            typename std::iterator_traits<It>::value_type element = *it;
+            *it = *out;
+            *out = element;
+            out += static_cast<std::ptrdiff_t>(to_front);
         }
     }
 
-    static constexpr size_t pass_count = RadixSorter<K>::pass_count + RadixSorter<V>::pass_count;
+    // moves every element into its bucket by swapping it with whatever is at
+    // the next free position of its bucket. bucket_begins is used as the write
+    // position of each bucket and ends up equal to bucket_ends
+    template<typename It, typename ExtractDigit>
+    static void american_flag_permute(It begin, std::size_t * bucket_begins, const std::size_t * bucket_ends, ExtractDigit & extract_digit)
+    {
+        using std::swap;
+        for (int i = 0; i < 256; ++i)
+        {
+            while (bucket_begins[i] != bucket_ends[i])
+            {
+                It it = begin + static_cast<std::ptrdiff_t>(bucket_begins[i]);
+                std::uint8_t digit = extract_digit(*it);
+                if (digit == i)
+                    ++bucket_begins[i];
+                else
+                    swap(*it, begin[bucket_begins[digit]++]);
+            }
+        }
+    }
 };
-template<size_t I, size_t S, typename Tuple>
-struct TupleRadixSorter
-{
-    using NextSorter = TupleRadixSorter<I + 1, S, Tuple>;
-    using ThisSorter = RadixSorter<typename std::tuple_element<I, Tuple>::type>;
 
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It begin, It end, OutIt out_begin, OutIt out_end, ExtractKey && extract_key)
+template<typename T>
+struct InPlaceRadixSorter : SizedInPlaceRadixSorter<sizeof(decltype(to_unsigned(std::declval<T>())))>
+{
+};
+template<>
+struct InPlaceRadixSorter<bool>
+{
+    template<typename It, typename ExtractKey, typename SortNext, typename Fallback>
+    static void sort(It begin, It end, ExtractKey & extract_key, SortNext & sort_next, Fallback & fallback)
     {
-        bool which = NextSorter::sort(begin, end, out_begin, out_end, extract_key);
-        auto extract_i = [&](auto && o)
+        if (end - begin <= in_place_fallback_threshold)
         {
-            return std::get<I>(extract_key(o));
-        };
-        if (which)
-            return !ThisSorter::sort(out_begin, out_end, begin, extract_i);
-        else
-            return ThisSorter::sort(begin, end, out_begin, extract_i);
+            fallback(begin, end);
+            return;
+        }
+        It middle = std::partition(begin, end, [&](auto && o)
+        {
+            return !extract_key(o);
+        });
+        if (in_place_wants_range(fallback, begin, middle))
+            sort_next(begin, middle);
+        if (in_place_wants_range(fallback, middle, end))
+            sort_next(middle, end);
     }
-
-    static constexpr size_t pass_count = ThisSorter::pass_count + NextSorter::pass_count;
 };
-template<size_t I, size_t S, typename Tuple>
-struct TupleRadixSorter<I, S, const Tuple &>
+template<typename K, typename V>
+struct InPlaceRadixSorter<std::pair<K, V>>
 {
-    using NextSorter = TupleRadixSorter<I + 1, S, const Tuple &>;
-    using ThisSorter = RadixSorter<typename std::tuple_element<I, Tuple>::type>;
-
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It begin, It end, OutIt out_begin, OutIt out_end, ExtractKey && extract_key)
+    template<typename It, typename ExtractKey, typename SortNext, typename Fallback>
+    static void sort(It begin, It end, ExtractKey & extract_key, SortNext & sort_next, Fallback & fallback)
     {
-        bool which = NextSorter::sort(begin, end, out_begin, out_end, extract_key);
-        auto extract_i = [&](auto && o) -> decltype(auto)
+        auto extract_first = [&](auto && o) -> member_key_t<decltype(extract_key(o)), K>
         {
-            return std::get<I>(extract_key(o));
+            return extract_key(o).first;
         };
-        if (which)
-            return !ThisSorter::sort(out_begin, out_end, begin, extract_i);
-        else
-            return ThisSorter::sort(begin, end, out_begin, extract_i);
+        auto extract_second = [&](auto && o) -> member_key_t<decltype(extract_key(o)), V>
+        {
+            return extract_key(o).second;
+        };
+        auto sort_second = [&](It begin, It end)
+        {
+            InPlaceRadixSorter<V>::sort(begin, end, extract_second, sort_next, fallback);
+        };
+        InPlaceRadixSorter<K>::sort(begin, end, extract_first, sort_second, fallback);
     }
-
-    static constexpr size_t pass_count = ThisSorter::pass_count + NextSorter::pass_count;
 };
-template<size_t I, typename Tuple>
-struct TupleRadixSorter<I, I, Tuple>
+template<size_t I, size_t S, typename Tuple>
+struct TupleInPlaceRadixSorter
 {
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It, It, OutIt, OutIt, ExtractKey &&)
+    using Element = typename std::tuple_element<I, Tuple>::type;
+
+    template<typename It, typename ExtractKey, typename SortNext, typename Fallback>
+    static void sort(It begin, It end, ExtractKey & extract_key, SortNext & sort_next, Fallback & fallback)
     {
-        return false;
+        auto extract_i = [&](auto && o) -> member_key_t<decltype(extract_key(o)), Element>
+        {
+            return std::get<I>(extract_key(o));
+        };
+        auto sort_rest = [&](It begin, It end)
+        {
+            TupleInPlaceRadixSorter<I + 1, S, Tuple>::sort(begin, end, extract_key, sort_next, fallback);
+        };
+        InPlaceRadixSorter<Element>::sort(begin, end, extract_i, sort_rest, fallback);
     }
-
-    static constexpr size_t pass_count = 0;
 };
 template<size_t I, typename Tuple>
-struct TupleRadixSorter<I, I, const Tuple &>
+struct TupleInPlaceRadixSorter<I, I, Tuple>
 {
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It, It, OutIt, OutIt, ExtractKey &&)
+    template<typename It, typename ExtractKey, typename SortNext, typename Fallback>
+    static void sort(It begin, It end, ExtractKey &, SortNext & sort_next, Fallback &)
     {
-        return false;
+        sort_next(begin, end);
     }
-
-    static constexpr size_t pass_count = 0;
 };
-
 template<typename... Args>
-struct RadixSorter<std::tuple<Args...>>
+struct InPlaceRadixSorter<std::tuple<Args...>> : TupleInPlaceRadixSorter<0, sizeof...(Args), std::tuple<Args...>>
 {
-    using SorterImpl = TupleRadixSorter<0, sizeof...(Args), std::tuple<Args...>>;
-
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
+};
+template<typename T, size_t S>
+struct InPlaceRadixSorter<std::array<T, S>>
+{
+    template<typename It, typename ExtractKey, typename SortNext, typename Fallback>
+    static void sort(It begin, It end, ExtractKey & extract_key, SortNext & sort_next, Fallback & fallback)
     {
-        return SorterImpl::sort(begin, end, buffer_begin, buffer_begin + (end - begin), extract_key);
+        sort_from_index(begin, end, extract_key, sort_next, fallback, 0);
     }
 
-    static constexpr size_t pass_count = SorterImpl::pass_count;
+    template<typename It, typename ExtractKey, typename SortNext, typename Fallback>
+    static void sort_from_index(It begin, It end, ExtractKey & extract_key, SortNext & sort_next, Fallback & fallback, size_t index)
+    {
+        if (index == S)
+        {
+            sort_next(begin, end);
+            return;
+        }
+        auto extract_i = [&](auto && o) -> member_key_t<decltype(extract_key(o)), T>
+        {
+            return extract_key(o)[index];
+        };
+        auto sort_rest = [&](It begin, It end)
+        {
+            sort_from_index(begin, end, extract_key, sort_next, fallback, index + 1);
+        };
+        InPlaceRadixSorter<T>::sort(begin, end, extract_i, sort_rest, fallback);
+    }
 };
+template<typename Key, typename It, typename ExtractKey>
+void in_place_radix_sort_impl(It begin, It end, ExtractKey & extract_key)
+{
+    auto fallback = [&](It begin, It end)
+    {
+        std::sort(begin, end, [&](auto && lhs, auto && rhs)
+        {
+            return RadixLess<Key>::less(extract_key(lhs), extract_key(rhs));
+        });
+    };
+    auto done = [](It, It)
+    {
+    };
+    InPlaceRadixSorter<Key>::sort(begin, end, extract_key, done, fallback);
+}
 
-template<typename... Args>
-struct RadixSorter<const std::tuple<Args...> &>
+// radix_select and radix_partial_sort only need [first, last) to be sorted.
+// the in-place sorters skip the buckets that don't overlap that range, and
+// this sorts the part of a small range that does
+template<typename It, typename Less>
+struct PartialSortFallback
 {
-    using SorterImpl = TupleRadixSorter<0, sizeof...(Args), const std::tuple<Args...> &>;
+    It first;
+    It last;
+    Less & less;
 
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
+    void operator()(It begin, It end)
     {
-        return SorterImpl::sort(begin, end, buffer_begin, buffer_begin + (end - begin), extract_key);
+        It sorted_begin = std::max(begin, first);
+        It sorted_end = std::min(end, last);
+        if (sorted_begin != begin)
+            std::nth_element(begin, sorted_begin, end, less);
+        if (sorted_end == end)
+            std::sort(sorted_begin, end, less);
+        else
+            std::partial_sort(sorted_begin, sorted_end, end, less);
     }
-
-    static constexpr size_t pass_count = SorterImpl::pass_count;
 };
+template<typename It, typename Less>
+bool in_place_wants_range(PartialSortFallback<It, Less> & fallback, It begin, It end)
+{
+    return begin < fallback.last && fallback.first < end;
+}
+// when only a few of the smallest elements are wanted, a heap of those
+// rejects almost every other element with one comparison against its top,
+// while the radix sort has to read every element for every byte. on random
+// floats the heap was faster from about 250 elements per wanted element, 6x
+// faster for the top 1000 of 16M and still 3x faster for the top 1000 of 1M.
+// below about 100 per wanted element the radix sort was faster
+static constexpr std::ptrdiff_t partial_sort_heap_ratio = 256;
 
-template<typename T, size_t S>
-struct RadixSorter<std::array<T, S>>
+// std::partial_sort, except that the key of the top of the heap is only
+// extracted when the top changes. with std::partial_sort and the same
+// comparison this was up to 1.5x slower for floats, because every comparison
+// converted both keys
+template<typename Key, typename It, typename ExtractKey, typename Less>
+void heap_partial_sort(It begin, It last, It end, ExtractKey & extract_key, Less & less)
 {
-    template<typename It, typename OutIt, typename ExtractKey>
-    static bool sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
+    std::make_heap(begin, last, less);
+    for (It it = last; it != end; ++it)
     {
-        auto buffer_end = buffer_begin + (end - begin);
-        bool which = false;
-        for (size_t i = S; i > 0; --i)
+        Key top = extract_key(*begin);
+        for (; it != end && !RadixLess<Key>::less(extract_key(*it), top); ++it)
         {
-            auto extract_i = [&, i = i - 1](auto && o)
-            {
-                return extract_key(o)[i];
-            };
-            if (which)
-                which = !RadixSorter<T>::sort(buffer_begin, buffer_end, begin, extract_i);
-            else
-                which = RadixSorter<T>::sort(begin, end, buffer_begin, extract_i);
         }
-        return which;
+        if (it == end)
+            break;
+        std::pop_heap(begin, last, less);
+        std::iter_swap(std::prev(last), it);
+        std::push_heap(begin, last, less);
     }
+    std::sort_heap(begin, last, less);
+}
 
-    static constexpr size_t pass_count = RadixSorter<T>::pass_count * S;
-};
+template<typename Key, typename It, typename ExtractKey>
+void radix_partial_sort_impl(It begin, It first, It last, It end, ExtractKey & extract_key)
+{
+    if (first == last)
+        return;
+    auto less = [&](auto && lhs, auto && rhs)
+    {
+        return RadixLess<Key>::less(extract_key(lhs), extract_key(rhs));
+    };
+    if ((last - begin) * partial_sort_heap_ratio <= end - begin)
+    {
+        heap_partial_sort<Key>(begin, last, end, extract_key, less);
+        return;
+    }
+    PartialSortFallback<It, decltype(less)> fallback{ first, last, less };
+    auto done = [](It, It)
+    {
+    };
+    InPlaceRadixSorter<Key>::sort(begin, end, extract_key, done, fallback);
+}
 
-template<typename T>
-struct RadixSorter<T &> : RadixSorter<const T &>
+// the standard libraries only make the deque iterator depend on the
+// allocator through its pointer type, so this also matches deques with
+// other allocators that use plain pointers. deques with fancy pointers take
+// the generic path, which is slower but still correct
+template<typename It>
+struct is_deque_iterator
+    : std::is_same<It, typename std::deque<typename std::iterator_traits<It>::value_type>::iterator>
 {
 };
-template<typename T>
-struct RadixSorter<T &&> : RadixSorter<T>
+// ranges that the sorters can't index quickly. a std::deque has to look up
+// the block for every index, and a std::list can't be indexed at all
+template<typename It>
+struct sort_through_contiguous_copy
+    : std::integral_constant<bool, !std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<It>::iterator_category>::value
+                                   || is_deque_iterator<It>::value>
 {
 };
-template<typename T>
-struct RadixSorter<const T &> : RadixSorter<T>
+// moves the elements into an array, sorts them there and moves them back.
+// std::move walks a std::deque one block at a time, so for simple types both
+// moves are as fast as a memcpy of every block
+template<typename It, typename Sort>
+void sort_contiguous_copy(It begin, It end, Sort && sort, std::true_type)
+{
+    typedef typename std::iterator_traits<It>::value_type value_type;
+    std::size_t num_elements = static_cast<std::size_t>(std::distance(begin, end));
+    if (num_elements <= 1)
+        return;
+    std::unique_ptr<value_type[]> data(new value_type[num_elements]);
+    std::unique_ptr<value_type[]> buffer(new value_type[num_elements]);
+    std::move(begin, end, data.get());
+    if (sort(data.get(), data.get() + num_elements, buffer.get()))
+        std::move(buffer.get(), buffer.get() + num_elements, begin);
+    else
+        std::move(data.get(), data.get() + num_elements, begin);
+}
+// elements that can't be default constructed only have to be move
+// constructible. the buffer is move constructed from the elements that are
+// left behind in the range, which are still valid objects
+template<typename It, typename Sort>
+void sort_contiguous_copy(It begin, It end, Sort && sort, std::false_type)
+{
+    typedef typename std::iterator_traits<It>::value_type value_type;
+    if (begin == end || std::next(begin) == end)
+        return;
+    std::vector<value_type> data(std::make_move_iterator(begin), std::make_move_iterator(end));
+    std::vector<value_type> buffer(std::make_move_iterator(begin), std::make_move_iterator(end));
+    if (sort(data.data(), data.data() + data.size(), buffer.data()))
+        std::move(buffer.begin(), buffer.end(), begin);
+    else
+        std::move(data.begin(), data.end(), begin);
+}
+template<typename It, typename Sort>
+void sort_contiguous_copy(It begin, It end, Sort && sort)
+{
+    sort_contiguous_copy(begin, end, sort, std::is_default_constructible<typename std::iterator_traits<It>::value_type>{});
+}
+
+template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+bool serial_radix_sort(It begin, It end, OutIt buffer_begin, ExtractKey & extract_key, Executor & executor, std::false_type)
+{
+    return RadixSorter<typename std::result_of<ExtractKey(decltype(*begin))>::type>::sort(begin, end, buffer_begin, extract_key, executor);
+}
+template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+bool serial_radix_sort(It begin, It end, OutIt, ExtractKey & extract_key, Executor & executor, std::true_type)
+{
+    sort_contiguous_copy(begin, end, [&](auto begin, auto end, auto buffer_begin)
+    {
+        return serial_radix_sort(begin, end, buffer_begin, extract_key, executor, std::false_type{});
+    });
+    return false;
+}
+
+template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+void serial_radix_sort_in_input(It begin, It end, OutIt buffer_begin, ExtractKey & extract_key, Executor & executor, std::false_type)
+{
+    set_wanted_placement(executor, ResultPlacement::in_input);
+    if (serial_radix_sort(begin, end, buffer_begin, extract_key, executor, std::false_type{}))
+        std::move(buffer_begin, buffer_begin + (end - begin), begin);
+}
+template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+void serial_radix_sort_in_input(It begin, It end, OutIt, ExtractKey & extract_key, Executor & executor, std::true_type)
+{
+    sort_contiguous_copy(begin, end, [&](auto begin, auto end, auto buffer_begin)
+    {
+        serial_radix_sort_in_input(begin, end, buffer_begin, extract_key, executor, std::false_type{});
+        return false;
+    });
+}
+
+// the scatter through KeyValueIterator writes every column to 256 places at
+// once, so it can't combine writes. once the columns are bigger than the
+// cache, every pass scatters one column at a time instead, with write
+// combining, straight into the buffers of the columns. the destinations come
+// from the key column: the value columns are scattered first, each one
+// taking its digits from the keys at the same positions, and then the keys
+// themselves. that reads the keys once more for every column of values, but
+// all of those reads are sequential. this needs keys that to_unsigned
+// converts, and columns that can be written with memcpy. measured with a
+// column of uint32_t keys and one of uint32_t values: below 2 MB of keys,
+// where the key column doesn't get write combining, the scatter through
+// KeyValueIterator is faster. from there on this is about twice as fast, and
+// as fast as packing the columns into a temporary array of rows
+template<typename T, typename = void>
+struct has_to_unsigned : std::false_type
 {
 };
 template<typename T>
-struct RadixSorter<const T &&> : RadixSorter<T>
+struct has_to_unsigned<T, decltype(static_cast<void>(to_unsigned(std::declval<T>())))> : std::true_type
 {
 };
-template<typename T>
-struct RadixSorter : RadixSorter<decltype(to_unsigned(std::declval<T>()))>
+template<bool... Values>
+struct all_of_bools : std::is_same<std::integer_sequence<bool, true, Values...>, std::integer_sequence<bool, Values..., true>>
+{
+};
+template<typename KeyIt, typename KeyOutIt, typename ValueIts, typename ValueOutIts>
+struct sort_by_key_scatters_columns;
+template<typename KeyIt, typename KeyOutIt, typename... ValueIts, typename... ValueOutIts>
+struct sort_by_key_scatters_columns<KeyIt, KeyOutIt, std::tuple<ValueIts...>, std::tuple<ValueOutIts...>>
+    : std::integral_constant<bool, has_to_unsigned<typename std::iterator_traits<KeyIt>::value_type>::value
+                                   && can_write_combine<KeyIt, KeyOutIt>::value
+                                   && all_of_bools<can_write_combine<ValueIts, ValueOutIts>::value...>::value>
 {
 };
 
-template<typename T>
-size_t radix_sort_pass_count = RadixSorter<T>::pass_count;
+template<typename KeyIt, typename... ValueIts, typename KeyOutIt, typename... ValueOutIts, typename count_type, size_t... Indices>
+void scatter_columns(KeyValueIterator<KeyIt, ValueIts...> begin, std::ptrdiff_t num_elements, KeyValueIterator<KeyOutIt, ValueOutIts...> out_begin, count_type * offsets, unsigned shift, std::index_sequence<Indices...>)
+{
+    typedef typename std::iterator_traits<KeyIt>::value_type key_type;
+    auto key_digit = [shift](const key_type & key)
+    {
+        return radix_digit(widen_key(to_unsigned(key)), shift);
+    };
+    auto scatter_values = [&](auto values, auto out_values)
+    {
+        typedef typename std::iterator_traits<decltype(values)>::value_type value_type;
+        count_type value_offsets[256];
+        std::copy(offsets, offsets + 256, value_offsets);
+        const value_type * first_value = &*values;
+        auto value_digit = [&](const value_type & value)
+        {
+            return key_digit(begin.key[&value - first_value]);
+        };
+        radix_scatter(values, values + num_elements, out_values, value_offsets, value_digit, choose_scatter_mode<decltype(values), decltype(out_values)>(num_elements));
+    };
+    int unused[] = { 0, (scatter_values(std::get<Indices>(begin.values), std::get<Indices>(out_begin.values)), 0)... };
+    static_cast<void>(unused);
+    radix_scatter(begin.key, begin.key + num_elements, out_begin.key, offsets, key_digit, choose_scatter_mode<KeyIt, KeyOutIt>(num_elements));
+}
+template<typename KeyIt, typename... ValueIts, typename KeyOutIt, typename... ValueOutIts, size_t... Indices>
+void move_columns(KeyValueIterator<KeyIt, ValueIts...> begin, std::ptrdiff_t num_elements, KeyValueIterator<KeyOutIt, ValueOutIts...> out_begin, std::index_sequence<Indices...>)
+{
+    std::move(begin.key, begin.key + num_elements, out_begin.key);
+    int unused[] = { 0, (std::move(std::get<Indices>(begin.values), std::get<Indices>(begin.values) + num_elements, std::get<Indices>(out_begin.values)), 0)... };
+    static_cast<void>(unused);
+}
+
+template<typename KeyIt, typename... ValueIts, typename KeyOutIt, typename... ValueOutIts, typename Executor>
+void radix_sort_by_key_impl(KeyValueIterator<KeyIt, ValueIts...> begin, KeyValueIterator<KeyIt, ValueIts...> end, KeyValueIterator<KeyOutIt, ValueOutIts...> buffer_begin, Executor & executor, std::false_type)
+{
+    typedef typename std::iterator_traits<KeyIt>::value_type key_type;
+    auto extract_key = [](const auto & reference) -> const key_type &
+    {
+        return reference.key;
+    };
+    serial_radix_sort_in_input(begin, end, buffer_begin, extract_key, executor, std::false_type{});
+}
+template<typename KeyIt, typename... ValueIts, typename KeyOutIt, typename... ValueOutIts, typename Executor>
+void radix_sort_by_key_impl(KeyValueIterator<KeyIt, ValueIts...> begin, KeyValueIterator<KeyIt, ValueIts...> end, KeyValueIterator<KeyOutIt, ValueOutIts...> buffer_begin, Executor & executor, std::true_type)
+{
+    typedef typename std::iterator_traits<KeyIt>::value_type key_type;
+    static constexpr size_t NumBytes = sizeof(decltype(to_unsigned(std::declval<const key_type &>())));
+    std::ptrdiff_t num_elements = end - begin;
+    if (range_bytes(begin.key, end.key) < write_combining_threshold)
+    {
+        radix_sort_by_key_impl(begin, end, buffer_begin, executor, std::false_type{});
+        return;
+    }
+    std::size_t counts[NumBytes][256] = {};
+    auto identity = [](const key_type & key) -> const key_type &
+    {
+        return key;
+    };
+    count_key_bytes<NumBytes, std::size_t>(begin.key, end.key, counts, identity);
+    observe_constant_bytes(executor, counts, static_cast<std::size_t>(num_elements));
+    RadixPassPlan<NumBytes> plan = plan_radix_passes<NumBytes>(counts, static_cast<std::size_t>(num_elements));
+    if (!plan.byte_aligned)
+    {
+        for (size_t pass = 0; pass < plan.num_passes; ++pass)
+            std::fill(std::begin(counts[pass]), std::end(counts[pass]), std::size_t());
+        for (KeyIt it = begin.key; it != end.key; ++it)
+        {
+            auto key = widen_key(to_unsigned(*it));
+            for (size_t pass = 0; pass < plan.num_passes; ++pass)
+                ++counts[pass][(key >> plan.shifts[pass]) & 0xff];
+        }
+    }
+    bool in_buffer = false;
+    for (size_t pass = 0; pass < plan.num_passes; ++pass)
+    {
+        std::size_t * pass_counts = plan.byte_aligned ? counts[plan.shifts[pass] / 8] : counts[pass];
+        auto observation = begin_observed_pass(executor, plan.shifts[pass] / 8, 8, pass_counts, 256, num_elements);
+        counts_to_offsets(pass_counts);
+        if (in_buffer)
+            scatter_columns(buffer_begin, num_elements, begin, pass_counts, plan.shifts[pass], std::index_sequence_for<ValueIts...>{});
+        else
+            scatter_columns(begin, num_elements, buffer_begin, pass_counts, plan.shifts[pass], std::index_sequence_for<ValueIts...>{});
+        end_observed_pass(executor, observation, static_cast<std::size_t>(num_elements) * sizeof(typename KeyValueIterator<KeyIt, ValueIts...>::value_type));
+        in_buffer = !in_buffer;
+    }
+    if (in_buffer)
+        move_columns(buffer_begin, num_elements, begin, std::index_sequence_for<ValueIts...>{});
+}
 }
 
 template<typename It, typename OutIt, typename ExtractKey>
@@ -701,33 +4031,469 @@ void counting_sort(It begin, It end, OutIt out_begin)
     detail::counting_sort_impl(begin, end, out_begin, [](auto && a){ return to_unsigned(a); });
 }
 
+// sorts [begin, end) using the buffer, which has to be as big as the input.
+// returns true if the result is in the buffer and false if it is in the
+// input. a std::deque or a range that isn't random access, like a std::list,
+// gets moved into contiguous memory, sorted there and moved back. for those
+// the result is always in the input and buffer_begin is never used, so it
+// can be any iterator, for example begin
 template<typename It, typename OutIt, typename ExtractKey>
 bool radix_sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
 {
-    return detail::RadixSorter<typename std::result_of<ExtractKey(decltype(*begin))>::type>::sort(begin, end, buffer_begin, extract_key);
+    detail::SerialExecutor executor;
+    return detail::serial_radix_sort(begin, end, buffer_begin, extract_key, executor, detail::sort_through_contiguous_copy<It>{});
 }
 template<typename It, typename OutIt>
 bool radix_sort(It begin, It end, OutIt buffer_begin)
 {
-    return detail::RadixSorter<decltype(*begin)>::sort(begin, end, buffer_begin, [](auto && a) -> decltype(*begin){ return a; });
+    return radix_sort(begin, end, buffer_begin, [](auto && a) -> decltype(*begin){ return a; });
 }
+// same as radix_sort, but with a fixed digit width for keys of two or more
+// bytes. the other keys and the parts of composite keys that are not sorted
+// by SizedRadixSorter always use 8 bit digits
 template<typename It, typename OutIt, typename ExtractKey>
-bool linear_sort(It begin, It end, OutIt buffer_begin, ExtractKey && key)
+bool radix_sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, radix_sort_digits digits)
 {
-    std::ptrdiff_t num_elements = end - begin;
-    if (num_elements <= 512 || detail::radix_sort_pass_count<typename std::result_of<ExtractKey(decltype(*begin))>::type> > 10)
+    detail::SerialExecutor executor;
+    executor.digits = digits;
+    return detail::serial_radix_sort(begin, end, buffer_begin, extract_key, executor, detail::sort_through_contiguous_copy<It>{});
+}
+// makes the key or a part of a composite key descending. wrapping a pair,
+// tuple or std::array makes all of its components descending. see
+// radix_sort_descending_key
+template<typename T>
+auto radix_sort_descending(T && key)
+{
+    return detail::DescendingKey<typename std::decay<T>::type>::make(std::forward<T>(key));
+}
+#ifdef RADIX_SORT_HAS_CPP17
+// sorts the empty optionals after all the values. see
+// radix_sort_nulls_last_key
+template<typename T>
+radix_sort_nulls_last_key<T> radix_sort_nulls_last(const std::optional<T> & key)
+{
+    return { key };
+}
+#endif
+// sorts the whole key in the given order. a descending sort is stable, too,
+// so equal keys stay in the order that they had in the input
+template<typename It, typename OutIt, typename ExtractKey>
+bool radix_sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, radix_sort_order order)
+{
+    if (order == radix_sort_order::ascending)
+        return radix_sort(begin, end, buffer_begin, extract_key);
+    return radix_sort(begin, end, buffer_begin, [&](auto && o)
+    {
+        return radix_sort_descending(extract_key(o));
+    });
+}
+// same as radix_sort, but the result is always in [begin, end). the sort
+// plans for that before the first pass: if the key has an odd number of
+// digits, the counting read also moves the elements into the buffer, and
+// the passes start from there. that is cheaper than moving the result back
+// afterwards, which only happens for keys where the number of passes isn't
+// known up front, like strings. the buffer still has to be as big as the
+// input, and its contents are unspecified afterwards
+template<typename It, typename OutIt, typename ExtractKey>
+void radix_sort_in_input(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
+{
+    detail::SerialExecutor executor;
+    detail::serial_radix_sort_in_input(begin, end, buffer_begin, extract_key, executor, detail::sort_through_contiguous_copy<It>{});
+}
+template<typename It, typename OutIt>
+void radix_sort_in_input(It begin, It end, OutIt buffer_begin)
+{
+    radix_sort_in_input(begin, end, buffer_begin, [](auto && a) -> decltype(*begin){ return a; });
+}
+// parallel version. every pass is split over the threads of the thread pool.
+// the pool can be a radix_sort_thread_pool or any type that has the same
+// num_threads() and parallel_for() member functions. the result is the same
+// as for the single threaded version, including stability
+template<typename It, typename OutIt, typename ExtractKey, typename ThreadPool>
+typename std::enable_if<!std::is_arithmetic<ThreadPool>::value && !std::is_enum<ThreadPool>::value && !detail::is_radix_sort_observer<ThreadPool>::value, bool>::type
+radix_sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, ThreadPool & thread_pool)
+{
+    return detail::RadixSorter<typename std::result_of<ExtractKey(decltype(*begin))>::type>::sort(begin, end, buffer_begin, extract_key, thread_pool);
+}
+// single threaded version that reports every pass to the observer. see
+// radix_sort_null_observer for the member functions that an observer needs
+template<typename It, typename OutIt, typename ExtractKey, typename Observer>
+typename std::enable_if<detail::is_radix_sort_observer<Observer>::value, bool>::type
+radix_sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, Observer & observer)
+{
+    auto executor = detail::make_observed_executor(observer);
+    return detail::serial_radix_sort(begin, end, buffer_begin, extract_key, executor, detail::sort_through_contiguous_copy<It>{});
+}
+template<typename It, typename OutIt, typename ExtractKey>
+bool radix_sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key, std::size_t num_threads)
+{
+    if (num_threads <= 1 || end - begin < detail::parallel_sort_threshold)
+        return radix_sort(begin, end, buffer_begin, std::forward<ExtractKey>(extract_key));
+    radix_sort_thread_pool thread_pool(num_threads);
+    return radix_sort(begin, end, buffer_begin, std::forward<ExtractKey>(extract_key), thread_pool);
+}
+// sorts the keys together with the index of their element, then moves each
+// element into the buffer once. use this instead of radix_sort if the
+// elements are big compared to their keys. it's stable and the result is
+// always in the buffer, so it returns true unless there was nothing to sort
+template<typename It, typename OutIt, typename ExtractKey>
+bool indirect_radix_sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
+{
+    detail::SerialExecutor executor;
+    return detail::indirect_radix_sort_impl<typename std::decay<typename std::result_of<ExtractKey(decltype(*begin))>::type>::type>(begin, end, buffer_begin, extract_key, executor);
+}
+template<typename It, typename OutIt>
+bool indirect_radix_sort(It begin, It end, OutIt buffer_begin)
+{
+    return indirect_radix_sort(begin, end, buffer_begin, [](auto && a) -> decltype(*begin){ return a; });
+}
+
+// same result as radix_sort, but calls extract_key only once per element.
+// the converted keys are stored in a temporary array that gets sorted along
+// with the elements. use this if extract_key is expensive, for example if it
+// has to follow a pointer. needs memory for two arrays of keys
+template<typename It, typename OutIt, typename ExtractKey>
+bool cached_key_radix_sort(It begin, It end, OutIt buffer_begin, ExtractKey && extract_key)
+{
+    typedef typename std::decay<typename std::result_of<ExtractKey(decltype(*begin))>::type>::type key_type;
+    detail::SerialExecutor executor;
+    return detail::cached_key_radix_sort_impl<key_type>(begin, end, buffer_begin, extract_key, executor, detail::is_memcpyable<typename detail::CachedKey<key_type>::type>{});
+}
+
+// sorts columns of values by a column of keys, so that the values at each
+// position stay with their key. values_begins has the start of every column
+// of values, and value_buffers has a buffer for every column in the same
+// order. only the keys are read to count, and every pass moves each key and
+// its values to the same position in their buffers. big inputs of columns
+// of simple types get scattered one column at a time instead, see
+// sort_by_key_scatters_columns. it's stable, supports the same keys as
+// radix_sort and the result is always in the input columns. the buffers have
+// to be as big as the columns, and their contents are unspecified afterwards
+template<typename KeyIt, typename... ValueIts, typename KeyOutIt, typename... ValueOutIts>
+void radix_sort_by_key(KeyIt keys_begin, KeyIt keys_end, std::tuple<ValueIts...> values_begins, KeyOutIt key_buffer, std::tuple<ValueOutIts...> value_buffers)
+{
+    static_assert(sizeof...(ValueIts) == sizeof...(ValueOutIts), "every column of values needs a buffer");
+    detail::KeyValueIterator<KeyIt, ValueIts...> zip_begin = { keys_begin, values_begins };
+    detail::KeyValueIterator<KeyOutIt, ValueOutIts...> zip_buffer = { key_buffer, value_buffers };
+    detail::SerialExecutor executor;
+    detail::radix_sort_by_key_impl(zip_begin, zip_begin + (keys_end - keys_begin), zip_buffer, executor, detail::sort_by_key_scatters_columns<KeyIt, KeyOutIt, std::tuple<ValueIts...>, std::tuple<ValueOutIts...>>{});
+}
+// same for a single column of values
+template<typename KeyIt, typename ValueIt, typename KeyOutIt, typename ValueOutIt>
+void radix_sort_by_key(KeyIt keys_begin, KeyIt keys_end, ValueIt values_begin, KeyOutIt key_buffer, ValueOutIt value_buffer)
+{
+    radix_sort_by_key(keys_begin, keys_end, std::make_tuple(values_begin), key_buffer, std::make_tuple(value_buffer));
+}
+
+// writes the positions of the elements in sorted order to index_out, so the
+// first index is the position of the smallest element. the elements don't
+// get moved. it's stable, supports the same keys as radix_sort and returns
+// the end of the indices. the sort uses uint32_t indices if there are fewer
+// than 2^32 elements and uint64_t indices otherwise, and it packs keys of up
+// to four bytes together with the index into a uint64_t. use
+// apply_permutation to sort columns with the indices
+template<typename It, typename IndexOutIt, typename ExtractKey>
+IndexOutIt radix_argsort(It begin, It end, IndexOutIt index_out, ExtractKey && extract_key)
+{
+    detail::SerialExecutor executor;
+    return detail::radix_argsort_impl<typename std::decay<typename std::result_of<ExtractKey(decltype(*begin))>::type>::type>(begin, end, index_out, extract_key, executor);
+}
+template<typename It, typename IndexOutIt>
+IndexOutIt radix_argsort(It begin, It end, IndexOutIt index_out)
+{
+    return radix_argsort(begin, end, index_out, [](auto && a) -> decltype(*begin){ return a; });
+}
+
+// copies the elements of the columns in the order of the permutation, so
+// that position i of every output gets the element at position
+// permutation_begin[i] of its column. with the indices from radix_argsort
+// this sorts the columns. columns and outs have the start of every column
+// and of its output, in the same order. the outputs can't overlap the columns
+template<typename IndexIt, typename... Its, typename... OutIts>
+void apply_permutation(IndexIt permutation_begin, IndexIt permutation_end, std::tuple<Its...> columns, std::tuple<OutIts...> outs)
+{
+    static_assert(sizeof...(Its) == sizeof...(OutIts), "every column needs an output");
+    detail::gather_columns(permutation_begin, permutation_end, columns, outs, std::index_sequence_for<Its...>{});
+}
+// same for a single column. returns the end of the output
+template<typename IndexIt, typename It, typename OutIt>
+OutIt apply_permutation(IndexIt permutation_begin, IndexIt permutation_end, It column, OutIt out)
+{
+    return detail::gather_column(permutation_begin, permutation_end, column, out);
+}
+// the opposite of apply_permutation: copies the element at position i of
+// every column to position permutation_begin[i] of its output. that undoes
+// apply_permutation with the same permutation
+template<typename IndexIt, typename... Its, typename... OutIts>
+void apply_inverse_permutation(IndexIt permutation_begin, IndexIt permutation_end, std::tuple<Its...> columns, std::tuple<OutIts...> outs)
+{
+    static_assert(sizeof...(Its) == sizeof...(OutIts), "every column needs an output");
+    detail::scatter_columns(permutation_begin, permutation_end, columns, outs, std::index_sequence_for<Its...>{});
+}
+template<typename IndexIt, typename It, typename OutIt>
+void apply_inverse_permutation(IndexIt permutation_begin, IndexIt permutation_end, It column, OutIt out)
+{
+    detail::scatter_column(permutation_begin, permutation_end, column, out);
+}
+
+namespace detail
+{
+// the radix sort that linear_sort uses when it doesn't use std::sort.
+// radix_sort_calibrate measures this against std::sort
+template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+bool linear_radix_sort(It begin, It end, OutIt buffer_begin, ExtractKey && key, Executor & executor)
+{
+    typedef typename std::result_of<ExtractKey(decltype(*begin))>::type key_type;
+    if (prefer_indirect_sort<typename std::iterator_traits<It>::value_type, typename std::decay<key_type>::type>::value)
+        return indirect_radix_sort_impl<typename std::decay<key_type>::type>(begin, end, buffer_begin, key, executor);
+    else
+        return RadixSorter<key_type>::sort(begin, end, buffer_begin, key, executor);
+}
+
+template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+bool linear_sort_impl(It begin, It end, OutIt buffer_begin, ExtractKey & key, Executor & executor)
+{
+    typedef typename std::result_of<ExtractKey(decltype(*begin))>::type key_type;
+    typedef typename std::iterator_traits<It>::value_type value_type;
+    linear_sort_info info;
+    info.num_elements = static_cast<std::size_t>(end - begin);
+    info.element_size = sizeof(value_type);
+    info.pass_count = RadixSorter<key_type>::pass_count;
+    info.threshold = linear_sort_threshold<value_type, key_type>();
+    if (end - begin < info.threshold)
     {
-        std::sort(begin, end, [key = std::forward<ExtractKey>(key)](auto && lhs, auto && rhs)
+        info.path = linear_sort_path::std_sort;
+        info.reason = info.threshold == linear_sort_never ? linear_sort_reason::too_many_passes : linear_sort_reason::few_elements;
+        observe_linear_sort(executor, info);
+        std::sort(begin, end, [&key](auto && lhs, auto && rhs)
         {
             return key(lhs) < key(rhs);
         });
         return false;
     }
+    else if (prefer_indirect_sort<value_type, typename std::decay<key_type>::type>::value)
+    {
+        info.path = linear_sort_path::indirect_radix_sort;
+        info.reason = linear_sort_reason::big_elements;
+    }
     else
-        return radix_sort(begin, end, buffer_begin, std::forward<ExtractKey>(key));
+    {
+        info.path = linear_sort_path::radix_sort;
+        info.reason = linear_sort_reason::many_elements;
+    }
+    observe_linear_sort(executor, info);
+    return linear_radix_sort(begin, end, buffer_begin, key, executor);
+}
+template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+bool serial_linear_sort(It begin, It end, OutIt buffer_begin, ExtractKey & key, Executor & executor, std::false_type)
+{
+    return linear_sort_impl(begin, end, buffer_begin, key, executor);
+}
+template<typename It, typename OutIt, typename ExtractKey, typename Executor>
+bool serial_linear_sort(It begin, It end, OutIt, ExtractKey & key, Executor & executor, std::true_type)
+{
+    sort_contiguous_copy(begin, end, [&](auto begin, auto end, auto buffer_begin)
+    {
+        return linear_sort_impl(begin, end, buffer_begin, key, executor);
+    });
+    return false;
+}
+}
+
+template<typename It, typename OutIt, typename ExtractKey>
+bool linear_sort(It begin, It end, OutIt buffer_begin, ExtractKey && key)
+{
+    detail::SerialExecutor executor;
+    return detail::serial_linear_sort(begin, end, buffer_begin, key, executor, detail::sort_through_contiguous_copy<It>{});
+}
+// reports which sort linear_sort picked and why to the observer, and if that
+// was a radix sort, every one of its passes
+template<typename It, typename OutIt, typename ExtractKey, typename Observer>
+typename std::enable_if<detail::is_radix_sort_observer<Observer>::value, bool>::type
+linear_sort(It begin, It end, OutIt buffer_begin, ExtractKey && key, Observer & observer)
+{
+    auto executor = detail::make_observed_executor(observer);
+    return detail::serial_linear_sort(begin, end, buffer_begin, key, executor, detail::sort_through_contiguous_copy<It>{});
+}
+template<typename It, typename OutIt, typename ExtractKey>
+bool linear_sort(It begin, It end, OutIt buffer_begin, ExtractKey && key, radix_sort_order order)
+{
+    if (order == radix_sort_order::ascending)
+        return linear_sort(begin, end, buffer_begin, key);
+    return linear_sort(begin, end, buffer_begin, [&](auto && o)
+    {
+        return radix_sort_descending(key(o));
+    });
 }
 template<typename It, typename OutIt>
 bool linear_sort(It begin, It end, OutIt buffer_begin)
 {
     return linear_sort(begin, end, buffer_begin, [](auto && a) -> decltype(*begin){ return a; });
 }
+
+// an unstable sort that works in place, so unlike radix_sort it doesn't need
+// a buffer. it sorts one byte at a time starting with the most significant
+// byte, moving elements into their buckets by swapping them in the style of
+// american flag sort. it supports the same keys as radix_sort
+template<typename It, typename ExtractKey>
+void in_place_radix_sort(It begin, It end, ExtractKey && extract_key)
+{
+    detail::in_place_radix_sort_impl<typename std::decay<typename std::result_of<ExtractKey(decltype(*begin))>::type>::type>(begin, end, extract_key);
+}
+template<typename It>
+void in_place_radix_sort(It begin, It end)
+{
+    in_place_radix_sort(begin, end, [](auto && a) -> decltype(*begin){ return a; });
+}
+
+// like std::nth_element: afterwards the element at nth is the one that would
+// be there if the range was sorted, no element before it is bigger and no
+// element after it is smaller. it works like in_place_radix_sort, but at
+// every byte it only continues into the bucket that contains nth. it supports
+// the same keys as in_place_radix_sort. for the biggest elements instead of
+// the smallest, wrap the key in radix_sort_descending
+template<typename It, typename ExtractKey>
+void radix_select(It begin, It nth, It end, ExtractKey && extract_key)
+{
+    if (nth == end)
+        return;
+    detail::radix_partial_sort_impl<typename std::decay<typename std::result_of<ExtractKey(decltype(*begin))>::type>::type>(begin, nth, std::next(nth), end, extract_key);
+}
+template<typename It>
+void radix_select(It begin, It nth, It end)
+{
+    radix_select(begin, nth, end, [](auto && a) -> decltype(*begin){ return a; });
+}
+// like std::partial_sort: afterwards [begin, middle) holds the smallest
+// elements in sorted order, and the rest of the range is in no particular
+// order. only the buckets that overlap [begin, middle) are sorted
+template<typename It, typename ExtractKey>
+void radix_partial_sort(It begin, It middle, It end, ExtractKey && extract_key)
+{
+    detail::radix_partial_sort_impl<typename std::decay<typename std::result_of<ExtractKey(decltype(*begin))>::type>::type>(begin, begin, middle, end, extract_key);
+}
+template<typename It>
+void radix_partial_sort(It begin, It middle, It end)
+{
+    radix_partial_sort(begin, middle, end, [](auto && a) -> decltype(*begin){ return a; });
+}
+
+// sorts many ranges one after the other without allocating a buffer for
+// every one of them. the buffer is kept between calls and only grows, and
+// it's allocated with the given allocator. ranges of up to 64 elements are
+// sorted with an insertion sort and don't need the buffer. the sorted result
+// is always in the range that was passed in
+template<typename T, typename Allocator = std::allocator<T>>
+class radix_sorter
+{
+public:
+    radix_sorter() = default;
+    explicit radix_sorter(const Allocator & allocator)
+        : buffer(allocator)
+    {
+    }
+
+    template<typename It, typename ExtractKey>
+    void sort(It begin, It end, ExtractKey && extract_key)
+    {
+        sort_range(begin, end, extract_key, detail::sort_through_contiguous_copy<It>{});
+    }
+    template<typename It>
+    void sort(It begin, It end)
+    {
+        sort(begin, end, [](auto && a) -> decltype(*begin){ return a; });
+    }
+    // if the result ends up in the buffer, the buffer is swapped with data
+    // instead of moving every element back. that's only done if the storage
+    // of data is at least as big as the buffer, so that the buffer never
+    // shrinks, and if the allocators are equal or propagate on swap.
+    // otherwise the elements are moved back and data keeps its storage
+    template<typename ExtractKey>
+    void sort(std::vector<T, Allocator> & data, ExtractKey && extract_key)
+    {
+        typedef typename std::decay<typename std::result_of<ExtractKey(T &)>::type>::type key_type;
+        if (static_cast<std::ptrdiff_t>(data.size()) <= detail::small_sort_threshold)
+        {
+            detail::small_radix_sort<key_type>(data.begin(), data.end(), extract_key);
+            return;
+        }
+        reserve(data.size());
+        if (!radix_sort(data.begin(), data.end(), buffer.begin(), extract_key))
+            return;
+        bool can_swap = std::allocator_traits<Allocator>::propagate_on_container_swap::value || data.get_allocator() == buffer.get_allocator();
+        if (!can_swap || data.capacity() < buffer.capacity())
+        {
+            std::move(buffer.begin(), buffer.begin() + data.size(), data.begin());
+            return;
+        }
+        // the elements past the sorted ones are only scratch space. resizing
+        // doesn't allocate, because the new storage of the buffer is at least
+        // as big as the old one
+        std::size_t buffer_size = buffer.size();
+        data.swap(buffer);
+        data.resize(buffer.size());
+        buffer.resize(buffer_size);
+    }
+    void sort(std::vector<T, Allocator> & data)
+    {
+        sort(data, [](const T & a) -> const T &{ return a; });
+    }
+
+    // makes the buffer big enough to sort num_elements without allocating
+    void reserve(std::size_t num_elements)
+    {
+        if (buffer.size() < num_elements)
+            buffer.resize(num_elements);
+    }
+    std::size_t capacity() const
+    {
+        return buffer.size();
+    }
+    void release_memory()
+    {
+        std::vector<T, Allocator>(buffer.get_allocator()).swap(buffer);
+    }
+    Allocator get_allocator() const
+    {
+        return buffer.get_allocator();
+    }
+
+private:
+    std::vector<T, Allocator> buffer;
+
+    template<typename It, typename ExtractKey>
+    void sort_range(It begin, It end, ExtractKey & extract_key, std::false_type)
+    {
+        typedef typename std::decay<typename std::result_of<ExtractKey(decltype(*begin))>::type>::type key_type;
+        std::ptrdiff_t num_elements = end - begin;
+        if (num_elements <= detail::small_sort_threshold)
+        {
+            detail::small_radix_sort<key_type>(begin, end, extract_key);
+            return;
+        }
+        reserve(static_cast<std::size_t>(num_elements));
+        radix_sort_in_input(begin, end, buffer.begin(), extract_key);
+    }
+    // a std::deque or a std::list gets moved into the first half of the
+    // buffer and sorted there, using the second half as the scratch space
+    template<typename It, typename ExtractKey>
+    void sort_range(It begin, It end, ExtractKey & extract_key, std::true_type)
+    {
+        std::size_t num_elements = static_cast<std::size_t>(std::distance(begin, end));
+        if (num_elements <= 1)
+            return;
+        reserve(2 * num_elements);
+        auto data = buffer.begin();
+        auto scratch = data + static_cast<std::ptrdiff_t>(num_elements);
+        std::move(begin, end, data);
+        typedef typename std::decay<typename std::result_of<ExtractKey(decltype(*data))>::type>::type key_type;
+        if (num_elements <= static_cast<std::size_t>(detail::small_sort_threshold))
+            detail::small_radix_sort<key_type>(data, scratch, extract_key);
+        else if (radix_sort(data, scratch, scratch, extract_key))
+        {
+            std::move(scratch, scratch + static_cast<std::ptrdiff_t>(num_elements), begin);
+            return;
+        }
+        std::move(data, scratch, begin);
+    }
+};
@@ -0,0 +1,867 @@
+//          Copyright Malte Skarupke 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See http://www.boost.org/LICENSE_1_0.txt)
+
+// the benchmarks for radix_sort.hpp. the main part is a matrix that runs
+// every sort over every element type and every key distribution, named
+//     sort/<algorithm>/<type>/<distribution>/<num_elements>
+// so use --benchmark_filter to run a part of it, for example
+//     radix_sort_benchmark --benchmark_filter='sort/.*/int32/uniform/'
+// to compare two runs write them out with
+//     --benchmark_out=before.json --benchmark_out_format=json
+// and diff the files with tools/compare.py from google benchmark
+
+#include "radix_sort.hpp"
+#include "external_radix_sort.hpp"
+
+#include "benchmark/benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <list>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+template<size_t Size>
+struct SizedStruct
+{
+    uint8_t array[Size] = {};
+};
+template<>
+struct SizedStruct<0>
+{
+};
+
+enum class BenchmarkDistribution
+{
+    uniform,
+    sorted,
+    reverse_sorted,
+    // 16 different keys
+    few_unique,
+    // 65536 different keys where the key of rank k shows up with a
+    // probability proportional to 1 / k
+    zipf,
+    // keys from 0 to 1023
+    narrow_range,
+};
+static const char * distribution_name(BenchmarkDistribution distribution)
+{
+    switch (distribution)
+    {
+    case BenchmarkDistribution::uniform: return "uniform";
+    case BenchmarkDistribution::sorted: return "sorted";
+    case BenchmarkDistribution::reverse_sorted: return "reverse_sorted";
+    case BenchmarkDistribution::few_unique: return "few_unique";
+    case BenchmarkDistribution::zipf: return "zipf";
+    case BenchmarkDistribution::narrow_range: return "narrow_range";
+    }
+    return "";
+}
+
+// makes an element from 64 random bits. small numbers turn into small keys
+// so that narrow_range stays narrow for every type
+template<typename T>
+struct BenchmarkElement
+{
+    static T make(std::uint64_t bits)
+    {
+        return make(bits, std::is_integral<T>());
+    }
+    static const T & key(const T & element)
+    {
+        return element;
+    }
+
+private:
+    static T make(std::uint64_t bits, std::true_type)
+    {
+        return static_cast<T>(bits);
+    }
+    static T make(std::uint64_t bits, std::false_type)
+    {
+        return static_cast<T>(static_cast<std::int64_t>(bits));
+    }
+};
+template<>
+struct BenchmarkElement<std::pair<std::int32_t, std::int32_t>>
+{
+    static std::pair<std::int32_t, std::int32_t> make(std::uint64_t bits)
+    {
+        return { static_cast<std::int32_t>(bits >> 32), static_cast<std::int32_t>(bits) };
+    }
+    static const std::pair<std::int32_t, std::int32_t> & key(const std::pair<std::int32_t, std::int32_t> & element)
+    {
+        return element;
+    }
+};
+template<>
+struct BenchmarkElement<std::tuple<std::int16_t, std::int32_t, std::int64_t>>
+{
+    static std::tuple<std::int16_t, std::int32_t, std::int64_t> make(std::uint64_t bits)
+    {
+        return std::tuple<std::int16_t, std::int32_t, std::int64_t>{ static_cast<std::int16_t>(bits >> 48), static_cast<std::int32_t>(bits >> 16), static_cast<std::int64_t>(bits) };
+    }
+    static const std::tuple<std::int16_t, std::int32_t, std::int64_t> & key(const std::tuple<std::int16_t, std::int32_t, std::int64_t> & element)
+    {
+        return element;
+    }
+};
+template<>
+struct BenchmarkElement<std::array<std::int32_t, 4>>
+{
+    static std::array<std::int32_t, 4> make(std::uint64_t bits)
+    {
+        return {{ static_cast<std::int32_t>(bits >> 48), static_cast<std::int32_t>((bits >> 32) & 0xffff), static_cast<std::int32_t>((bits >> 16) & 0xffff), static_cast<std::int32_t>(bits & 0xffff) }};
+    }
+    static const std::array<std::int32_t, 4> & key(const std::array<std::int32_t, 4> & element)
+    {
+        return element;
+    }
+};
+// an int64_t key followed by a payload of Size bytes
+template<size_t Size>
+struct BenchmarkElement<std::tuple<std::int64_t, SizedStruct<Size>>>
+{
+    static std::tuple<std::int64_t, SizedStruct<Size>> make(std::uint64_t bits)
+    {
+        return std::tuple<std::int64_t, SizedStruct<Size>>{ static_cast<std::int64_t>(bits), SizedStruct<Size>() };
+    }
+    static std::int64_t key(const std::tuple<std::int64_t, SizedStruct<Size>> & element)
+    {
+        return std::get<0>(element);
+    }
+};
+
+template<typename T>
+static std::vector<T> create_benchmark_data(BenchmarkDistribution distribution, int size)
+{
+    std::mt19937_64 randomness(77342348);
+    std::vector<std::uint64_t> bits;
+    bits.reserve(size);
+    switch (distribution)
+    {
+    case BenchmarkDistribution::uniform:
+    case BenchmarkDistribution::sorted:
+    case BenchmarkDistribution::reverse_sorted:
+        for (int i = 0; i < size; ++i)
+            bits.push_back(randomness());
+        break;
+    case BenchmarkDistribution::few_unique:
+    {
+        std::uint64_t unique[16];
+        for (std::uint64_t & u : unique)
+            u = randomness();
+        for (int i = 0; i < size; ++i)
+            bits.push_back(unique[randomness() % 16]);
+        break;
+    }
+    case BenchmarkDistribution::zipf:
+    {
+        static constexpr int num_ranks = 1 << 16;
+        std::vector<std::uint64_t> values(num_ranks);
+        std::vector<double> cumulative(num_ranks);
+        double total = 0.0;
+        for (int i = 0; i < num_ranks; ++i)
+        {
+            values[i] = randomness();
+            total += 1.0 / (i + 1);
+            cumulative[i] = total;
+        }
+        std::uniform_real_distribution<double> distribution(0.0, total);
+        for (int i = 0; i < size; ++i)
+        {
+            auto rank = std::upper_bound(cumulative.begin(), cumulative.end() - 1, distribution(randomness));
+            bits.push_back(values[rank - cumulative.begin()]);
+        }
+        break;
+    }
+    case BenchmarkDistribution::narrow_range:
+        for (int i = 0; i < size; ++i)
+            bits.push_back(randomness() % 1024);
+        break;
+    }
+    std::vector<T> result;
+    result.reserve(size);
+    for (std::uint64_t b : bits)
+        result.push_back(BenchmarkElement<T>::make(b));
+    auto compare_keys = [](const T & l, const T & r)
+    {
+        return BenchmarkElement<T>::key(l) < BenchmarkElement<T>::key(r);
+    };
+    if (distribution == BenchmarkDistribution::sorted)
+        std::stable_sort(result.begin(), result.end(), compare_keys);
+    else if (distribution == BenchmarkDistribution::reverse_sorted)
+        std::stable_sort(result.begin(), result.end(), [&](const T & l, const T & r){ return compare_keys(r, l); });
+    return result;
+}
+
+struct BenchmarkRadixSort
+{
+    static const char * name() { return "radix_sort"; }
+    template<typename T>
+    static void sort(std::vector<T> & to_sort, std::vector<T> & buffer)
+    {
+        radix_sort(to_sort.begin(), to_sort.end(), buffer.begin(), [](const T & element) -> decltype(auto)
+        {
+            return BenchmarkElement<T>::key(element);
+        });
+    }
+};
+struct BenchmarkLinearSort
+{
+    static const char * name() { return "linear_sort"; }
+    template<typename T>
+    static void sort(std::vector<T> & to_sort, std::vector<T> & buffer)
+    {
+        linear_sort(to_sort.begin(), to_sort.end(), buffer.begin(), [](const T & element) -> decltype(auto)
+        {
+            return BenchmarkElement<T>::key(element);
+        });
+    }
+};
+// only works for one byte keys
+struct BenchmarkCountingSort
+{
+    static const char * name() { return "counting_sort"; }
+    template<typename T>
+    static void sort(std::vector<T> & to_sort, std::vector<T> & buffer)
+    {
+        counting_sort(to_sort.begin(), to_sort.end(), buffer.begin(), [](const T & element)
+        {
+            return detail::to_unsigned(BenchmarkElement<T>::key(element));
+        });
+    }
+};
+struct BenchmarkStdSort
+{
+    static const char * name() { return "std_sort"; }
+    template<typename T>
+    static void sort(std::vector<T> & to_sort, std::vector<T> &)
+    {
+        std::sort(to_sort.begin(), to_sort.end(), [](const T & l, const T & r)
+        {
+            return BenchmarkElement<T>::key(l) < BenchmarkElement<T>::key(r);
+        });
+    }
+};
+struct BenchmarkStdStableSort
+{
+    static const char * name() { return "std_stable_sort"; }
+    template<typename T>
+    static void sort(std::vector<T> & to_sort, std::vector<T> &)
+    {
+        std::stable_sort(to_sort.begin(), to_sort.end(), [](const T & l, const T & r)
+        {
+            return BenchmarkElement<T>::key(l) < BenchmarkElement<T>::key(r);
+        });
+    }
+};
+
+// times only the sort, not the copy of the input that every iteration needs
+template<typename Algorithm, typename T>
+static void benchmark_sort(benchmark::State & state, BenchmarkDistribution distribution)
+{
+    std::vector<T> original = create_benchmark_data<T>(distribution, state.range(0));
+    std::vector<T> to_sort(original.size());
+    std::vector<T> buffer(original.size());
+    while (state.KeepRunning())
+    {
+        std::copy(original.begin(), original.end(), to_sort.begin());
+        auto start = std::chrono::high_resolution_clock::now();
+        Algorithm::sort(to_sort, buffer);
+        auto end = std::chrono::high_resolution_clock::now();
+        state.SetIterationTime(std::chrono::duration<double>(end - start).count());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * state.range(0) * sizeof(T));
+}
+
+// from 16 elements up to a million or 64MB, whichever is smaller
+static constexpr int min_sort_benchmark_size = 1 << 4;
+static constexpr int max_sort_benchmark_size = 1 << 20;
+static constexpr size_t max_sort_benchmark_bytes = 1 << 26;
+
+template<typename Algorithm, typename T>
+static void register_sort_benchmarks(const char * type_name)
+{
+    const BenchmarkDistribution distributions[] =
+    {
+        BenchmarkDistribution::uniform, BenchmarkDistribution::sorted, BenchmarkDistribution::reverse_sorted,
+        BenchmarkDistribution::few_unique, BenchmarkDistribution::zipf, BenchmarkDistribution::narrow_range,
+    };
+    int max_size = static_cast<int>(std::min<size_t>(max_sort_benchmark_size, max_sort_benchmark_bytes / sizeof(T)));
+    for (BenchmarkDistribution distribution : distributions)
+    {
+        std::string name = std::string("sort/") + Algorithm::name() + "/" + type_name + "/" + distribution_name(distribution);
+        benchmark::internal::Benchmark * registered = benchmark::RegisterBenchmark(name.c_str(), &benchmark_sort<Algorithm, T>, distribution);
+        registered->UseManualTime();
+        int size = min_sort_benchmark_size;
+        for (; size < max_size; size *= 16)
+            registered->Arg(size);
+        registered->Arg(max_size);
+    }
+}
+template<typename T>
+static void register_sort_benchmarks_for_type(const char * type_name)
+{
+    register_sort_benchmarks<BenchmarkRadixSort, T>(type_name);
+    register_sort_benchmarks<BenchmarkLinearSort, T>(type_name);
+    register_sort_benchmarks<BenchmarkStdSort, T>(type_name);
+    register_sort_benchmarks<BenchmarkStdStableSort, T>(type_name);
+}
+
+static bool register_sort_benchmark_matrix()
+{
+    register_sort_benchmarks_for_type<std::int8_t>("int8");
+    register_sort_benchmarks<BenchmarkCountingSort, std::int8_t>("int8");
+    register_sort_benchmarks_for_type<std::int16_t>("int16");
+    register_sort_benchmarks_for_type<std::int32_t>("int32");
+    register_sort_benchmarks_for_type<std::int64_t>("int64");
+    register_sort_benchmarks_for_type<float>("float");
+    register_sort_benchmarks_for_type<double>("double");
+    register_sort_benchmarks_for_type<std::pair<std::int32_t, std::int32_t>>("pair_int32_int32");
+    register_sort_benchmarks_for_type<std::tuple<std::int16_t, std::int32_t, std::int64_t>>("tuple_int16_int32_int64");
+    register_sort_benchmarks_for_type<std::array<std::int32_t, 4>>("array_int32_4");
+    register_sort_benchmarks_for_type<std::tuple<std::int64_t, SizedStruct<0>>>("int64_payload_0");
+    register_sort_benchmarks_for_type<std::tuple<std::int64_t, SizedStruct<8>>>("int64_payload_8");
+    register_sort_benchmarks_for_type<std::tuple<std::int64_t, SizedStruct<32>>>("int64_payload_32");
+    register_sort_benchmarks_for_type<std::tuple<std::int64_t, SizedStruct<64>>>("int64_payload_64");
+    register_sort_benchmarks_for_type<std::tuple<std::int64_t, SizedStruct<128>>>("int64_payload_128");
+    register_sort_benchmarks_for_type<std::tuple<std::int64_t, SizedStruct<256>>>("int64_payload_256");
+    return true;
+}
+static const bool sort_benchmark_matrix_registered = register_sort_benchmark_matrix();
+
+// compares the digit schedules on random keys. range(1) is the
+// radix_sort_digits value, where 0 is automatic
+template<typename T>
+static void benchmark_radix_sort_digits(benchmark::State & state)
+{
+    std::mt19937_64 randomness(77342348);
+    std::uniform_int_distribution<std::uint64_t> distribution;
+    std::vector<T> original;
+    original.reserve(state.range(0));
+    for (int i = 0; i < state.range(0); ++i)
+        original.push_back(static_cast<T>(distribution(randomness)));
+    std::vector<T> to_sort(original.size());
+    std::vector<T> buffer(original.size());
+    radix_sort_digits digits = static_cast<radix_sort_digits>(state.range(1));
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        to_sort = original;
+        state.ResumeTiming();
+        radix_sort(to_sort.begin(), to_sort.end(), buffer.begin(), [](T key){ return key; }, digits);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+static void radix_sort_digits_arguments(benchmark::internal::Benchmark * benchmark)
+{
+    for (int size = 1 << 10; size <= 100000000; size = size < 100000000 / 8 ? size * 8 : 100000000)
+    {
+        for (int digits = 0; digits < 4; ++digits)
+            benchmark->Args({ size, digits });
+        if (size == 100000000)
+            break;
+    }
+}
+// with 8 byte keys, 11 bit digits win from around 4k to 256k elements and
+// lose badly above that, where the 8 bit digits use the write combining
+// scatter. nanoseconds per element for 8, 11 and 16 bit digits:
+// uint64_t    16384 elements:  28.5  27.9  43.4
+// uint64_t    65536 elements:  30.8  28.4  39.3
+// uint64_t  1048576 elements:  33.8  72.0  98.6
+BENCHMARK_TEMPLATE(benchmark_radix_sort_digits, std::uint32_t)->Apply(radix_sort_digits_arguments)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_radix_sort_digits, float)->Apply(radix_sort_digits_arguments)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_radix_sort_digits, std::uint64_t)->Apply(radix_sort_digits_arguments)->UseRealTime();
+
+// to compare with sort/radix_sort/int64_payload_64
+static void benchmark_indirect_radix_sort(benchmark::State & state)
+{
+    typedef std::tuple<std::int64_t, SizedStruct<64>> element;
+    std::vector<element> original = create_benchmark_data<element>(BenchmarkDistribution::uniform, state.range(0));
+    std::vector<element> to_sort(original.size());
+    std::vector<element> buffer(original.size());
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        to_sort = original;
+        state.ResumeTiming();
+        indirect_radix_sort(to_sort.begin(), to_sort.end(), buffer.begin(), [](const element & e){ return std::get<0>(e); });
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(benchmark_indirect_radix_sort)->Range(1 << 10, 1 << 20);
+
+// sorts indices into a table of records, so extract_key has to follow a
+// pointer to a random place in memory for every call
+template<bool CachedKeys>
+static void benchmark_expensive_extract_key(benchmark::State & state)
+{
+    std::mt19937_64 randomness(77342348);
+    std::uniform_int_distribution<std::int64_t> distribution;
+    std::vector<std::pair<std::int64_t, SizedStruct<56>>> records;
+    records.reserve(state.range(0));
+    for (int i = 0; i < state.range(0); ++i)
+        records.emplace_back(distribution(randomness), SizedStruct<56>());
+    std::vector<std::uint32_t> indices(records.size());
+    std::vector<std::uint32_t> buffer(records.size());
+    auto extract_key = [&records](std::uint32_t index)
+    {
+        return records[index].first;
+    };
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        for (std::uint32_t i = 0; i < indices.size(); ++i)
+            indices[i] = i;
+        std::shuffle(indices.begin(), indices.end(), randomness);
+        state.ResumeTiming();
+        if (CachedKeys)
+            cached_key_radix_sort(indices.begin(), indices.end(), buffer.begin(), extract_key);
+        else
+            radix_sort(indices.begin(), indices.end(), buffer.begin(), extract_key);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+// once the records don't fit in the cache, caching the keys makes this
+// almost twice as fast:
+// benchmark_expensive_extract_key<false>/262144    59986977 ns  4.37M items/s
+// benchmark_expensive_extract_key<true>/262144     39631642 ns  6.61M items/s
+// benchmark_expensive_extract_key<false>/4194304 1355730853 ns  3.09M items/s
+// benchmark_expensive_extract_key<true>/4194304   739805566 ns  5.67M items/s
+BENCHMARK_TEMPLATE(benchmark_expensive_extract_key, false)->Range(1 << 10, 1 << 22);
+BENCHMARK_TEMPLATE(benchmark_expensive_extract_key, true)->Range(1 << 10, 1 << 22);
+
+static void benchmark_parallel_radix_sort(benchmark::State & state)
+{
+    std::vector<std::int64_t> original = create_benchmark_data<std::int64_t>(BenchmarkDistribution::uniform, state.range(0));
+    std::vector<std::int64_t> to_sort(original.size());
+    std::vector<std::int64_t> buffer(original.size());
+    radix_sort_thread_pool thread_pool(state.range(1));
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        to_sort = original;
+        state.ResumeTiming();
+        radix_sort(to_sort.begin(), to_sort.end(), buffer.begin(), [](std::int64_t i){ return i; }, thread_pool);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+static void parallel_benchmark_arguments(benchmark::internal::Benchmark * benchmark)
+{
+    int max_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    for (int size = 1 << 20; size <= 1 << 26; size *= 8)
+    {
+        for (int num_threads = 1; num_threads < max_threads; num_threads *= 2)
+            benchmark->Args({ size, num_threads });
+        benchmark->Args({ size, max_threads });
+    }
+}
+BENCHMARK(benchmark_parallel_radix_sort)->Apply(parallel_benchmark_arguments)->UseRealTime();
+
+// the std::deque and the std::list get sorted in a contiguous copy. for 1M
+// elements that made the std::deque 1.8x faster than indexing it directly,
+// and it is 1.3x slower than the std::vector
+template<typename Container>
+static void benchmark_container_radix_sort(benchmark::State & state)
+{
+    std::vector<std::int64_t> data = create_benchmark_data<std::int64_t>(BenchmarkDistribution::uniform, state.range(0));
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        Container to_sort(data.begin(), data.end());
+        Container buffer(to_sort.size());
+        state.ResumeTiming();
+        radix_sort(to_sort.begin(), to_sort.end(), buffer.begin(), [](std::int64_t i){ return i; });
+    }
+}
+BENCHMARK_TEMPLATE(benchmark_container_radix_sort, std::vector<std::int64_t>)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(benchmark_container_radix_sort, std::deque<std::int64_t>)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(benchmark_container_radix_sort, std::list<std::int64_t>)->Range(1 << 10, 1 << 20);
+
+// many small sorts one after the other, like sorting the results of every
+// request in a server. radix_sort allocates a new buffer every time,
+// radix_sorter keeps its buffer and uses an insertion sort for up to 64
+// elements
+template<bool Sorter>
+static void benchmark_repeated_sorts(benchmark::State & state)
+{
+    std::vector<std::int64_t> data = create_benchmark_data<std::int64_t>(BenchmarkDistribution::uniform, 1 << 16);
+    std::ptrdiff_t size = state.range(0);
+    radix_sorter<std::int64_t> sorter;
+    std::vector<std::int64_t> to_sort;
+    while (state.KeepRunning())
+    {
+        for (std::ptrdiff_t begin = 0; begin + size <= static_cast<std::ptrdiff_t>(data.size()); begin += size)
+        {
+            to_sort.assign(data.begin() + begin, data.begin() + begin + size);
+            if (Sorter)
+                sorter.sort(to_sort.begin(), to_sort.end());
+            else
+            {
+                std::vector<std::int64_t> buffer(to_sort.size());
+                radix_sort(to_sort.begin(), to_sort.end(), buffer.begin());
+            }
+            benchmark::DoNotOptimize(to_sort.data());
+        }
+    }
+}
+BENCHMARK_TEMPLATE(benchmark_repeated_sorts, false)->RangeMultiplier(4)->Range(16, 1 << 12);
+BENCHMARK_TEMPLATE(benchmark_repeated_sorts, true)->RangeMultiplier(4)->Range(16, 1 << 12);
+
+// keys with an odd number of digits, where radix_sort leaves the result in
+// the buffer. the copy back is compared to radix_sort_in_input, which moves
+// the elements into the buffer during the counting read instead
+template<typename T, bool InInput>
+static void benchmark_result_in_input(benchmark::State & state)
+{
+    std::mt19937_64 randomness(5);
+    std::vector<T> data(state.range(0));
+    for (T & i : data)
+        i = static_cast<T>(randomness());
+    std::vector<T> to_sort(data.size());
+    std::vector<T> buffer(data.size());
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        to_sort = data;
+        state.ResumeTiming();
+        if (InInput)
+            radix_sort_in_input(to_sort.begin(), to_sort.end(), buffer.begin());
+        else if (radix_sort(to_sort.begin(), to_sort.end(), buffer.begin()))
+            std::copy(buffer.begin(), buffer.end(), to_sort.begin());
+        benchmark::DoNotOptimize(to_sort.data());
+    }
+}
+BENCHMARK_TEMPLATE(benchmark_result_in_input, std::uint8_t, false)->Range(1 << 12, 1 << 24);
+BENCHMARK_TEMPLATE(benchmark_result_in_input, std::uint8_t, true)->Range(1 << 12, 1 << 24);
+BENCHMARK_TEMPLATE(benchmark_result_in_input, std::uint32_t, false)->Range(1 << 12, 1 << 16);
+BENCHMARK_TEMPLATE(benchmark_result_in_input, std::uint32_t, true)->Range(1 << 12, 1 << 16);
+
+// a column of uint32 keys and a column of uint32 values. the zipped version
+// copies them into a new vector of pairs, sorts that and copies them back
+// out. radix_sort_by_key sorts the columns directly
+template<bool ByKey>
+static void benchmark_radix_sort_by_key(benchmark::State & state)
+{
+    std::vector<std::uint32_t> data = create_benchmark_data<std::uint32_t>(BenchmarkDistribution::uniform, state.range(0));
+    std::vector<std::uint32_t> keys(data.size());
+    std::vector<std::uint32_t> values(data.size());
+    std::vector<std::uint32_t> key_buffer(data.size());
+    std::vector<std::uint32_t> value_buffer(data.size());
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        keys = data;
+        for (size_t i = 0; i < values.size(); ++i)
+            values[i] = static_cast<std::uint32_t>(i);
+        state.ResumeTiming();
+        if (ByKey)
+            radix_sort_by_key(keys.begin(), keys.end(), values.begin(), key_buffer.begin(), value_buffer.begin());
+        else
+        {
+            std::vector<std::pair<std::uint32_t, std::uint32_t>> zipped(keys.size());
+            std::vector<std::pair<std::uint32_t, std::uint32_t>> zipped_buffer(keys.size());
+            for (size_t i = 0; i < keys.size(); ++i)
+                zipped[i] = { keys[i], values[i] };
+            radix_sort_in_input(zipped.begin(), zipped.end(), zipped_buffer.begin(), [](const std::pair<std::uint32_t, std::uint32_t> & p){ return p.first; });
+            for (size_t i = 0; i < keys.size(); ++i)
+            {
+                keys[i] = zipped[i].first;
+                values[i] = zipped[i].second;
+            }
+        }
+        benchmark::DoNotOptimize(values.data());
+    }
+}
+BENCHMARK_TEMPLATE(benchmark_radix_sort_by_key, false)->Range(1 << 10, 1 << 24);
+BENCHMARK_TEMPLATE(benchmark_radix_sort_by_key, true)->Range(1 << 10, 1 << 24);
+
+// the sorting permutation of a column of keys. uint32 keys get packed with
+// their index into a uint64, uint64 keys get sorted as (key, index) pairs
+template<typename T, bool Radix>
+static void benchmark_argsort(benchmark::State & state)
+{
+    std::vector<T> keys = create_benchmark_data<T>(BenchmarkDistribution::uniform, state.range(0));
+    std::vector<std::uint32_t> indices(keys.size());
+    while (state.KeepRunning())
+    {
+        if (Radix)
+            radix_argsort(keys.begin(), keys.end(), indices.begin());
+        else
+        {
+            for (size_t i = 0; i < indices.size(); ++i)
+                indices[i] = static_cast<std::uint32_t>(i);
+            std::stable_sort(indices.begin(), indices.end(), [&](std::uint32_t l, std::uint32_t r){ return keys[l] < keys[r]; });
+        }
+        benchmark::DoNotOptimize(indices.data());
+    }
+}
+BENCHMARK_TEMPLATE(benchmark_argsort, std::uint32_t, false)->Range(1 << 10, 1 << 22);
+BENCHMARK_TEMPLATE(benchmark_argsort, std::uint32_t, true)->Range(1 << 10, 1 << 22);
+BENCHMARK_TEMPLATE(benchmark_argsort, std::uint64_t, false)->Range(1 << 10, 1 << 22);
+BENCHMARK_TEMPLATE(benchmark_argsort, std::uint64_t, true)->Range(1 << 10, 1 << 22);
+
+#ifdef RADIX_SORT_HAS_INT128
+// UUIDv7 like keys as a native 128 bit integer against the same keys split
+// into a pair of uint64s. both count all 16 bytes in one read and skip the
+// bytes that are the same in every key
+template<bool Native>
+static void benchmark_uint128(benchmark::State & state)
+{
+    std::mt19937_64 randomness(128);
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> pairs(state.range(0));
+    for (std::pair<std::uint64_t, std::uint64_t> & key : pairs)
+        key = { 0x0190000000007000ull | ((randomness() & 0xffffff) << 16) | (randomness() & 0xfff), 0x8000000000000000ull | (randomness() & 0x3fffffffffffffffull) };
+    std::vector<unsigned __int128> keys(pairs.size());
+    for (size_t i = 0; i < pairs.size(); ++i)
+        keys[i] = (static_cast<unsigned __int128>(pairs[i].first) << 64) | pairs[i].second;
+    std::vector<unsigned __int128> to_sort(keys.size());
+    std::vector<unsigned __int128> buffer(keys.size());
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> pairs_to_sort(pairs.size());
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> pairs_buffer(pairs.size());
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        if (Native)
+            to_sort = keys;
+        else
+            pairs_to_sort = pairs;
+        state.ResumeTiming();
+        if (Native)
+            radix_sort(to_sort.begin(), to_sort.end(), buffer.begin());
+        else
+            radix_sort(pairs_to_sort.begin(), pairs_to_sort.end(), pairs_buffer.begin());
+        benchmark::DoNotOptimize(buffer.data());
+        benchmark::DoNotOptimize(pairs_buffer.data());
+    }
+}
+BENCHMARK_TEMPLATE(benchmark_uint128, false)->Range(1 << 10, 1 << 22);
+BENCHMARK_TEMPLATE(benchmark_uint128, true)->Range(1 << 10, 1 << 22);
+#endif
+
+// the hybrid MSD/LSD sort against the LSD passes. the hybrid sort only gets
+// used automatically from hybrid_sort_min_bytes on, so it's called directly
+template<bool Hybrid>
+static void benchmark_hybrid_radix_sort(benchmark::State & state)
+{
+    std::vector<std::uint64_t> data = create_benchmark_data<std::uint64_t>(BenchmarkDistribution::uniform, state.range(0));
+    std::vector<std::uint64_t> to_sort(data.size());
+    std::vector<std::uint64_t> buffer(data.size());
+    auto identity = [](std::uint64_t i){ return i; };
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        to_sort = data;
+        state.ResumeTiming();
+        detail::SerialExecutor executor;
+        if (Hybrid)
+            detail::SizedRadixSorter<8>::sort_hybrid(to_sort.begin(), to_sort.end(), buffer.begin(), identity, executor, detail::hybrid_max_msd_passes, detail::ResultPlacement::anywhere);
+        else
+            detail::SizedRadixSorter<8>::sort_lsd(to_sort.begin(), to_sort.end(), buffer.begin(), identity, executor, radix_sort_digits::bits_8);
+        benchmark::DoNotOptimize(buffer.data());
+    }
+}
+BENCHMARK_TEMPLATE(benchmark_hybrid_radix_sort, false)->RangeMultiplier(4)->Range(1 << 20, 1 << 26);
+BENCHMARK_TEMPLATE(benchmark_hybrid_radix_sort, true)->RangeMultiplier(4)->Range(1 << 20, 1 << 26);
+
+// sorts a file of 8 byte keys with a memory budget of a quarter of the file,
+// so every key goes through one partition pass. the file is in TMPDIR
+static void benchmark_external_radix_sort(benchmark::State & state)
+{
+    std::vector<std::uint64_t> data = create_benchmark_data<std::uint64_t>(BenchmarkDistribution::uniform, state.range(0));
+    const char * tmpdir = std::getenv("TMPDIR");
+    std::string path = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/radix_sort_benchmark_input";
+    external_radix_sort_options options;
+    options.memory_budget = data.size() * sizeof(std::uint64_t) / 4;
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        std::FILE * file = std::fopen(path.c_str(), "wb");
+        std::fwrite(data.data(), sizeof(std::uint64_t), data.size(), file);
+        std::fclose(file);
+        state.ResumeTiming();
+        external_radix_sort<std::uint64_t>(path, path, options);
+    }
+    std::remove(path.c_str());
+    state.SetBytesProcessed(state.iterations() * state.range(0) * sizeof(std::uint64_t));
+}
+BENCHMARK(benchmark_external_radix_sort)->RangeMultiplier(4)->Range(1 << 20, 1 << 24)->UseRealTime();
+
+// ru_maxrss is the peak of the whole process, so to compare the peak memory
+// of two sorts run them in separate processes using --benchmark_filter
+static double peak_rss_in_mb()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+static void benchmark_ping_pong_radix_sort_memory(benchmark::State & state)
+{
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        std::vector<std::int64_t> to_sort = create_benchmark_data<std::int64_t>(BenchmarkDistribution::uniform, state.range(0));
+        state.ResumeTiming();
+        std::vector<std::int64_t> buffer(to_sort.size());
+        radix_sort(to_sort.begin(), to_sort.end(), buffer.begin(), [](std::int64_t i){ return i; });
+    }
+    state.counters["peak_rss_mb"] = peak_rss_in_mb();
+}
+BENCHMARK(benchmark_ping_pong_radix_sort_memory)->Range(1 << 16, 1 << 24);
+
+static void benchmark_in_place_radix_sort(benchmark::State & state)
+{
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        std::vector<std::int64_t> to_sort = create_benchmark_data<std::int64_t>(BenchmarkDistribution::uniform, state.range(0));
+        state.ResumeTiming();
+        in_place_radix_sort(to_sort.begin(), to_sort.end(), [](std::int64_t i){ return i; });
+    }
+    state.counters["peak_rss_mb"] = peak_rss_in_mb();
+}
+BENCHMARK(benchmark_in_place_radix_sort)->Range(1 << 16, 1 << 24);
+
+// the median, the top 1000 and the top 10% of random floats. at 16M elements
+// radix_select was 2.4x faster than std::nth_element, and radix_partial_sort
+// was 7x faster than std::partial_sort for the top 10%. for the top 1000
+// std::partial_sort was 5x faster because it rejects almost every element
+// with one comparison, so radix_partial_sort now calls it when fewer than
+// one in 256 elements are wanted, and is a little faster than it there
+template<bool Radix>
+static void benchmark_select(benchmark::State & state)
+{
+    std::vector<float> data = create_benchmark_data<float>(BenchmarkDistribution::uniform, state.range(0));
+    std::ptrdiff_t k = state.range(1) ? state.range(1) : state.range(0) / 2;
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        std::vector<float> to_select = data;
+        state.ResumeTiming();
+        if (!state.range(1) && Radix)
+            radix_select(to_select.begin(), to_select.begin() + k, to_select.end());
+        else if (!state.range(1))
+            std::nth_element(to_select.begin(), to_select.begin() + k, to_select.end());
+        else if (Radix)
+            radix_partial_sort(to_select.begin(), to_select.begin() + k, to_select.end(), [](float f){ return radix_sort_descending(f); });
+        else
+            std::partial_sort(to_select.begin(), to_select.begin() + k, to_select.end(), std::greater<float>());
+        benchmark::DoNotOptimize(to_select[k - 1]);
+    }
+}
+static void select_arguments(benchmark::internal::Benchmark * benchmark)
+{
+    for (int size = 1 << 16; size <= 1 << 24; size *= 16)
+    {
+        for (int k : { 0, 1000, size / 10 })
+            benchmark->Args({ size, k });
+    }
+}
+BENCHMARK_TEMPLATE(benchmark_select, false)->Apply(select_arguments);
+BENCHMARK_TEMPLATE(benchmark_select, true)->Apply(select_arguments);
+
+// one scatter pass with each scatter mode. Size is the payload next to an
+// int64_t key, so SizedStruct<0> is 8 bytes, SizedStruct<8> is 16 bytes and
+// SizedStruct<24> is 32 bytes
+template<size_t Size>
+static void benchmark_scatter_mode(benchmark::State & state)
+{
+    typedef std::tuple<std::int64_t, SizedStruct<Size>> element;
+    std::mt19937_64 randomness(77342348);
+    std::uniform_int_distribution<std::int64_t> distribution;
+    std::vector<element> to_sort;
+    to_sort.reserve(state.range(0));
+    for (int i = 0; i < state.range(0); ++i)
+        to_sort.emplace_back(distribution(randomness), SizedStruct<Size>());
+    std::vector<element> buffer(to_sort.size());
+    auto extract_digit = [](const element & e){ return static_cast<std::uint8_t>(std::get<0>(e)); };
+    std::size_t counts[256] = {};
+    for (const element & e : to_sort)
+        ++counts[extract_digit(e)];
+    detail::ScatterMode mode = static_cast<detail::ScatterMode>(state.range(1));
+    while (state.KeepRunning())
+    {
+        std::size_t offsets[256];
+        std::copy(std::begin(counts), std::end(counts), offsets);
+        detail::counts_to_offsets(offsets);
+        detail::radix_scatter(to_sort.begin(), to_sort.end(), buffer.begin(), offsets, extract_digit, mode);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0) * sizeof(element));
+}
+static void scatter_mode_arguments(benchmark::internal::Benchmark * benchmark)
+{
+    for (int size = 1 << 12; size <= 1 << 24; size *= 4)
+    {
+        for (int mode = 0; mode < 3; ++mode)
+            benchmark->Args({ size, mode });
+    }
+}
+// mode 0 is direct, 1 is write combining, 2 is write combining with non
+// temporal stores. on a Xeon with 2MB of L2 the crossover is at around 2MB
+// of input for all three sizes:
+// benchmark_scatter_mode<0>/65536/0       192291 ns  2.54G/s
+// benchmark_scatter_mode<0>/65536/2       244125 ns  2.00G/s
+// benchmark_scatter_mode<0>/262144/0     2158322 ns   927M/s
+// benchmark_scatter_mode<0>/262144/1     1263468 ns  1.55G/s
+// benchmark_scatter_mode<0>/262144/2      952153 ns  2.05G/s
+// benchmark_scatter_mode<0>/16777216/0 218276447 ns   586M/s
+// benchmark_scatter_mode<0>/16777216/2  55191599 ns  2.26G/s
+// benchmark_scatter_mode<8>/65536/0       283811 ns  3.44G/s
+// benchmark_scatter_mode<8>/65536/2       286261 ns  3.41G/s
+// benchmark_scatter_mode<8>/262144/0     2894152 ns  1.35G/s
+// benchmark_scatter_mode<8>/262144/2     1225103 ns  3.19G/s
+// benchmark_scatter_mode<24>/16384/0       77625 ns  6.29G/s
+// benchmark_scatter_mode<24>/16384/2      105333 ns  4.64G/s
+// benchmark_scatter_mode<24>/65536/0      713567 ns  2.74G/s
+// benchmark_scatter_mode<24>/65536/2      481137 ns  4.06G/s
+BENCHMARK_TEMPLATE(benchmark_scatter_mode, 0)->Apply(scatter_mode_arguments);
+BENCHMARK_TEMPLATE(benchmark_scatter_mode, 8)->Apply(scatter_mode_arguments);
+BENCHMARK_TEMPLATE(benchmark_scatter_mode, 24)->Apply(scatter_mode_arguments);
+
+// just the counting read of a radix sort. the second argument is the number
+// of distinct keys, where 0 means uniformly random keys
+template<typename T>
+static void benchmark_histogram(benchmark::State & state)
+{
+    std::mt19937_64 randomness(77342348);
+    std::vector<T> keys;
+    keys.reserve(state.range(0));
+    for (int i = 0; i < state.range(0); ++i)
+        keys.push_back(static_cast<T>(state.range(1) ? 0x5a5a5a5a5a5a5a5aull * (randomness() % state.range(1)) : randomness()));
+    auto identity = [](T key){ return key; };
+    while (state.KeepRunning())
+    {
+        std::size_t counts[sizeof(T)][256] = {};
+        detail::count_key_bytes<sizeof(T), std::size_t>(keys.begin(), keys.end(), counts, identity);
+        benchmark::DoNotOptimize(counts);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+static void histogram_arguments(benchmark::internal::Benchmark * benchmark)
+{
+    for (int size = 1 << 10; size <= 1 << 22; size *= 16)
+    {
+        for (int distinct : { 0, 1, 4 })
+            benchmark->Args({ size, distinct });
+    }
+}
+// with sub histograms, compared to counting into a single histogram:
+// benchmark_histogram<std::uint8_t>/262144/0      200165 ns (single: 187651 ns)
+// benchmark_histogram<std::uint8_t>/262144/1      259361 ns (single: 854039 ns)
+// benchmark_histogram<std::uint8_t>/262144/4      200479 ns (single: 272125 ns)
+// benchmark_histogram<std::uint64_t>/262144/0    2895949 ns (single: 3510111 ns)
+// benchmark_histogram<std::uint64_t>/262144/1    2640593 ns (single: 3782456 ns)
+BENCHMARK_TEMPLATE(benchmark_histogram, std::uint8_t)->Apply(histogram_arguments);
+BENCHMARK_TEMPLATE(benchmark_histogram, std::uint32_t)->Apply(histogram_arguments);
+BENCHMARK_TEMPLATE(benchmark_histogram, std::uint64_t)->Apply(histogram_arguments);
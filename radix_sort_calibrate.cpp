@@ -0,0 +1,226 @@
+//          Copyright Malte Skarupke 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See http://www.boost.org/LICENSE_1_0.txt)
+
+// measures where the radix sort of linear_sort starts to beat std::sort and
+// where the hybrid MSD/LSD sort starts to beat the LSD sort on this machine
+// and writes a header with the thresholds:
+//     radix_sort_calibrate radix_sort_thresholds.hpp
+// then compile with -DRADIX_SORT_THRESHOLDS_HEADER='"radix_sort_thresholds.hpp"'
+// to make linear_sort use them. without an argument it prints the header
+
+#include "radix_sort.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+template<size_t Size>
+struct CalibratePayload
+{
+    uint8_t array[Size] = {};
+};
+template<>
+struct CalibratePayload<0>
+{
+};
+
+static void random_key(std::mt19937_64 & randomness, std::uint8_t & key)
+{
+    key = static_cast<std::uint8_t>(randomness());
+}
+static void random_key(std::mt19937_64 & randomness, std::uint16_t & key)
+{
+    key = static_cast<std::uint16_t>(randomness());
+}
+static void random_key(std::mt19937_64 & randomness, std::uint32_t & key)
+{
+    key = static_cast<std::uint32_t>(randomness());
+}
+static void random_key(std::mt19937_64 & randomness, std::uint64_t & key)
+{
+    key = randomness();
+}
+template<typename T, size_t S>
+static void random_key(std::mt19937_64 & randomness, std::array<T, S> & key)
+{
+    for (T & k : key)
+        random_key(randomness, k);
+}
+
+// the best of several runs, in seconds. every run sorts a fresh copy
+template<typename T, typename Sort>
+static double time_sort(const std::vector<T> & original, Sort && sort)
+{
+    std::vector<T> to_sort(original.size());
+    std::vector<T> buffer(original.size());
+    int num_runs = std::max(5, static_cast<int>((1 << 18) / original.size()));
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < num_runs; ++i)
+    {
+        std::copy(original.begin(), original.end(), to_sort.begin());
+        auto start = std::chrono::steady_clock::now();
+        sort(to_sort, buffer);
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+    return best;
+}
+
+static constexpr std::ptrdiff_t min_calibrate_size = 8;
+static constexpr std::ptrdiff_t max_calibrate_size = 1 << 16;
+
+// the smallest number of elements from which on the radix sort is faster
+// for every measured size
+template<typename Key, size_t ElementSize>
+static std::ptrdiff_t measure_threshold()
+{
+    typedef std::tuple<Key, CalibratePayload<ElementSize - sizeof(Key)>> element;
+    auto extract_key = [](const element & e) -> const Key &
+    {
+        return std::get<0>(e);
+    };
+    std::mt19937_64 randomness(77342348);
+    std::ptrdiff_t threshold = detail::linear_sort_never;
+    for (std::ptrdiff_t size = max_calibrate_size; size >= min_calibrate_size; size /= 2)
+    {
+        std::vector<element> original(size);
+        for (element & e : original)
+            random_key(randomness, std::get<0>(e));
+        double radix_time = time_sort(original, [&](std::vector<element> & to_sort, std::vector<element> & buffer)
+        {
+            detail::SerialExecutor executor;
+            detail::linear_radix_sort(to_sort.begin(), to_sort.end(), buffer.begin(), extract_key, executor);
+        });
+        double comparison_time = time_sort(original, [&](std::vector<element> & to_sort, std::vector<element> &)
+        {
+            std::sort(to_sort.begin(), to_sort.end(), [&](const element & l, const element & r)
+            {
+                return extract_key(l) < extract_key(r);
+            });
+        });
+        if (radix_time >= comparison_time)
+            break;
+        threshold = size;
+    }
+    return threshold;
+}
+
+template<typename Key, size_t... SizeBuckets>
+static std::array<std::ptrdiff_t, detail::linear_sort_size_buckets> measure_thresholds(std::index_sequence<SizeBuckets...>)
+{
+    // elements that are smaller than the key can't exist, so those columns
+    // get the threshold of the smallest element
+    std::array<std::ptrdiff_t, detail::linear_sort_size_buckets> result = {{ (sizeof(Key) <= (size_t(1) << SizeBuckets) ? measure_threshold<Key, std::max(sizeof(Key), size_t(1) << SizeBuckets)>() : detail::linear_sort_never)... }};
+    size_t smallest = detail::linear_sort_bucket(sizeof(Key), detail::linear_sort_size_buckets);
+    for (size_t i = 0; i < smallest; ++i)
+        result[i] = result[smallest];
+    return result;
+}
+
+template<typename Key>
+static std::array<std::ptrdiff_t, detail::linear_sort_size_buckets> measure_pass_bucket(size_t pass_bucket)
+{
+    std::fprintf(stderr, "measuring keys with %zu passes\n", detail::RadixSorter<Key>::pass_count);
+    if (detail::linear_sort_bucket(detail::RadixSorter<Key>::pass_count, detail::linear_sort_pass_buckets) != pass_bucket)
+        std::fprintf(stderr, "warning: the key for row %zu is in a different row\n", pass_bucket);
+    return measure_thresholds<Key>(std::make_index_sequence<detail::linear_sort_size_buckets>{});
+}
+
+static constexpr std::size_t min_hybrid_calibrate_bytes = std::size_t(1) << 24;
+static constexpr std::size_t max_hybrid_calibrate_bytes = std::size_t(1) << 29;
+
+// the smallest number of bytes from which on the hybrid sort is faster than
+// the LSD sort for every measured size, or 0 if it's never faster
+static std::size_t measure_hybrid_threshold()
+{
+    std::fprintf(stderr, "measuring the hybrid sort\n");
+    auto extract_key = [](std::uint64_t key)
+    {
+        return key;
+    };
+    std::mt19937_64 randomness(1873461);
+    std::size_t threshold = 0;
+    for (std::size_t bytes = max_hybrid_calibrate_bytes; bytes >= min_hybrid_calibrate_bytes; bytes /= 2)
+    {
+        std::vector<std::uint64_t> original(bytes / sizeof(std::uint64_t));
+        for (std::uint64_t & key : original)
+            random_key(randomness, key);
+        double hybrid_time = time_sort(original, [&](std::vector<std::uint64_t> & to_sort, std::vector<std::uint64_t> & buffer)
+        {
+            detail::SerialExecutor executor;
+            detail::SizedRadixSorter<8>::sort_hybrid(to_sort.begin(), to_sort.end(), buffer.begin(), extract_key, executor, detail::hybrid_max_msd_passes, detail::ResultPlacement::anywhere);
+        });
+        double lsd_time = time_sort(original, [&](std::vector<std::uint64_t> & to_sort, std::vector<std::uint64_t> & buffer)
+        {
+            detail::SerialExecutor executor;
+            detail::SizedRadixSorter<8>::sort_lsd(to_sort.begin(), to_sort.end(), buffer.begin(), extract_key, executor, radix_sort_digits::bits_8);
+        });
+        if (hybrid_time >= lsd_time)
+            break;
+        threshold = bytes;
+    }
+    return threshold;
+}
+
+static std::string format_threshold(std::ptrdiff_t threshold)
+{
+    if (threshold == detail::linear_sort_never)
+        return "linear_sort_never";
+    else
+        return std::to_string(threshold);
+}
+
+int main(int argc, char * argv[])
+{
+    std::array<std::array<std::ptrdiff_t, detail::linear_sort_size_buckets>, detail::linear_sort_pass_buckets> table;
+    // there are no keys with a single pass, so the first row is a copy of
+    // the second one
+    table[1] = measure_pass_bucket<std::uint8_t>(1);
+    table[0] = table[1];
+    table[2] = measure_pass_bucket<std::uint16_t>(2);
+    table[3] = measure_pass_bucket<std::uint32_t>(3);
+    table[4] = measure_pass_bucket<std::uint64_t>(4);
+    table[5] = measure_pass_bucket<std::array<std::uint64_t, 3>>(5);
+    table[6] = measure_pass_bucket<std::array<std::uint64_t, 6>>(6);
+    std::size_t hybrid_threshold = measure_hybrid_threshold();
+
+    std::string header;
+    header += "// generated by radix_sort_calibrate. see linear_sort_thresholds in\n";
+    header += "// radix_sort.hpp for what the rows and columns mean\n";
+    header += "#pragma once\n\n";
+    header += "#define RADIX_SORT_LINEAR_SORT_THRESHOLDS \\\n{ \\\n";
+    for (const auto & row : table)
+    {
+        header += "    {";
+        for (size_t i = 0; i < row.size(); ++i)
+        {
+            header += i == 0 ? " " : ", ";
+            header += format_threshold(row[i]);
+        }
+        header += " }, \\\n";
+    }
+    header += "}\n";
+    // if the hybrid sort never won, it's turned off
+    header += "\n#define RADIX_SORT_HYBRID_SORT_MIN_BYTES ";
+    header += hybrid_threshold == 0 ? std::string("static_cast<std::size_t>(-1)") : std::to_string(hybrid_threshold) + "u";
+    header += "\n";
+
+    if (argc < 2)
+    {
+        std::fputs(header.c_str(), stdout);
+        return 0;
+    }
+    std::FILE * file = std::fopen(argv[1], "w");
+    if (!file)
+    {
+        std::fprintf(stderr, "couldn't open %s for writing\n", argv[1]);
+        return 1;
+    }
+    std::fputs(header.c_str(), file);
+    std::fclose(file);
+    return 0;
+}
@@ -0,0 +1,314 @@
+//          Copyright Malte Skarupke 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See http://www.boost.org/LICENSE_1_0.txt)
+
+// sorts a file of packed fixed-width binary records by a key that is
+// described on the command line:
+//     radix_sort_file --record-size 16 --key 0:8:u:le:asc input [output]
+// every --key is OFFSET:WIDTH followed by optional fields in any order:
+//     u, s or f     unsigned, signed or floating point. the default is u
+//     le or be      little or big endian. the default is le
+//     asc or desc   the sort direction. the default is asc
+// WIDTH is 1 to 8 bytes, or 4 or 8 for floats. several --key arguments make
+// a composite key where the first one is the most significant. records with
+// equal keys keep their order. without an output file the input gets
+// sorted in place, through a copy in memory unless --low-memory is given.
+// the files get memory mapped, but the keys are sorted in memory: every
+// record gets an entry of its key bytes rounded up to a multiple of 8, plus
+// 8 bytes for its index, and the sort needs a buffer of the same size. so
+// for 16 byte records with an 8 byte key that's 32 bytes per record, twice
+// the size of the file. sorting in place needs another copy of the file on
+// top of that, or with --low-memory 4 bytes per record for the permutation,
+// 8 from 4 billion records on
+
+#include "radix_sort.hpp"
+#include "radix_sort_file.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct RecordLayout
+{
+    std::size_t record_size = 0;
+    std::vector<KeyField> fields;
+    // sort in place without a second copy of the file in memory. that is a
+    // lot slower because the records get moved in random order
+    bool low_memory = false;
+};
+
+template<std::size_t NumWords, typename Index>
+struct KeyAndIndex
+{
+    std::array<std::uint64_t, NumWords> key;
+    Index index;
+};
+
+typedef std::chrono::steady_clock clock_type;
+
+static double seconds_since(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+static void advise(void * begin, std::size_t size, int advice)
+{
+    // only a hint, so errors are ignored
+    if (size)
+        madvise(begin, size, advice);
+}
+
+template<std::size_t NumWords, typename Index>
+static void gather_records(const unsigned char * input, unsigned char * output, const std::vector<KeyAndIndex<NumWords, Index>> & keys, std::size_t record_size)
+{
+    for (std::size_t i = 0; i < keys.size(); ++i)
+        std::memcpy(output + i * record_size, input + std::size_t(keys[i].index) * record_size, record_size);
+}
+
+template<std::size_t NumWords, typename Index>
+static void sort_records(const unsigned char * input, unsigned char * output, std::size_t num_records, const RecordLayout & layout)
+{
+    typedef KeyAndIndex<NumWords, Index> entry;
+    std::size_t record_size = layout.record_size;
+    std::size_t num_bytes = num_records * record_size;
+
+    auto start = clock_type::now();
+    advise(const_cast<unsigned char *>(input), num_bytes, MADV_SEQUENTIAL);
+    std::vector<entry> keys(num_records);
+    for (std::size_t i = 0; i < num_records; ++i)
+    {
+        pack_key(input + i * record_size, layout.fields, keys[i].key);
+        keys[i].index = static_cast<Index>(i);
+    }
+    double read_time = seconds_since(start);
+
+    start = clock_type::now();
+    {
+        std::vector<entry> buffer(num_records);
+        radix_sort_in_input(keys.begin(), keys.end(), buffer.begin(), [](const entry & e) -> const std::array<std::uint64_t, NumWords> &
+        {
+            return e.key;
+        });
+    }
+    double sort_time = seconds_since(start);
+
+    start = clock_type::now();
+    if (input != output)
+    {
+        // the reads jump around the input, the writes are sequential
+        advise(const_cast<unsigned char *>(input), num_bytes, MADV_RANDOM);
+        advise(output, num_bytes, MADV_SEQUENTIAL);
+        gather_records(input, output, keys, record_size);
+    }
+    else if (layout.low_memory)
+    {
+        std::vector<Index> permutation(num_records);
+        for (std::size_t i = 0; i < num_records; ++i)
+            permutation[i] = keys[i].index;
+        keys = std::vector<entry>();
+        advise(output, num_bytes, MADV_RANDOM);
+        permute_in_place(output, record_size, permutation);
+    }
+    else
+    {
+        std::unique_ptr<unsigned char[]> sorted(new unsigned char[num_bytes]);
+        advise(output, num_bytes, MADV_RANDOM);
+        gather_records(input, sorted.get(), keys, record_size);
+        advise(output, num_bytes, MADV_SEQUENTIAL);
+        std::memcpy(output, sorted.get(), num_bytes);
+    }
+    double write_time = seconds_since(start);
+
+    double megabytes = num_bytes / (1024.0 * 1024.0);
+    double total_time = read_time + sort_time + write_time;
+    std::fprintf(stderr, "read keys:    %8.3f s\n", read_time);
+    std::fprintf(stderr, "sort keys:    %8.3f s\n", sort_time);
+    std::fprintf(stderr, "move records: %8.3f s\n", write_time);
+    std::fprintf(stderr, "sorted %zu records, %.1f MB, in %.3f s: %.1f MB/s, %.1f million records/s\n",
+                 num_records, megabytes, total_time, total_time > 0.0 ? megabytes / total_time : 0.0,
+                 total_time > 0.0 ? num_records / total_time / 1000000.0 : 0.0);
+}
+
+template<std::size_t NumWords>
+static void sort_records(const unsigned char * input, unsigned char * output, std::size_t num_records, const RecordLayout & layout)
+{
+    if (num_records <= std::numeric_limits<std::uint32_t>::max())
+        sort_records<NumWords, std::uint32_t>(input, output, num_records, layout);
+    else
+        sort_records<NumWords, std::uint64_t>(input, output, num_records, layout);
+}
+
+static constexpr std::size_t max_key_bytes = 32;
+
+static void sort_records(const unsigned char * input, unsigned char * output, std::size_t num_records, const RecordLayout & layout)
+{
+    std::size_t key_bytes = 0;
+    for (const KeyField & field : layout.fields)
+        key_bytes += field.width;
+    switch ((key_bytes + 7) / 8)
+    {
+    case 1:
+        return sort_records<1>(input, output, num_records, layout);
+    case 2:
+        return sort_records<2>(input, output, num_records, layout);
+    case 3:
+        return sort_records<3>(input, output, num_records, layout);
+    default:
+        return sort_records<4>(input, output, num_records, layout);
+    }
+}
+
+static void * map_file(int file, std::size_t size, int protection, int flags)
+{
+    if (!size)
+        return nullptr;
+    void * result = mmap(nullptr, size, protection, flags, file, 0);
+    return result == MAP_FAILED ? nullptr : result;
+}
+
+static int usage(const char * program)
+{
+    std::fprintf(stderr, "usage: %s --record-size N --key OFFSET:WIDTH[:u|s|f][:le|be][:asc|desc] [--key ...] [--low-memory] input [output]\n", program);
+    return 2;
+}
+
+int main(int argc, char * argv[])
+{
+    RecordLayout layout;
+    std::vector<const char *> paths;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+        if (argument == "--record-size" && i + 1 < argc)
+        {
+            if (!parse_size(argv[++i], layout.record_size) || !layout.record_size)
+            {
+                std::fprintf(stderr, "invalid record size %s\n", argv[i]);
+                return usage(argv[0]);
+            }
+        }
+        else if (argument == "--key" && i + 1 < argc)
+        {
+            KeyField field;
+            if (!parse_key_field(argv[++i], field))
+            {
+                std::fprintf(stderr, "invalid key %s\n", argv[i]);
+                return usage(argv[0]);
+            }
+            layout.fields.push_back(field);
+        }
+        else if (argument == "--low-memory")
+            layout.low_memory = true;
+        else if (argument.size() > 1 && argument[0] == '-')
+            return usage(argv[0]);
+        else
+            paths.push_back(argv[i]);
+    }
+    if (!layout.record_size || layout.fields.empty() || paths.empty() || paths.size() > 2)
+        return usage(argv[0]);
+    std::size_t record_size = layout.record_size;
+    std::size_t key_bytes = 0;
+    for (const KeyField & field : layout.fields)
+    {
+        if (field.offset > record_size || field.width > record_size - field.offset)
+        {
+            std::fprintf(stderr, "the key at offset %zu with width %zu doesn't fit into a record of %zu bytes\n", field.offset, field.width, record_size);
+            return 1;
+        }
+        key_bytes += field.width;
+    }
+    if (key_bytes > max_key_bytes)
+    {
+        std::fprintf(stderr, "the keys are %zu bytes together, the limit is %zu\n", key_bytes, max_key_bytes);
+        return 1;
+    }
+
+    bool in_place = paths.size() == 1;
+    int input = open(paths[0], in_place ? O_RDWR : O_RDONLY);
+    if (input < 0)
+    {
+        std::fprintf(stderr, "couldn't open %s: %s\n", paths[0], std::strerror(errno));
+        return 1;
+    }
+    struct stat input_stat;
+    if (fstat(input, &input_stat) != 0)
+    {
+        std::fprintf(stderr, "couldn't stat %s: %s\n", paths[0], std::strerror(errno));
+        return 1;
+    }
+    std::size_t num_bytes = static_cast<std::size_t>(input_stat.st_size);
+    if (num_bytes % record_size)
+    {
+        std::fprintf(stderr, "%s has %zu bytes, which isn't a multiple of the record size %zu\n", paths[0], num_bytes, record_size);
+        return 1;
+    }
+    unsigned char * input_map = static_cast<unsigned char *>(map_file(input, num_bytes, in_place ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED));
+    if (num_bytes && !input_map)
+    {
+        std::fprintf(stderr, "couldn't map %s: %s\n", paths[0], std::strerror(errno));
+        return 1;
+    }
+
+    int output = input;
+    unsigned char * output_map = input_map;
+    if (!in_place)
+    {
+        // with O_TRUNC the output can't be the input, because that would
+        // throw away the records before they are read
+        output = open(paths[1], O_RDWR | O_CREAT, 0666);
+        if (output < 0)
+        {
+            std::fprintf(stderr, "couldn't open %s: %s\n", paths[1], std::strerror(errno));
+            return 1;
+        }
+        struct stat output_stat;
+        if (fstat(output, &output_stat) == 0 && output_stat.st_dev == input_stat.st_dev && output_stat.st_ino == input_stat.st_ino)
+        {
+            std::fprintf(stderr, "the output is the input, leave out the output to sort in place\n");
+            return 1;
+        }
+        if (ftruncate(output, static_cast<off_t>(num_bytes)) != 0)
+        {
+            std::fprintf(stderr, "couldn't resize %s: %s\n", paths[1], std::strerror(errno));
+            return 1;
+        }
+        output_map = static_cast<unsigned char *>(map_file(output, num_bytes, PROT_READ | PROT_WRITE, MAP_SHARED));
+        if (num_bytes && !output_map)
+        {
+            std::fprintf(stderr, "couldn't map %s: %s\n", paths[1], std::strerror(errno));
+            return 1;
+        }
+    }
+
+    sort_records(input_map, output_map, num_bytes / record_size, layout);
+
+    int result = 0;
+    if (num_bytes && msync(output_map, num_bytes, MS_SYNC) != 0)
+    {
+        std::fprintf(stderr, "couldn't write %s: %s\n", paths.back(), std::strerror(errno));
+        result = 1;
+    }
+    if (num_bytes)
+    {
+        munmap(input_map, num_bytes);
+        if (!in_place)
+            munmap(output_map, num_bytes);
+    }
+    if (!in_place)
+        close(output);
+    close(input);
+    return result;
+}
@@ -0,0 +1,157 @@
+//          Copyright Malte Skarupke 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+// the key encoding and the record permutation of radix_sort_file. they are
+// in a header so that they can be tested on their own
+
+struct KeyField
+{
+    std::size_t offset = 0;
+    std::size_t width = 0;
+    enum Type { unsigned_type, signed_type, float_type } type = unsigned_type;
+    bool big_endian = false;
+    bool descending = false;
+};
+
+inline bool parse_size(const std::string & text, std::size_t & result)
+{
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    errno = 0;
+    unsigned long long value = std::strtoull(text.c_str(), nullptr, 10);
+    if (errno || value > std::numeric_limits<std::size_t>::max())
+        return false;
+    result = static_cast<std::size_t>(value);
+    return true;
+}
+
+// parses OFFSET:WIDTH followed by the optional fields of --key
+inline bool parse_key_field(const std::string & text, KeyField & field)
+{
+    std::vector<std::string> parts;
+    for (std::size_t begin = 0;;)
+    {
+        std::size_t end = text.find(':', begin);
+        parts.push_back(text.substr(begin, end - begin));
+        if (end == std::string::npos)
+            break;
+        begin = end + 1;
+    }
+    if (parts.size() < 2 || !parse_size(parts[0], field.offset) || !parse_size(parts[1], field.width))
+        return false;
+    for (std::size_t i = 2; i < parts.size(); ++i)
+    {
+        const std::string & part = parts[i];
+        if (part == "u")
+            field.type = KeyField::unsigned_type;
+        else if (part == "s")
+            field.type = KeyField::signed_type;
+        else if (part == "f")
+            field.type = KeyField::float_type;
+        else if (part == "le")
+            field.big_endian = false;
+        else if (part == "be")
+            field.big_endian = true;
+        else if (part == "asc")
+            field.descending = false;
+        else if (part == "desc")
+            field.descending = true;
+        else
+            return false;
+    }
+    if (field.width < 1 || field.width > 8)
+        return false;
+    if (field.type == KeyField::float_type && field.width != 4 && field.width != 8)
+        return false;
+    return true;
+}
+
+// turns the bytes of the field into an unsigned number with the same order
+// as the field, in the lowest width * 8 bits. this is the same thing that
+// detail::to_unsigned does for the built in types
+inline std::uint64_t read_key_field(const unsigned char * record, const KeyField & field)
+{
+    const unsigned char * bytes = record + field.offset;
+    std::uint64_t value = 0;
+    if (field.big_endian)
+    {
+        for (std::size_t i = 0; i < field.width; ++i)
+            value = (value << 8) | bytes[i];
+    }
+    else
+    {
+        for (std::size_t i = field.width; i-- > 0;)
+            value = (value << 8) | bytes[i];
+    }
+    std::uint64_t sign_bit = std::uint64_t(1) << (field.width * 8 - 1);
+    std::uint64_t mask = sign_bit | (sign_bit - 1);
+    if (field.type == KeyField::signed_type)
+        value ^= sign_bit;
+    else if (field.type == KeyField::float_type)
+        value = (value & sign_bit) ? (~value & mask) : (value | sign_bit);
+    if (field.descending)
+        value = ~value & mask;
+    return value;
+}
+
+// the fields get packed back to back starting at the most significant byte
+// of the first word. the bytes at the end that no field uses are zero in
+// every key, so the sort skips them
+template<std::size_t NumWords>
+void pack_key(const unsigned char * record, const std::vector<KeyField> & fields, std::array<std::uint64_t, NumWords> & key)
+{
+    key.fill(0);
+    std::size_t bit = 0;
+    for (const KeyField & field : fields)
+    {
+        std::uint64_t value = read_key_field(record, field);
+        std::size_t num_bits = field.width * 8;
+        std::size_t word = bit / 64;
+        std::size_t used = bit % 64;
+        std::size_t fits = std::min(num_bits, 64 - used);
+        key[word] |= (value >> (num_bits - fits)) << (64 - used - fits);
+        if (fits < num_bits)
+            key[word + 1] |= value << (64 - (num_bits - fits));
+        bit += num_bits;
+    }
+}
+
+// moves the records so that position i has the record that was at
+// permutation[i], by following the cycles of the permutation. this needs no
+// second copy of the file. the permutation is left as the identity
+template<typename Index>
+void permute_in_place(unsigned char * records, std::size_t record_size, std::vector<Index> & permutation)
+{
+    std::vector<unsigned char> temp(record_size);
+    for (std::size_t i = 0; i < permutation.size(); ++i)
+    {
+        if (permutation[i] == i)
+            continue;
+        std::memcpy(temp.data(), records + i * record_size, record_size);
+        std::size_t position = i;
+        for (;;)
+        {
+            std::size_t source = permutation[position];
+            permutation[position] = static_cast<Index>(position);
+            if (source == i)
+                break;
+            std::memcpy(records + position * record_size, records + source * record_size, record_size);
+            position = source;
+        }
+        std::memcpy(records + position * record_size, temp.data(), record_size);
+    }
+}